@@ -4,75 +4,480 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <semaphore.h>
+#include <errno.h>
 #include <stdbool.h>
-
-#define MAX_ALARMS_PER_THREAD 2
-#define CIRCULAR_BUFFER_SIZE 4
-
+#include <limits.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include "timer_queue.h"
+#include "alarm_index.h"
+#include "ring.h"
+#include "pool.h"
+#include "string_arena.h"
+#include "tick_clock.h"
+#include "command.h"
+#include "output.h"
+#include "event_log.h"
+#include "epoch.h"
+#include "metrics.h"
+#include "lock_profile.h"
+#include "mailbox.h"
+
+#define DISPLAY_SLOTS 16 // Initial size of a display thread's alarm array
+#define GROUP_SLOTS 8 // Initial size of a group's member array
+#define REBALANCE_SLACK 8 // Extra alarms a display thread may have over the least loaded
+#define VIEW_SLOTS 1024 // Initial size of view_table
+#define CIRCULAR_BUFFER_SIZE 64 // Default capacity, a power of 2; set with -b
+#define CONSUMER_THREADS 4 // Default number of consumer threads; set with -c
+#define POOL_SLAB_OBJECTS 64 // Objects allocated at a time by each pool
+#define REQUEST_BATCH 256 // Most Start_Alarms sent to a consumer at once
+#define INPUT_CHUNK 65536 // Bytes of commands read at a time
+#define STATS_INTERVAL 10 // Default seconds between reports to the --stats file
+
+// Request opcodes, one for each command. Each command has its own queue
+// and worker thread, so a worker never looks at other types of request.
+typedef enum request_type {
+    START_ALARM,
+    CHANGE_ALARM,
+    CANCEL_ALARM,
+    SUSPEND_ALARM,
+    REACTIVATE_ALARM,
+    VIEW_ALARMS,
+    START_ALARM_BATCH, // A chain of Start_Alarms, sent as one
+    STATS, // Every consumer is given it, as it is the group requests
+    CANCEL_GROUP, // Group requests: every consumer is given them
+    SUSPEND_GROUP,
+    REACTIVATE_GROUP,
+    VIEW_GROUP
+} request_type_t;
+
+// Command names, indexed by request_type_t, for messages
+const char *request_type_names[] = {
+    "Start_Alarm",
+    "Change_Alarm",
+    "Cancel_Alarm",
+    "Suspend_Alarm",
+    "Reactivate_Alarm",
+    "View_Alarms",
+    "Start_Alarm_Batch",
+    "Stats",
+    "Cancel_Group",
+    "Suspend_Group",
+    "Reactivate_Group",
+    "View_Group"
+};
 
 //VERYfinal
 //alarm structure
 //global alarm
+// The fields the worker and display threads test on every pass come first,
+// with the flags packed into one word, so they share the first cache line.
+// The worker threads tell an alarm's display thread of a change by message
+// (see display_post), not by setting flags for it to find; mail counts the
+// messages on their way, so that the alarm is not moved from under them.
+// Alarms are allocated from alarm_pool, whose slabs are contiguous arrays.
+// The message is interned in message_arena rather than stored in the alarm.
 typedef struct alarm_tag {
-    struct alarm_tag *link;
-    int seconds;
-    int remaining_sec;
-    time_t time;
-    char message[128];
+    timer_node_t timer; // timer.time is the expiration time
     int alarm_id;
-    int suspend_status; //ADDED
-    time_t timestamp;  //ADDED
-    char request_type[20];  //ADDED
-    int alarm_request;
     int group_id; // Added group_id
     int interval; // Added interval
-    time_t last_printed; // Added last printed time
-    int changed_group; // Added changed group flag
-    int message_changed; // Add this
-    int interval_changed; // Add this
-    int cancelled;
-    int processed;
-    int memory_owner;
-    int suspended_printed;
-    pthread_t display_thread_id;
+    int seconds;
+    unsigned char request_type; // A request_type_t
+    // The flags share a byte, so are read and written only with the mutex of
+    // the alarm's shard held (or every shard's); a request sent to every
+    // consumer is in no shard, and uses command_pending with alarm_mutex.
+    unsigned char suspended : 1;
+    unsigned char suspended_printed : 1;
+    unsigned char processed : 1;
+    unsigned char memory_owner : 1;
+    unsigned char command_pending : 1; // A command for this alarm is queued and not yet handled
+    _Atomic unsigned short mail; // Messages posted to its display thread and not yet taken
+    int group_slot; // Index in its group's members array, while on alarm_queue
+    struct alarm_tag *link;
+    timer_node_t print_timer; // print_timer.time is the next print time
+    const char *message; // Interned in message_arena
+    time_t timestamp;  //ADDED
+    int owner; // Index of its display thread in display_threads, -1 if none
+    int view_slot; // Slot in view_table, -1 if not on alarm_queue
+    union {
+        int remaining_sec; // Of a suspended alarm
+        int consumers_left; // Of a request sent to every consumer, those yet to take it
+    };
+    int display_slot; // Index in its display thread's alarms array
 } alarm_t;
 
-alarm_t *change_alarm_list = NULL;
-
+// What View_Alarms shows of an alarm on alarm_queue. A published record is
+// never changed: a change publishes a new one in its slot of view_table and
+// retires the old one to view_epoch, to be freed once no view can see it.
+typedef struct alarm_view {
+    epoch_node_t node; // On a retired list, once replaced
+    int alarm_id;
+    int group_id;
+    int suspend_status;
+    pthread_t owner; // Thread id of its display thread, 0 if unassigned
+} alarm_view_t;
+
+// The records View_Alarms walks, one slot per alarm on alarm_queue. A full
+// table is replaced by one twice the size, and retired like a record.
+typedef struct view_table {
+    epoch_node_t node;
+    int size;
+    alarm_view_t *_Atomic slots[];
+} view_table_t;
+
+// FIFO of pending requests for one worker thread, linked through
+// alarm->link. Protected by its own mutex, which is held only to add or
+// take a request, so requests for alarms in different shards are queued
+// in parallel. The worker waits on cond, with mutex, while it is empty.
+typedef struct request_queue {
+    alarm_t *head;
+    alarm_t **tail;
+    int count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} request_queue_t;
+
+#define REQUEST_QUEUE_INITIALIZER(queue) \
+    { NULL, &(queue).head, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+
+// Who posts to a display thread's mailboxes: each worker thread that
+// changes alarms has a mailbox of its own in each display thread, so that
+// every mailbox has one producer and one consumer.
+typedef enum display_sender {
+    FROM_SUSPEND_REACTIVATE,
+    FROM_CHANGE,
+    FROM_CANCEL, // Taken last, with every shard's mutex, as it frees the alarm
+    DISPLAY_SENDERS
+} display_sender_t;
+
+// The messages a display thread acts on, each about one of its alarms.
+typedef enum display_message_type {
+    DISPLAY_SUSPEND, // Stop printing it
+    DISPLAY_REACTIVATE, // Print it again, at once
+    DISPLAY_GROUP_CHANGED, // Changed, perhaps to another group
+    DISPLAY_MESSAGE_CHANGED,
+    DISPLAY_INTERVAL_CHANGED,
+    DISPLAY_CANCEL // Take it out and free it
+} display_message_type_t;
+
+// One of the fixed pool of display threads started by main. Each prints
+// any number of alarms, which it keeps in a growable array. Its mutex
+// protects its fields, and the message, interval, group_id and print_timer
+// of its alarms, which it reads while printing; it waits for work with its
+// mutex alone, so printing does not hold up the workers.
+// Its alarms are added and removed (changing alarm_count and owner) with
+// alarm_mutex, the alarm's shard's mutex and its own mutex held, so any of
+// them is enough to read an alarm's owner, and alarm_mutex or its own mutex
+// to read alarm_count. Suspensions and changes come to it as messages, which
+// it takes with only its own mutex, and cancellations as messages it takes
+// with every shard's mutex.
 typedef struct display_thread {
     pthread_t thread_id;
+    profiled_mutex_t mutex;
+    char mutex_name[33]; // For the lock profile; room for any thread number
+    atomic_int load; // alarm_count, for other display threads to read without a lock
     int alarm_count;
-    alarm_t *alarms[MAX_ALARMS_PER_THREAD];
-    struct display_thread *next;
-    int group_id; // Added group_id
+    int alarm_capacity;
+    alarm_t **alarms;
+    timer_queue_t print_queue; // Next print time of each assigned alarm
+    time_t next_expiry; // Earliest expiry of its alarms when last looked at
+    mailbox_t mailboxes[DISPLAY_SENDERS];
+    pthread_cond_t wakeup; // With mutex; signalled after a post, times out on CLOCK_MONOTONIC
 } display_thread_t;
 
-pthread_mutex_t alarm_mutex = PTHREAD_MUTEX_INITIALIZER;
+// One group, as the display threads see it: the display thread its new
+// alarms go to, and how many of its alarms are assigned. New alarms in a
+// group go to its home display thread, so a group's alarms are printed
+// together, unless the home has REBALANCE_SLACK more alarms than the least
+// loaded display thread. Kept in group_index by group_id while the group has
+// assigned alarms or a group command pending. Protected by alarm_mutex.
+typedef struct alarm_group {
+    int group_id;
+    display_thread_t *home;
+    int alarm_count; // Assigned to display threads
+    bool command_pending; // A group command for it is queued and not yet handled
+} alarm_group_t;
+
+// The members of a group that are in one shard: its alarms on the shard's
+// alarm_queue, so that the group commands take time in proportion to the
+// size of the group. Kept in the shard's group_index by group_id while it
+// has members. Protected by the shard's mutex.
+typedef struct group_members {
+    int group_id;
+    int member_count;
+    int member_capacity;
+    alarm_t **members; // Each at its group_slot
+} group_members_t;
+
+// Lock order: alarm_mutex, then the shards' mutexes, in the order of
+// consumer_shards, then display thread mutexes, in the order of
+// display_threads, then view_mutex or a request queue's mutex, which are
+// never held together. A thread that holds a later mutex and needs an
+// earlier one unlocks the later one first. The pools, message arena, output buffers, event log and metrics
+// have locks of their own, if any, which are taken last.
+//
+// A command for one alarm takes only its shard's mutex, so commands for
+// alarms in different shards run in parallel. alarm_mutex protects the group
+// records in group_index, which display thread each alarm is assigned to,
+// and the count of consumers yet to take a request sent to all of them. It
+// is taken, with every shard's mutex after it (alarm_lock_all), for work on
+// alarms that may be in any shard: the group commands, and a display thread
+// freeing or moving its alarms.
+profiled_mutex_t alarm_mutex; // Profiled when compiled with -DLOCK_PROFILE
 pthread_cond_t alarm_cond = PTHREAD_COND_INITIALIZER;
-alarm_t *alarm_list = NULL;
-display_thread_t *display_threads = NULL;
-
-// Circular buffer sahred by main and consumer thread 
-alarm_t *circular_buffer[CIRCULAR_BUFFER_SIZE];
-int buffer_head = 0;
-int buffer_tail = 0;
-int buffer_count = 0;
-pthread_mutex_t buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t buffer_not_full = PTHREAD_COND_INITIALIZER;
-pthread_cond_t buffer_not_empty = PTHREAD_COND_INITIALIZER;
+timer_queue_kind_t timer_queue_kind = TIMER_QUEUE_HEAP; // Selected with -q
+display_thread_t *display_threads; // The display thread pool
+int display_thread_count; // Set with -d, one per processor by default
+alarm_index_t group_index = ALARM_INDEX_INITIALIZER; // alarm_group_t by group_id
+pthread_cond_t group_command_done = PTHREAD_COND_INITIALIZER; // With alarm_mutex
+
+// Requests and groups are allocated in one thread and freed in another,
+// so they come from pools (pool.c) rather than malloc.
+pool_t alarm_pool;
+pool_t group_pool;
+pool_t members_pool;
+pool_t view_pool;
+string_arena_t message_arena; // Alarm messages, shared by equal alarms
+
+// One request queue per worker thread. Each worker waits on its own queue
+// until a request of its type arrives, rather than polling every second.
+request_queue_t start_queue = REQUEST_QUEUE_INITIALIZER(start_queue); // Start_Alarms not yet given to a display thread
+request_queue_t change_queue = REQUEST_QUEUE_INITIALIZER(change_queue);
+request_queue_t cancel_queue = REQUEST_QUEUE_INITIALIZER(cancel_queue);
+request_queue_t suspend_reactivate_queue = REQUEST_QUEUE_INITIALIZER(suspend_reactivate_queue);
+request_queue_t view_queue = REQUEST_QUEUE_INITIALIZER(view_queue);
+// Earliest expiry the cancel thread must wake for, 0 if none, with
+// cancel_queue's mutex
+time_t current_expiry = 0;
+
+// Requests are sharded by alarm_id over a pool of consumer threads, each
+// with its own circular buffer shared with main. Every request for one alarm
+// goes through the same buffer and consumer, so they are taken in order.
+// The buffers are lock-free rings (ring.c); main only blocks when one is full.
+// Each shard also has the alarms whose alarm_id maps to it: its own timer
+// queue, index and group members, under its own mutex, so the consumers
+// and workers handle requests for alarms in different shards in parallel.
+// The mutex also protects the fields of the shard's alarms that the commands
+// change, except those its display thread reads while printing.
+typedef struct consumer_shard {
+    ring_t circular_buffer;
+    pthread_t thread_id;
+    profiled_mutex_t mutex;
+    char mutex_name[24]; // For the lock profile; room for any shard number
+    uint64_t taken; // When mutex was last locked, while it is held
+    timer_queue_t alarm_queue; // Its Start_Alarms, by expiration time
+    alarm_index_t alarm_index; // Alarms on alarm_queue, by alarm_id
+    alarm_index_t group_index; // group_members_t by group_id
+    pthread_cond_t command_done; // With mutex: a queued command for one of its alarms has been handled
+} consumer_shard_t;
+
+consumer_shard_t *consumer_shards;
+int consumer_count = CONSUMER_THREADS;
 
 int most_recent_displayed_alarm_id = -1; // Shared variable
 
-// Readers-Writers synchronization
-sem_t read_count_mutex;
-sem_t resource_mutex;
-int read_count = 0;
+// View_Alarms reads view_table with no lock, under view_epoch; writers
+// hold view_mutex, so that alarms in different shards may change their
+// records at once. Free slots are kept on a stack.
+pthread_mutex_t view_mutex = PTHREAD_MUTEX_INITIALIZER;
+view_table_t *_Atomic view_table;
+epoch_t view_epoch;
+int *view_free_slots;
+int view_free_count;
+int view_slots_used; // Slots ever handed out; the rest are free
+
+// Runtime metrics (metrics.h), shown by the Stats command and written to
+// the --stats file. Each thread records into its own block, with no lock.
+// Commands are counted by command_kind_t.
+enum {
+    METRIC_BAD_COMMANDS = COMMAND_STATS + 1,
+    METRIC_COUNTERS
+};
+
+enum {
+    METRIC_RING_OCCUPANCY, // Requests in a buffer, after each insert
+    METRIC_RING_BLOCKED, // Nanoseconds main waited on a full buffer
+    METRIC_LOCK_WAIT, // Nanoseconds taken to lock alarm_mutex
+    METRIC_LOCK_HOLD, // Nanoseconds alarm_mutex was held at a time
+    METRIC_SHARD_LOCK_WAIT, // Nanoseconds taken to lock a shard's mutex
+    METRIC_SHARD_LOCK_HOLD, // Nanoseconds a shard's mutex was held at a time
+    METRIC_EXPIRY_LATENESS, // Nanoseconds from an expiry to its removal
+    METRIC_HISTOGRAMS
+};
+
+enum {
+    METRIC_ALARMS, // Of each display thread
+    METRIC_GAUGES
+};
+
+const char *const metric_counter_names[METRIC_COUNTERS] = {
+    "Start_Alarm commands",
+    "Change_Alarm commands",
+    "Cancel_Alarm commands",
+    "Suspend_Alarm commands",
+    "Reactivate_Alarm commands",
+    "View_Alarms commands",
+    "Cancel_Group commands",
+    "Suspend_Group commands",
+    "Reactivate_Group commands",
+    "View_Group commands",
+    "Stats commands",
+    "Bad commands"
+};
+
+const char *const metric_histogram_names[METRIC_HISTOGRAMS] = {
+    "Circular_Buffer occupancy",
+    "Circular_Buffer blocked ns",
+    "alarm_mutex wait ns",
+    "alarm_mutex hold ns",
+    "Shard mutex wait ns",
+    "Shard mutex hold ns",
+    "Expiry lateness ns"
+};
+
+const char *const metric_gauge_names[METRIC_GAUGES] = {
+    "alarms"
+};
+
+char *stats_path; // Set with --stats
+char *stats_temp_path; // stats_path with ".tmp" added
+int stats_interval = STATS_INTERVAL; // Set with --stats-interval
+
+// When the calling thread last took alarm_mutex
+__thread uint64_t alarm_mutex_taken;
+
+// alarm_mutex is only locked, unlocked and waited on through these, which
+// record the wait and hold times in the metrics and pass the caller's file
+// and line to the lock profile.
+#define alarm_lock() alarm_lock_at(__FILE__, __LINE__)
+#define alarm_unlock() alarm_unlock_at()
+#define alarm_wait(cond, deadline) alarm_wait_at(cond, deadline, __FILE__, __LINE__)
+
+// Lock alarm_mutex, recording how long it took. Returns the status of
+// pthread_mutex_lock.
+int alarm_lock_at(const char *file, int line) {
+    uint64_t start = metrics_now();
+    int status = profiled_mutex_lock_at(&alarm_mutex, file, line);
+
+    alarm_mutex_taken = metrics_now();
+    metrics_record(METRIC_LOCK_WAIT, alarm_mutex_taken - start);
+    return status;
+}
+
+// Unlock alarm_mutex, recording how long it was held.
+int alarm_unlock_at(void) {
+    metrics_record(METRIC_LOCK_HOLD, metrics_now() - alarm_mutex_taken);
+    return profiled_mutex_unlock_at(&alarm_mutex);
+}
+
+// Wait on cond with alarm_mutex until the deadline, in ticks, or with no
+// timeout if it is 0. The time alarm_mutex was held is recorded up to the
+// wait; the time taken to relock it cannot be told apart from the sleep,
+// so it is not. Returns the status of the wait.
+int alarm_wait_at(pthread_cond_t *cond, time_t deadline, const char *file, int line) {
+    int status;
+
+    metrics_record(METRIC_LOCK_HOLD, metrics_now() - alarm_mutex_taken);
+    profiled_mutex_waiting_at(&alarm_mutex);
+    status = deadline == 0
+        ? pthread_cond_wait(cond, &alarm_mutex.mutex)
+        : tick_clock_timedwait(cond, &alarm_mutex.mutex, deadline);
+    profiled_mutex_woken_at(&alarm_mutex, file, line);
+    alarm_mutex_taken = metrics_now();
+    return status;
+}
+
+// A shard's mutex is only locked, unlocked and waited on through these,
+// which, as for alarm_mutex, record the wait and hold times in the metrics
+// and pass the caller's file and line to the lock profile.
+#define shard_lock(shard) shard_lock_at(shard, __FILE__, __LINE__)
+#define shard_unlock(shard) shard_unlock_at(shard)
+#define shard_wait(shard, cond) shard_wait_at(shard, cond, __FILE__, __LINE__)
+#define alarm_lock_all() alarm_lock_all_at(__FILE__, __LINE__)
+
+// The shard that holds an alarm, and whose consumer takes its requests
+consumer_shard_t *alarm_shard(int alarm_id) {
+    return &consumer_shards[(unsigned int)alarm_id % consumer_count];
+}
+
+// Lock a shard's mutex, recording how long it took. Returns the status of
+// pthread_mutex_lock.
+int shard_lock_at(consumer_shard_t *shard, const char *file, int line) {
+    uint64_t start = metrics_now();
+    int status = profiled_mutex_lock_at(&shard->mutex, file, line);
+
+    shard->taken = metrics_now();
+    metrics_record(METRIC_SHARD_LOCK_WAIT, shard->taken - start);
+    return status;
+}
+
+// Unlock a shard's mutex, recording how long it was held.
+int shard_unlock_at(consumer_shard_t *shard) {
+    metrics_record(METRIC_SHARD_LOCK_HOLD, metrics_now() - shard->taken);
+    return profiled_mutex_unlock_at(&shard->mutex);
+}
+
+// Wait on cond with a shard's mutex, recording the hold time up to the wait
+// as alarm_wait does. Returns the status of the wait.
+int shard_wait_at(consumer_shard_t *shard, pthread_cond_t *cond, const char *file, int line) {
+    int status;
+
+    metrics_record(METRIC_SHARD_LOCK_HOLD, metrics_now() - shard->taken);
+    profiled_mutex_waiting_at(&shard->mutex);
+    status = pthread_cond_wait(cond, &shard->mutex.mutex);
+    profiled_mutex_woken_at(&shard->mutex, file, line);
+    shard->taken = metrics_now();
+    return status;
+}
+
+// Lock alarm_mutex and then every shard's mutex, in the lock order, for work
+// on alarms that may be in any shard.
+void alarm_lock_all_at(const char *file, int line) {
+    alarm_lock_at(file, line);
+    for (int i = 0; i < consumer_count; i++) {
+        shard_lock_at(&consumer_shards[i], file, line);
+    }
+}
+
+void alarm_unlock_all(void) {
+    for (int i = consumer_count - 1; i >= 0; i--) {
+        shard_unlock(&consumer_shards[i]);
+    }
+    alarm_unlock();
+}
+
+// A display thread's mutex is locked through these, which pass the caller's
+// file and line to the lock profile.
+#define display_lock(thread) profiled_mutex_lock(&(thread)->mutex)
+#define display_unlock(thread) profiled_mutex_unlock(&(thread)->mutex)
+
+// Lock the mutexes of two display threads, which may be the same, in the
+// lock order.
+void display_lock_pair(display_thread_t *a, display_thread_t *b) {
+    if (b < a) {
+        display_thread_t *t = a;
+        a = b;
+        b = t;
+    }
+    display_lock(a);
+    if (b != a) {
+        display_lock(b);
+    }
+}
+
+void display_unlock_pair(display_thread_t *a, display_thread_t *b) {
+    if (b != a) {
+        display_unlock(b);
+    }
+    display_unlock(a);
+}
 
 void sort_alarms_by_time(alarm_t *alarms[], int count) {
     for (int i = 0; i < count - 1; i++) {
         for (int j = 0; j < count - i - 1; j++) {
-            if (alarms[j] != NULL && alarms[j + 1] != NULL && alarms[j]->time > alarms[j + 1]->time) {
+            if (alarms[j] != NULL && alarms[j + 1] != NULL && alarms[j]->timer.time > alarms[j + 1]->timer.time) {
                 alarm_t *temp = alarms[j];
                 alarms[j] = alarms[j + 1];
                 alarms[j + 1] = temp;
@@ -81,1130 +486,2262 @@ void sort_alarms_by_time(alarm_t *alarms[], int count) {
     }
 }
 
-void *display_alarm_thread(void *arg) {
-    display_thread_t *display_thread_data = (display_thread_t *)arg;
-    int last_alarm_group_id = display_thread_data->group_id;
-    // printf("DEBUG: display_alarm_thread started\n");
-    // printf("DEBUG: display_thread_data address: %p\n", (void *)display_thread_data);
-    // if (display_thread_data != NULL) {
-    //     printf("DEBUG: display_thread_data->alarm_count: %d\n",
-    //            display_thread_data->alarm_count);
-    //     printf("DEBUG: display_thread_data->group_id: %d\n",
-    //            display_thread_data->group_id);
-    //     if (display_thread_data->alarm_count > 0) {
-    //         printf("DEBUG: display_thread_data->alarms[0]: %p\n",
-    //                (void *)display_thread_data->alarms[0]);
-    //     }
-    // } else {
-    //     printf("DEBUG: display_thread_data is NULL!\n");
-    //     pthread_exit(NULL);
-    // }
+// Free an alarm or request, and its message.
+void free_alarm(alarm_t *alarm) {
+    string_arena_release(&message_arena, alarm->message);
+    pool_free(&alarm_pool, alarm);
+}
 
-    while (1) {
-        time_t current_time = time(NULL);
-        pthread_mutex_lock(&alarm_mutex); // Protect shared data
+// Append a request to a queue and wake its worker thread.
+void request_queue_push(request_queue_t *queue, alarm_t *request) {
+    request->link = NULL;
+    pthread_mutex_lock(&queue->mutex);
+    *queue->tail = request;
+    queue->tail = &request->link;
+    queue->count++;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
 
-        int active_alarms = 0; // To track active alarms for thread exit
+// Remove and return the oldest request in a queue, or NULL if it is empty.
+alarm_t *request_queue_pop(request_queue_t *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    alarm_t *request = queue->head;
+    if (request != NULL) {
+        queue->head = request->link;
+        if (queue->head == NULL) {
+            queue->tail = &queue->head;
+        }
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return request;
+}
 
-        // Iterate through the alarms assigned to this thread
-        for (int i = 0; i < display_thread_data->alarm_count; i++) {
-            alarm_t *alarm = display_thread_data->alarms[i];
-            if (alarm == NULL) continue; // Skip NULL entries
+// Wait until a queue has a request. Only its worker thread takes requests
+// from it, so it still has one on return.
+void request_queue_wait(request_queue_t *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->head == NULL) {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+}
 
-            // 1. Check for Cancellation
-            if (alarm->cancelled == 1) {
-                printf("Alarm(%d) Cancelled, freeing memory.\n", alarm->alarm_id);
-                free(alarm);
-                display_thread_data->alarms[i] = NULL;
-                continue;
-            }
+// Print the requests waiting in a queue, and the time each has left.
+void print_request_queue(const char *title, request_queue_t *queue) {
+    time_t now = tick_clock_now();
 
-            // 2. Check for Suspension
-            if (alarm->suspend_status == 1) {
-                printf("Alarm(%d) is suspended. Skipping print.\n", alarm->alarm_id);
-                continue;
-            }
+    pthread_mutex_lock(&queue->mutex);
+    output_printf("[%s: ", title);
+    for (alarm_t *next = queue->head; next != NULL; next = next->link) {
+        output_printf("(%g sec) [\"%s\"] ", tick_clock_seconds(next->timer.time - now), next->message);
+    }
+    output_printf("]\n");
+    pthread_mutex_unlock(&queue->mutex);
+}
 
-            if (alarm->last_printed != 0 && current_time < alarm->last_printed + alarm->interval) {
-                // Not time to print yet, skip this alarm
-                active_alarms++;
-                continue;
+// Find the Start_Alarm for alarm_id, in its shard, that was requested before
+// the given time. The caller must hold the shard's mutex.
+alarm_t *find_start_alarm(consumer_shard_t *shard, int alarm_id, time_t timestamp) {
+    alarm_index_entry_t *entry = alarm_index_find(&shard->alarm_index, alarm_id);
+    if (entry != NULL && ((alarm_t *)entry->alarm)->timestamp <= timestamp) {
+        return entry->alarm;
+    }
+    return NULL;
+}
+
+// Queue a command for its worker thread once every command queued before it
+// for the same alarm has been handled. Different threads handle each type of
+// command, so without this a Cancel_Alarm could overtake an earlier
+// Change_Alarm for the same alarm. The caller must hold the mutex of the
+// alarm's shard.
+void queue_command(consumer_shard_t *shard, request_queue_t *queue, alarm_t *request) {
+    alarm_t *target;
+    while ((target = find_start_alarm(shard, request->alarm_id, request->timestamp)) != NULL &&
+           target->command_pending) {
+        shard_wait(shard, &shard->command_done);
+    }
+    if (target != NULL) {
+        target->command_pending = 1;
+    }
+    request_queue_push(queue, request);
+}
+
+// Record that a worker thread has handled a command for target, which may
+// be NULL if the alarm has gone: expired, or cancelled with its group while
+// the command was queued. Commands waiting behind it then go ahead too.
+// The caller must hold the mutex of the alarm's shard.
+void command_handled(consumer_shard_t *shard, alarm_t *target) {
+    if (target != NULL) {
+        target->command_pending = 0;
+    }
+    pthread_cond_broadcast(&shard->command_done);
+}
+
+// Free a view record, or a view table, once no view can be using it.
+void free_view(epoch_node_t *node) {
+    pool_free(&view_pool, node);
+}
+
+void free_view_table(epoch_node_t *node) {
+    free(node);
+}
+
+// Publish a record in an alarm's slot of view_table, and retire the one it
+// replaces. The caller must hold view_mutex.
+void view_publish(alarm_t *alarm, alarm_view_t *view) {
+    view_table_t *table = atomic_load_explicit(&view_table, memory_order_relaxed);
+    alarm_view_t *old = atomic_exchange(&table->slots[alarm->view_slot], view);
+    if (old != NULL) {
+        epoch_retire(&view_epoch, &old->node, free_view);
+    }
+}
+
+// Publish a new record of what View_Alarms shows of an alarm, if it is on
+// alarm_queue. If there is no memory, views show the old record. The caller
+// must hold the mutex of the alarm's shard.
+void view_update(alarm_t *alarm) {
+    if (alarm->view_slot < 0) {
+        return;
+    }
+    alarm_view_t *view = (alarm_view_t *)pool_alloc(&view_pool);
+    if (view == NULL) {
+        return;
+    }
+    view->alarm_id = alarm->alarm_id;
+    view->group_id = alarm->group_id;
+    view->suspend_status = alarm->suspended;
+    view->owner = alarm->owner < 0 ? 0 : display_threads[alarm->owner].thread_id;
+    pthread_mutex_lock(&view_mutex);
+    view_publish(alarm, view);
+    pthread_mutex_unlock(&view_mutex);
+}
+
+// Give an alarm a slot in view_table, growing the table if every slot is
+// taken. Returns 0, or -1 if there is no memory. The caller must hold
+// view_mutex.
+int view_slot_get(alarm_t *alarm) {
+    view_table_t *table = atomic_load_explicit(&view_table, memory_order_relaxed);
+    if (view_free_count > 0) {
+        alarm->view_slot = view_free_slots[--view_free_count];
+        return 0;
+    }
+    if (table == NULL || view_slots_used == table->size) {
+        int size = table == NULL ? VIEW_SLOTS : table->size * 2;
+        int *free_slots = (int *)realloc(view_free_slots, size * sizeof(int));
+        if (free_slots != NULL) {
+            view_free_slots = free_slots;
+        }
+        view_table_t *larger = (view_table_t *)malloc(sizeof(view_table_t) + size * sizeof(alarm_view_t *));
+        if (free_slots == NULL || larger == NULL) {
+            free(larger);
+            return -1;
+        }
+        larger->size = size;
+        for (int i = 0; i < size; i++) {
+            atomic_init(&larger->slots[i], i < view_slots_used ? atomic_load(&table->slots[i]) : NULL);
+        }
+        atomic_store_explicit(&view_table, larger, memory_order_release);
+        if (table != NULL) {
+            epoch_retire(&view_epoch, &table->node, free_view_table);
+        }
+    }
+    alarm->view_slot = view_slots_used++;
+    return 0;
+}
+
+// Give an alarm just put on alarm_queue a slot in view_table, and publish its
+// record. If there is no memory, the alarm does not appear in views. The
+// caller must hold the mutex of the alarm's shard.
+void view_insert(alarm_t *alarm) {
+    pthread_mutex_lock(&view_mutex);
+    int status = view_slot_get(alarm);
+    pthread_mutex_unlock(&view_mutex);
+    if (status != 0) {
+        output_printf("Start_Alarm: no memory to show Alarm(%d) in views\n", alarm->alarm_id);
+        return;
+    }
+    view_update(alarm);
+}
+
+// Take an alarm leaving alarm_queue out of view_table. The caller must hold
+// the mutex of the alarm's shard.
+void view_remove(alarm_t *alarm) {
+    if (alarm->view_slot < 0) {
+        return;
+    }
+    pthread_mutex_lock(&view_mutex);
+    view_publish(alarm, NULL);
+    view_free_slots[view_free_count++] = alarm->view_slot;
+    pthread_mutex_unlock(&view_mutex);
+    alarm->view_slot = -1;
+}
+
+// Find a group's record, or NULL if it has no assigned alarms and no group
+// command pending. The caller must hold alarm_mutex.
+alarm_group_t *group_find(int group_id) {
+    alarm_index_entry_t *entry = alarm_index_find(&group_index, group_id);
+    return entry == NULL ? NULL : entry->alarm;
+}
+
+// Find a group's record, adding it if it is new. Returns NULL if there is no
+// memory. The caller must hold alarm_mutex.
+alarm_group_t *group_get(int group_id) {
+    alarm_group_t *group = group_find(group_id);
+    if (group != NULL) {
+        return group;
+    }
+    group = (alarm_group_t *)pool_alloc(&group_pool);
+    if (group == NULL) {
+        return NULL;
+    }
+    group->group_id = group_id;
+    group->home = NULL;
+    group->alarm_count = 0;
+    group->command_pending = false;
+    alarm_index_insert(&group_index, group_id, group);
+    return group;
+}
+
+// Drop a group's record once it has no assigned alarms and no group command
+// pending. The caller must hold alarm_mutex.
+void group_put(alarm_group_t *group) {
+    if (group->alarm_count == 0 && !group->command_pending) {
+        alarm_index_remove(&group_index, group->group_id);
+        pool_free(&group_pool, group);
+    }
+}
+
+// Find a group's members in a shard, or NULL if it has none there. The
+// caller must hold the shard's mutex.
+group_members_t *members_find(consumer_shard_t *shard, int group_id) {
+    alarm_index_entry_t *entry = alarm_index_find(&shard->group_index, group_id);
+    return entry == NULL ? NULL : entry->alarm;
+}
+
+// Find a group's members in a shard, adding them if they are new. Returns
+// NULL if there is no memory. The caller must hold the shard's mutex.
+group_members_t *members_get(consumer_shard_t *shard, int group_id) {
+    group_members_t *members = members_find(shard, group_id);
+    if (members != NULL) {
+        return members;
+    }
+    members = (group_members_t *)pool_alloc(&members_pool);
+    if (members == NULL) {
+        return NULL;
+    }
+    members->group_id = group_id;
+    members->member_count = 0;
+    members->member_capacity = 0;
+    members->members = NULL;
+    alarm_index_insert(&shard->group_index, group_id, members);
+    return members;
+}
+
+// Drop a group's members in a shard once there are none. The caller must
+// hold the shard's mutex.
+void members_put(consumer_shard_t *shard, group_members_t *members) {
+    if (members->member_count == 0) {
+        alarm_index_remove(&shard->group_index, members->group_id);
+        free(members->members);
+        pool_free(&members_pool, members);
+    }
+}
+
+// Add an alarm to a group's members. Returns 0, or -1 if there is no memory.
+// The caller must hold the mutex of the alarm's shard.
+int members_add(group_members_t *members, alarm_t *alarm) {
+    if (members->member_count == members->member_capacity) {
+        int capacity = members->member_capacity == 0 ? GROUP_SLOTS : members->member_capacity * 2;
+        alarm_t **array = (alarm_t **)realloc(members->members, capacity * sizeof(alarm_t *));
+        if (array == NULL) {
+            return -1;
+        }
+        members->members = array;
+        members->member_capacity = capacity;
+    }
+    alarm->group_slot = members->member_count;
+    members->members[members->member_count++] = alarm;
+    return 0;
+}
+
+// Remove the member at a slot of a group's members, moving the last member
+// into the gap. The caller must hold the mutex of their shard.
+void members_remove(group_members_t *members, int slot) {
+    alarm_t *last = members->members[--members->member_count];
+    members->members[slot] = last;
+    last->group_slot = slot;
+}
+
+// Add an alarm just put on alarm_queue to its group's members in its shard.
+// Returns 0, or -1 if there is no memory. The caller must hold the mutex of
+// the alarm's shard.
+int group_join(alarm_t *alarm) {
+    consumer_shard_t *shard = alarm_shard(alarm->alarm_id);
+    group_members_t *members = members_get(shard, alarm->group_id);
+    if (members == NULL) {
+        return -1;
+    }
+    if (members_add(members, alarm) != 0) {
+        members_put(shard, members);
+        return -1;
+    }
+    return 0;
+}
+
+// Take an alarm leaving alarm_queue out of its group's members. The caller
+// must hold the mutex of the alarm's shard.
+void group_leave(alarm_t *alarm) {
+    consumer_shard_t *shard = alarm_shard(alarm->alarm_id);
+    group_members_t *members = members_find(shard, alarm->group_id);
+    members_remove(members, alarm->group_slot);
+    members_put(shard, members);
+}
+
+// Take a Start_Alarm off its shard's alarm_queue and out of its alarm_index
+// once it has expired or been cancelled. An alarm is indexed, and is a member
+// of its group, exactly while it is queued. The caller must hold the mutex
+// of the alarm's shard.
+void retire_start_alarm(alarm_t *alarm) {
+    consumer_shard_t *shard = alarm_shard(alarm->alarm_id);
+    if (timer_node_queued(&alarm->timer)) {
+        timer_queue_remove(&shard->alarm_queue, &alarm->timer);
+        alarm_index_remove(&shard->alarm_index, alarm->alarm_id);
+        view_remove(alarm);
+        group_leave(alarm);
+    }
+}
+
+// Find the display thread that an alarm has been assigned to, or NULL.
+// The caller must hold alarm_mutex or the mutex of the alarm's shard.
+display_thread_t *find_display_thread(alarm_t *alarm) {
+    return alarm->owner < 0 ? NULL : &display_threads[alarm->owner];
+}
+
+// Wake a display thread to take its messages, or to work out again when it
+// must next wake. The caller must hold the display thread's mutex.
+void signal_display_thread(display_thread_t *thread) {
+    pthread_cond_signal(&thread->wakeup);
+}
+
+// Have a display thread look for expired alarms by the given time, if it was
+// not going to already. The caller must hold the display thread's mutex.
+void display_expires(display_thread_t *thread, time_t time) {
+    if (thread->next_expiry == 0 || time < thread->next_expiry) {
+        thread->next_expiry = time;
+    }
+}
+
+// Wake the cancel thread if the alarm now expires before the time it is
+// waiting for. The caller must hold the mutex of the alarm's shard.
+void expiry_changed(alarm_t *alarm) {
+    pthread_mutex_lock(&cancel_queue.mutex);
+    if (current_expiry == 0 || alarm->timer.time < current_expiry) {
+        current_expiry = alarm->timer.time;
+        pthread_cond_signal(&cancel_queue.cond);
+    }
+    pthread_mutex_unlock(&cancel_queue.mutex);
+}
+
+// Schedule the alarm's next print one interval after it was last printed.
+// The caller must hold the display thread's mutex.
+void display_rearm(display_thread_t *display_thread, alarm_t *alarm, time_t current_time) {
+    alarm->print_timer.time = current_time + (alarm->interval > 0 ? alarm->interval : tick_clock_ticks(1));
+    if (timer_node_queued(&alarm->print_timer)) {
+        timer_queue_update(&display_thread->print_queue, &alarm->print_timer);
+    } else {
+        timer_queue_insert(&display_thread->print_queue, &alarm->print_timer);
+    }
+}
+
+// Count an assigned alarm in its group, adding the group if it is new.
+// Returns the group, or NULL if there is no memory. The caller must hold
+// alarm_mutex.
+alarm_group_t *group_hold(int group_id) {
+    alarm_group_t *group = group_get(group_id);
+    if (group != NULL) {
+        group->alarm_count++;
+    }
+    return group;
+}
+
+// Stop counting an assigned alarm in its group. The caller must hold
+// alarm_mutex.
+void group_release(int group_id) {
+    alarm_group_t *group = group_find(group_id);
+    group->alarm_count--;
+    group_put(group);
+}
+
+// Pick the display thread for a new alarm in a group: the group's home,
+// unless it has no home or too many alarms, in which case the least loaded
+// display thread becomes its home. The caller must hold alarm_mutex.
+display_thread_t *choose_display_thread(alarm_group_t *group) {
+    display_thread_t *least = &display_threads[0];
+    for (int i = 1; i < display_thread_count; i++) {
+        if (display_threads[i].alarm_count < least->alarm_count) {
+            least = &display_threads[i];
+        }
+    }
+    if (group->home == NULL || group->home->alarm_count > least->alarm_count + REBALANCE_SLACK) {
+        group->home = least;
+    }
+    return group->home;
+}
+
+// Add an alarm to a display thread's array and make it the alarm's owner.
+// Returns 0, or -1 if there is no memory. The caller must hold alarm_mutex,
+// the mutex of the alarm's shard and the display thread's mutex.
+int display_add(display_thread_t *display_thread, alarm_t *alarm) {
+    if (display_thread->alarm_count == display_thread->alarm_capacity) {
+        int capacity = display_thread->alarm_capacity == 0 ? DISPLAY_SLOTS : display_thread->alarm_capacity * 2;
+        alarm_t **alarms = (alarm_t **)realloc(display_thread->alarms, capacity * sizeof(alarm_t *));
+        if (alarms == NULL) {
+            return -1;
+        }
+        display_thread->alarms = alarms;
+        display_thread->alarm_capacity = capacity;
+    }
+    alarm->display_slot = display_thread->alarm_count;
+    display_thread->alarms[display_thread->alarm_count++] = alarm;
+    atomic_store_explicit(&display_thread->load, display_thread->alarm_count, memory_order_relaxed);
+    alarm->owner = (int)(display_thread - display_threads);
+    display_expires(display_thread, alarm->timer.time);
+    view_update(alarm);
+    return 0;
+}
+
+// Remove an alarm from a display thread, moving its last alarm into the
+// gap. The caller must hold alarm_mutex, the mutex of the alarm's shard and
+// the display thread's mutex.
+void display_remove(display_thread_t *display_thread, alarm_t *alarm) {
+    alarm_t *last = display_thread->alarms[--display_thread->alarm_count];
+    atomic_store_explicit(&display_thread->load, display_thread->alarm_count, memory_order_relaxed);
+    display_thread->alarms[alarm->display_slot] = last;
+    last->display_slot = alarm->display_slot;
+    timer_queue_remove(&display_thread->print_queue, &alarm->print_timer);
+    alarm->owner = -1;
+    view_update(alarm);
+}
+
+// Whether an alarm may move to another display thread: not while messages
+// about it are on their way to the one it is on, which would find it gone.
+// The caller must hold the mutex of its shard and of its display thread, so
+// that no message about it is posted or taken meanwhile.
+bool display_movable(alarm_t *alarm) {
+    return atomic_load_explicit(&alarm->mail, memory_order_relaxed) == 0;
+}
+
+// Move an alarm to another display thread, keeping its next print time.
+// Returns 0, or -1 if there is no memory. The alarm must be movable. The
+// caller must hold alarm_mutex, the mutex of the alarm's shard and both
+// display threads' mutexes.
+int display_move(display_thread_t *from, display_thread_t *to, alarm_t *alarm) {
+    bool printing = timer_node_queued(&alarm->print_timer);
+
+    display_remove(from, alarm);
+    if (display_add(to, alarm) != 0) {
+        display_add(from, alarm); // There is room, as one was just removed
+        to = from;
+    }
+    if (printing) {
+        timer_queue_insert(&to->print_queue, &alarm->print_timer);
+    }
+    signal_display_thread(to);
+    return to == from ? -1 : 0;
+}
+
+// Move an alarm on alarm_queue to another group. An assigned alarm counts in
+// the new group, and moves to its home display thread unless messages about
+// it are on their way to its own; an unassigned one is assigned by group by
+// the start alarm thread. The caller must hold alarm_mutex and the mutex of
+// the alarm's shard.
+void regroup_alarm(alarm_t *alarm, int group_id) {
+    consumer_shard_t *shard = alarm_shard(alarm->alarm_id);
+    display_thread_t *owner = find_display_thread(alarm);
+    group_members_t *from = members_find(shard, alarm->group_id);
+    group_members_t *to = members_get(shard, group_id);
+    alarm_group_t *group = NULL;
+
+    if (to != NULL && owner != NULL && (group = group_hold(group_id)) == NULL) {
+        members_put(shard, to);
+        to = NULL;
+    }
+    // Leave the old group first: if the alarm is its last member, removing
+    // it would otherwise set its group_slot back to the old slot
+    if (to != NULL) {
+        members_remove(from, alarm->group_slot);
+        if (members_add(to, alarm) != 0) {
+            members_add(from, alarm); // There is room, as one was just removed
+            members_put(shard, to);
+            to = NULL;
+            if (group != NULL) {
+                group_release(group_id);
             }
-            // 3. Check for Expiration
-            if (alarm->time <= current_time) {
-                if (alarm->memory_owner == 1) { // Only free if we own it
-                    // printf("DEBUG: Alarm Expired - alarm_id: %d\n", alarm->alarm_id);
-                    // printf("DEBUG: Alarm Expired - alarm address: %p\n", (void *)alarm);
-                    // printf("DEBUG: Alarm Expired - current time: %ld\n", current_time);
-                    // printf("DEBUG: Alarm Expired - alarm time: %ld\n", alarm->time);
-                    // printf("Display Alarm Thread %ld Stopped Printing Expired Alarm(%d) at %ld\n",
-                    //        pthread_self(), alarm->alarm_id, current_time);
-
-                    free(alarm);
-                    //printf("DEBUG: Alarm Freed - alarm address: %p\n", (void *)alarm);
-                    display_thread_data->alarms[i] = NULL;
-                    alarm = NULL;
-                } else {
-                    //printf("DEBUG: Alarm Expired - but not freeing because global list owns it.\n");
-                    display_thread_data->alarms[i] = NULL; // Just remove from our list
-                    alarm = NULL;
+        }
+    }
+    if (to == NULL) {
+        output_printf("Change Alarm Thread: no memory to move Alarm(%d) to Group(%d)\n", alarm->alarm_id, group_id);
+        return;
+    }
+    members_put(shard, from);
+    if (owner == NULL) {
+        alarm->group_id = group_id;
+    } else {
+        group_release(alarm->group_id);
+        if (group->home == NULL) {
+            group->home = owner;
+        }
+        display_thread_t *home = choose_display_thread(group);
+        display_lock_pair(owner, home);
+        alarm->group_id = group_id;
+        if (home != owner && display_movable(alarm)) {
+            display_move(owner, home, alarm);
+        }
+        display_unlock_pair(owner, home);
+    }
+    view_update(alarm);
+}
+
+// Whether another display thread seems to have REBALANCE_SLACK more alarms
+// than this one, going by the loads they publish, without alarm_mutex.
+bool display_unbalanced(display_thread_t *display_thread) {
+    int load = atomic_load_explicit(&display_thread->load, memory_order_relaxed);
+    for (int i = 0; i < display_thread_count; i++) {
+        if (atomic_load_explicit(&display_threads[i].load, memory_order_relaxed) - load > REBALANCE_SLACK) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Take alarms from the busiest display thread if it has REBALANCE_SLACK more
+// than this one: half the difference, a group at a time, so the groups stay
+// together. Alarms with messages on their way to the busiest thread stay
+// there. Returns the number taken. The caller must hold alarm_mutex, every
+// shard's mutex and this display thread's mutex, which is unlocked for a
+// moment to lock the busiest thread's in order.
+int display_steal(display_thread_t *display_thread) {
+    display_thread_t *busiest = &display_threads[0];
+    for (int i = 1; i < display_thread_count; i++) {
+        if (display_threads[i].alarm_count > busiest->alarm_count) {
+            busiest = &display_threads[i];
+        }
+    }
+    int wanted = (busiest->alarm_count - display_thread->alarm_count) / 2;
+    if (busiest->alarm_count - display_thread->alarm_count <= REBALANCE_SLACK) {
+        return 0;
+    }
+
+    int taken = 0;
+    display_unlock(display_thread);
+    display_lock_pair(display_thread, busiest);
+    while (taken < wanted) {
+        int group_id = busiest->alarms[busiest->alarm_count - 1]->group_id;
+        alarm_group_t *group = group_find(group_id);
+        if (group->home == busiest) {
+            group->home = display_thread;
+        }
+        // Going backwards, each alarm moved into a gap has been looked at
+        int before = taken;
+        for (int i = busiest->alarm_count - 1; i >= 0 && taken < wanted; i--) {
+            alarm_t *alarm = busiest->alarms[i];
+            if (alarm->group_id == group_id && display_movable(alarm)) {
+                if (display_move(busiest, display_thread, alarm) != 0) {
+                    display_unlock(busiest);
+                    return taken;
                 }
-                continue;
+                taken++;
             }
+        }
+        if (taken == before) {
+            break; // The last alarm cannot move yet, so nor can its group
+        }
+    }
+    display_unlock(busiest);
+    output_printf("Display Thread %ld Took %d Alarms from Display Thread %ld at %ld\n",
+                  pthread_self(), taken, busiest->thread_id, tick_clock_now());
+    return taken;
+}
 
-            // 4. Handle Changes (Group, Message, Interval)
-            if (alarm->changed_group == 1) {
-                printf("Display Thread %ld Has Stopped Printing Message of Alarm(%d) at %ld: Changed Group(%d)\n",
-                       pthread_self(), alarm->alarm_id, current_time, alarm->group_id);
-                alarm->time = current_time + alarm->seconds;
-                alarm->changed_group = 0;
-                alarm->last_printed = current_time;
-            }
+// Record how long after its expiry time, in ticks, an alarm was removed.
+void record_lateness(time_t expiry) {
+    long long late = tick_clock_since(expiry);
 
-            if (alarm->message_changed == 1) {
-                printf("Display Thread %ld Starts to Print Changed Message Alarm(%d) at %ld: Group(%d) %ld %s\n",
-                       pthread_self(), alarm->alarm_id, current_time, display_thread_data->group_id, current_time, alarm->message);
-                alarm->message_changed = 0;
-                alarm->last_printed = current_time;
-            }
+    metrics_record(METRIC_EXPIRY_LATENESS, late > 0 ? late : 0);
+}
 
-            if (alarm->interval_changed == 1) {
-                printf("Display Thread %ld Starts to Print Changed Interval Value Alarm(%d) at %ld: Group(%d) %ld %d %s\n",
-                       pthread_self(), alarm->alarm_id, current_time, display_thread_data->group_id, current_time, alarm->interval, alarm->message);
-                alarm->interval_changed = 0;
-                alarm->last_printed = current_time;
-            }
+// Whether a display thread must take alarm_mutex and every shard's mutex to
+// act on its alarms: one has been cancelled, or may have expired. The caller
+// must hold its mutex.
+bool display_due(display_thread_t *display_thread, time_t current_time) {
+    return !mailbox_empty(&display_thread->mailboxes[FROM_CANCEL]) ||
+           (display_thread->next_expiry != 0 && display_thread->next_expiry <= current_time);
+}
 
-            // 5. Normal Printing (if interval elapsed)
-            if (alarm->last_printed == 0 || current_time - alarm->last_printed >= alarm->interval) {
-                printf("Alarm (%d) Printed by Alarm Display Thread %ld at %ld: Group(%d) %s\n",
-                       alarm->alarm_id, pthread_self(), current_time, alarm->group_id, alarm->message);
-                alarm->last_printed = current_time;
-            }
+// Whether any messages are waiting for a display thread. The caller must
+// hold its mutex.
+bool display_has_mail(display_thread_t *display_thread) {
+    for (int from = 0; from < DISPLAY_SENDERS; from++) {
+        if (!mailbox_empty(&display_thread->mailboxes[from])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Start a changed alarm's print interval again, unless it is suspended, in
+// which case it prints at once when reactivated. The caller must hold the
+// display thread's mutex.
+void display_restart(display_thread_t *display_thread, alarm_t *alarm, time_t current_time) {
+    if (timer_node_queued(&alarm->print_timer)) {
+        display_rearm(display_thread, alarm, current_time);
+    }
+}
+
+// Act on a suspension, reactivation or change of one of a display thread's
+// alarms. It only moves the alarm's print timer, so the caller need hold only
+// the display thread's mutex.
+void display_apply(display_thread_t *display_thread_data, alarm_t *alarm, int type, time_t current_time) {
+    switch (type) {
+    case DISPLAY_SUSPEND:
+        output_printf("Alarm(%d) is suspended. Skipping print.\n", alarm->alarm_id);
+        timer_queue_remove(&display_thread_data->print_queue, &alarm->print_timer);
+        break;
+    case DISPLAY_REACTIVATE:
+        // Reactivated alarms print straight away
+        if (!timer_node_queued(&alarm->print_timer)) {
+            timer_node_init(&alarm->print_timer, current_time);
+            timer_queue_insert(&display_thread_data->print_queue, &alarm->print_timer);
+        }
+        break;
+    case DISPLAY_GROUP_CHANGED:
+        output_printf("Display Thread %ld Has Stopped Printing Message of Alarm(%d) at %ld: Changed Group(%d)\n",
+                      display_thread_data->thread_id, alarm->alarm_id, current_time, alarm->group_id);
+        display_restart(display_thread_data, alarm, current_time);
+        break;
+    case DISPLAY_MESSAGE_CHANGED:
+        output_printf("Display Thread %ld Starts to Print Changed Message Alarm(%d) at %ld: Group(%d) %ld %s\n",
+                      display_thread_data->thread_id, alarm->alarm_id, current_time, alarm->group_id, current_time, alarm->message);
+        display_restart(display_thread_data, alarm, current_time);
+        break;
+    case DISPLAY_INTERVAL_CHANGED:
+        output_printf("Display Thread %ld Starts to Print Changed Interval Value Alarm(%d) at %ld: Group(%d) %ld %d %s\n",
+                      display_thread_data->thread_id, alarm->alarm_id, current_time, alarm->group_id, current_time, alarm->interval, alarm->message);
+        display_restart(display_thread_data, alarm, current_time);
+        break;
+    }
+}
+
+// Take the suspensions, reactivations and changes posted to a display
+// thread, and act on each. The caller need hold only the display thread's
+// mutex.
+void display_receive(display_thread_t *display_thread_data, time_t current_time) {
+    mailbox_message_t message;
+
+    for (int from = 0; from < FROM_CANCEL; from++) {
+        while (mailbox_take(&display_thread_data->mailboxes[from], &message)) {
+            alarm_t *alarm = (alarm_t *)message.data;
+            display_apply(display_thread_data, alarm, message.type, current_time);
+            atomic_fetch_sub_explicit(&alarm->mail, 1, memory_order_relaxed);
+        }
+    }
+}
+
+// Take a cancelled alarm out of its display thread and free it. The caller
+// must hold alarm_mutex, every shard's mutex and the display thread's mutex.
+void display_free_cancelled(display_thread_t *display_thread_data, alarm_t *alarm) {
+    output_printf("Alarm(%d) Cancelled, freeing memory.\n", alarm->alarm_id);
+    display_remove(display_thread_data, alarm);
+    group_release(alarm->group_id);
+    free_alarm(alarm);
+}
+
+// Take the cancellations posted to a display thread, and free each alarm.
+// The caller must hold alarm_mutex, every shard's mutex and the display
+// thread's mutex, and must have taken its other messages since locking the
+// shards' mutexes, so that none is left about an alarm freed here.
+void display_cancel(display_thread_t *display_thread_data) {
+    mailbox_message_t message;
+
+    while (mailbox_take(&display_thread_data->mailboxes[FROM_CANCEL], &message)) {
+        display_free_cancelled(display_thread_data, (alarm_t *)message.data);
+    }
+}
 
-            active_alarms++; // Count if it wasn't cancelled, suspended, or expired
-            last_alarm_group_id = alarm->group_id;
+// Post a message about an alarm to the display thread that owns it, if any,
+// and wake it. "from" is the calling worker thread, whose mailbox it is.
+// As every message about an alarm is posted with its shard's mutex, a
+// display thread holding every shard's mutex has all of its messages in its
+// mailboxes, and takes them all before it frees an alarm. The caller must
+// hold the mutex of the alarm's shard, but not the display thread's mutex.
+//
+// If there is no memory for the message, the change is made here instead,
+// as the display thread would make it, with its mutex held: the messages
+// already posted to it are taken first, so they are still acted on in order.
+// A cancelled alarm cannot be freed here, without every shard's mutex, so it
+// is left for the display thread to free as if it had expired.
+void display_post(alarm_t *alarm, display_sender_t from, display_message_type_t type) {
+    display_thread_t *thread = find_display_thread(alarm);
+    if (thread == NULL) {
+        return; // Its display thread looks at it when it is assigned
+    }
+    atomic_fetch_add_explicit(&alarm->mail, 1, memory_order_relaxed);
+    int status = mailbox_post(&thread->mailboxes[from], type, alarm);
+    display_lock(thread);
+    if (status != 0) {
+        atomic_fetch_sub_explicit(&alarm->mail, 1, memory_order_relaxed);
+        output_printf("Display Thread %ld: no memory for a message about Alarm(%d), changing it directly\n",
+                      thread->thread_id, alarm->alarm_id);
+        time_t current_time = tick_clock_now();
+        if (type == DISPLAY_CANCEL) {
+            alarm->timer.time = current_time;
+            display_expires(thread, current_time);
+        } else {
+            display_receive(thread, current_time);
+            display_apply(thread, alarm, type, current_time);
         }
+    }
+    signal_display_thread(thread);
+    display_unlock(thread);
+}
 
-        // 6. Compact the array
-        int new_count = 0;
-        for (int i = 0; i < display_thread_data->alarm_count; i++) {
-            if (display_thread_data->alarms[i] != NULL) {
-                display_thread_data->alarms[new_count] = display_thread_data->alarms[i];
-                new_count++;
+// Look through a display thread's alarms for any that have expired, which
+// applies to suspended alarms too, and free them. The caller must hold
+// alarm_mutex, every shard's mutex and the display thread's mutex, and must
+// have taken its messages since locking the shards' mutexes.
+void display_scan(display_thread_t *display_thread_data, time_t current_time) {
+    time_t next_wakeup = 0; // Earliest expiry, 0 if none
+
+    // Removing an alarm moves the last one into its slot, which is looked
+    // at next.
+    int i = 0;
+    while (i < display_thread_data->alarm_count) {
+        alarm_t *alarm = display_thread_data->alarms[i];
+        if (alarm->timer.time <= current_time) {
+            // output_printf("Display Alarm Thread %ld Stopped Printing Expired Alarm(%d) at %ld\n",
+            //               pthread_self(), alarm->alarm_id, current_time);
+            if (timer_node_queued(&alarm->timer)) {
+                // Seen before the cancel thread took it off alarm_queue
+                event_log_write(EVENT_EXPIRED, alarm->alarm_id, alarm->group_id, pthread_self());
+                record_lateness(alarm->timer.time);
+            }
+            retire_start_alarm(alarm);
+            display_remove(display_thread_data, alarm);
+            group_release(alarm->group_id);
+            free_alarm(alarm);
+            continue;
+        }
+        if (next_wakeup == 0 || alarm->timer.time < next_wakeup) {
+            next_wakeup = alarm->timer.time;
+        }
+        i++;
+    }
+    display_thread_data->next_expiry = next_wakeup;
+}
+
+void *display_alarm_thread(void *arg) {
+    display_thread_t *display_thread_data = (display_thread_t *)arg;
+
+    metrics_name_thread("Display Thread %d", (int)(display_thread_data - display_threads));
+    display_lock(display_thread_data);
+    while (1) {
+        time_t current_time = tick_clock_now();
+
+        // 1. Suspensions, reactivations and changes, which need only our
+        // own mutex
+        display_receive(display_thread_data, current_time);
+
+        // 2. Cancellations and expiries free alarms, and evening out the
+        // load moves them. Those alarms may be in any shard, so this needs
+        // alarm_mutex and every shard's mutex, which come before our own
+        // mutex in the lock order. Messages posted while we were getting
+        // them are taken first, so none is left about an alarm that is freed.
+        if (display_due(display_thread_data, current_time) || display_unbalanced(display_thread_data)) {
+            display_unlock(display_thread_data);
+            alarm_lock_all();
+            display_lock(display_thread_data);
+            current_time = tick_clock_now();
+            display_receive(display_thread_data, current_time);
+            display_cancel(display_thread_data);
+            if (display_thread_data->next_expiry != 0 && display_thread_data->next_expiry <= current_time) {
+                display_scan(display_thread_data, current_time);
+            }
+
+            // 3. Even out the load: look at any alarms taken from a busier thread
+            int taken = display_steal(display_thread_data);
+            alarm_unlock_all();
+            if (taken > 0) {
+                continue;
             }
         }
-        display_thread_data->alarm_count = new_count;
 
-        // 7. Check for thread exit based on active alarms
-        if (active_alarms == 0) {
-            printf("No more active alarms in Group(%d): Display Thread %ld exiting at %ld\n",
-                   last_alarm_group_id, pthread_self(), current_time);
-            free(display_thread_data);
-            pthread_mutex_unlock(&alarm_mutex);
-            pthread_exit(NULL);
+        // 4. Normal Printing, for each alarm whose interval has elapsed.
+        // Re-arming by interval just moves the print timer to a new slot.
+        timer_node_t *node;
+        while ((node = timer_queue_pop_expired(&display_thread_data->print_queue, current_time)) != NULL) {
+            alarm_t *alarm = timer_entry(node, alarm_t, print_timer);
+            output_printf("Alarm (%d) Printed by Alarm Display Thread %ld at %ld: Group(%d) %s\n",
+                          alarm->alarm_id, pthread_self(), current_time, alarm->group_id, alarm->message);
+            event_log_write(EVENT_PRINTED, alarm->alarm_id, alarm->group_id, pthread_self());
+            display_rearm(display_thread_data, alarm, current_time);
         }
+        metrics_set(METRIC_ALARMS, display_thread_data->alarm_count);
 
-        pthread_mutex_unlock(&alarm_mutex);
-        sleep(1);
+        // 5. Sleep until the next print or expiry is due, or until another
+        // thread assigns us an alarm or posts us a message. One posted since
+        // we last looked is taken at once.
+        if (display_has_mail(display_thread_data)) {
+            continue;
+        }
+        time_t next_wakeup = display_thread_data->next_expiry;
+        time_t next_print = timer_queue_next(&display_thread_data->print_queue);
+        if (next_print != 0 && (next_wakeup == 0 || next_print < next_wakeup)) {
+            next_wakeup = next_print;
+        }
+        profiled_mutex_waiting(&display_thread_data->mutex);
+        if (next_wakeup == 0) {
+            pthread_cond_wait(&display_thread_data->wakeup, &display_thread_data->mutex.mutex);
+        } else {
+            tick_clock_timedwait(&display_thread_data->wakeup, &display_thread_data->mutex.mutex, next_wakeup);
+        }
+        profiled_mutex_woken(&display_thread_data->mutex);
     }
     return NULL;
 }
 
 
+// Assign each new alarm to a display thread. An alarm that cannot be
+// assigned for want of memory is tried again, before the rest, a second
+// later.
 void *start_alarm_thread(void *arg) {
+    alarm_t *retry = NULL;
+
+    metrics_name_thread("Start Alarm Thread");
     while (1) {
-        pthread_mutex_lock(&alarm_mutex);
-        alarm_t *alarm = alarm_list;
-        alarm_t *prev = NULL;
-
-        while (alarm != NULL) {
-            if (strcmp(alarm->request_type, "Start_Alarm") == 0 && !alarm->processed) {
-                display_thread_t *assigned_thread = NULL;
-                display_thread_t *current_thread = display_threads;
-
-                while (current_thread != NULL) {
-                    if (pthread_equal(current_thread->thread_id, alarm->display_thread_id)) {
-                        assigned_thread = current_thread;
-                        break;
-                    }
-                    current_thread = current_thread->next;
-                }
+        if (retry == NULL) {
+            request_queue_wait(&start_queue);
+        }
+
+        // Groups and display threads are chosen with alarm_mutex, and each
+        // alarm is looked at with its shard's mutex
+        alarm_t *alarm;
+        alarm_lock();
+        while ((alarm = retry != NULL ? retry : request_queue_pop(&start_queue)) != NULL) {
+            consumer_shard_t *shard = alarm_shard(alarm->alarm_id);
+            retry = NULL;
+            shard_lock(shard);
+
+            // An alarm cancelled or expired before it was assigned is no
+            // longer on alarm_queue, and has no other owner.
+            if (!timer_node_queued(&alarm->timer)) {
+                shard_unlock(shard);
+                free_alarm(alarm);
+                continue;
+            }
 
-                if (assigned_thread == NULL) {
-                    current_thread = display_threads;
-                    while (current_thread != NULL) {
-                        if (current_thread->group_id == alarm->group_id &&
-                            current_thread->alarm_count < MAX_ALARMS_PER_THREAD) {
-                            assigned_thread = current_thread;
-                            break;
-                        }
-                        current_thread = current_thread->next;
-                    }
-
-                    if (assigned_thread == NULL) {
-                        assigned_thread = malloc(sizeof(display_thread_t));
-                        if (assigned_thread == NULL) {
-                            perror("Failed to allocate memory for display thread");
-                            pthread_mutex_unlock(&alarm_mutex);
-                            sleep(1);
-                            continue;
-                        }
-
-                        assigned_thread->group_id = alarm->group_id;
-                        assigned_thread->alarm_count = 0;
-                        assigned_thread->next = display_threads;
-                        display_threads = assigned_thread;
-
-                        if (pthread_create(&assigned_thread->thread_id, NULL,
-                                           display_alarm_thread, assigned_thread) != 0) {
-                            perror("Failed to create display thread");
-                            free(assigned_thread);
-                            assigned_thread = NULL;
-                            pthread_mutex_unlock(&alarm_mutex);
-                            sleep(1);
-                            continue;
-                        }
-                        time_t current_time = time(NULL);
-                        //Corrected print statement
-                        printf("Start Alarm Thread Created New Display Alarm Thread %ld For Alarm(%d) at %ld: Group(%d)\n",
-                               assigned_thread->thread_id, alarm->alarm_id, current_time, alarm->group_id);
-                    }
+            // Alarms go to their group's display thread, or the least loaded
+            alarm_group_t *group = group_hold(alarm->group_id);
+            display_thread_t *assigned_thread = group == NULL ? NULL : choose_display_thread(group);
+            if (assigned_thread != NULL) {
+                display_lock(assigned_thread);
+            }
+            if (group == NULL || display_add(assigned_thread, alarm) != 0) {
+                if (group != NULL) {
+                    display_unlock(assigned_thread);
+                    group_release(alarm->group_id);
                 }
-                time_t current_time = time(NULL);
-                //Corrected print statement
-                printf("Alarm (%d) Assigned to Display Thread (%ld) at %ld: Group(%d)\n",
-                       alarm->alarm_id, assigned_thread->thread_id, current_time, alarm->group_id);
-
-                assigned_thread->alarms[assigned_thread->alarm_count++] = alarm;
-                alarm->display_thread_id = assigned_thread->thread_id;
-                alarm->processed = 1; 
-                alarm->memory_owner = 1;
-                // if (prev == NULL) {
-                //     alarm_list = alarm->link;
-                // } else {
-                //     prev->link = alarm->link;
-                // }
+                shard_unlock(shard);
+                perror("Failed to allocate memory for alarm assignment");
+                retry = alarm;
                 break;
             }
-            prev = alarm;
-            alarm = alarm->link;
+            time_t current_time = tick_clock_now();
+
+            // New alarms print straight away, unless suspended before they
+            // were assigned, when they print once reactivated
+            if (!alarm->suspended) {
+                timer_node_init(&alarm->print_timer, current_time);
+                timer_queue_insert(&assigned_thread->print_queue, &alarm->print_timer);
+            }
+            //Corrected print statement
+            output_printf("Alarm (%d) Assigned to Display Thread (%ld) at %ld: Group(%d)\n",
+                          alarm->alarm_id, assigned_thread->thread_id, current_time, alarm->group_id);
+            event_log_write(EVENT_ASSIGNED, alarm->alarm_id, alarm->group_id, assigned_thread->thread_id);
+
+            alarm->processed = 1; 
+            alarm->memory_owner = 1;
+            signal_display_thread(assigned_thread);
+            display_unlock(assigned_thread);
+            shard_unlock(shard);
+        }
+        alarm_unlock();
+
+        if (retry != NULL) {
+            // Back off before retrying the alarm that could not be assigned
+            sleep(1);
         }
-        pthread_mutex_unlock(&alarm_mutex);
-        sleep(1);
     }
     return NULL;
 }
 
 void *change_alarm_thread(void *arg) {
+    metrics_name_thread("Change Alarm Thread");
     while (1) {
-        pthread_mutex_lock(&alarm_mutex);
-        alarm_t *current_change_alarm = change_alarm_list;
-        alarm_t *prev_change_alarm = NULL;
-        time_t current_time = time(NULL);
-
-        while (current_change_alarm != NULL) {
-            alarm_t *next_change_alarm = current_change_alarm->link;
-            alarm_t *target_start_alarm = NULL;
-            //update global alarm list 
-            alarm_t *global_alarm = alarm_list;
-            while (global_alarm != NULL) {
-                if (global_alarm->alarm_id == current_change_alarm->alarm_id &&
-                    strcmp(global_alarm->request_type, "Start_Alarm") == 0 &&
-                    global_alarm->timestamp < current_change_alarm->timestamp) {
-                    target_start_alarm = global_alarm;
-                    break;
-                }
-                global_alarm = global_alarm->link;
-            }
-            // Search display threads for the target Start_Alarm
-            display_thread_t *current_thread = display_threads;
-            while (current_thread != NULL) {
-                for (int i = 0; i < current_thread->alarm_count; i++) {
-                    alarm_t *alarm = current_thread->alarms[i];
-                    if (alarm && alarm->alarm_id == current_change_alarm->alarm_id &&
-                        strcmp(alarm->request_type, "Start_Alarm") == 0 &&
-                        alarm->timestamp < current_change_alarm->timestamp) {
-                        target_start_alarm = alarm;
-                        break;
-                    }
-                }
-                if (target_start_alarm != NULL) {
-                    break; // Target found, no need to check other threads
-                }
-                current_thread = current_thread->next;
+        request_queue_wait(&change_queue);
+        alarm_t *current_change_alarm;
+        time_t current_time = tick_clock_now();
+
+        while ((current_change_alarm = request_queue_pop(&change_queue)) != NULL) {
+            consumer_shard_t *shard = alarm_shard(current_change_alarm->alarm_id);
+            bool regroup = false;
+
+            //update global alarm queue
+            shard_lock(shard);
+            alarm_t *target_start_alarm = find_start_alarm(shard, current_change_alarm->alarm_id,
+                                                           current_change_alarm->timestamp);
+            if (target_start_alarm != NULL && target_start_alarm->group_id != current_change_alarm->group_id) {
+                // Moving it to another group changes the groups' records,
+                // which needs alarm_mutex, before the shard's mutex. Its
+                // command is still pending, so only a group command can
+                // change it meanwhile.
+                shard_unlock(shard);
+                alarm_lock();
+                shard_lock(shard);
+                target_start_alarm = find_start_alarm(shard, current_change_alarm->alarm_id,
+                                                      current_change_alarm->timestamp);
+                regroup = true;
             }
+            command_handled(shard, target_start_alarm);
 
             if (target_start_alarm != NULL) {
                 // Update the Start_Alarm request
-                target_start_alarm->time = current_change_alarm->time;
+                target_start_alarm->timer.time = current_change_alarm->timer.time;
                 target_start_alarm->seconds = current_change_alarm->seconds;
+                timer_queue_update(&shard->alarm_queue, &target_start_alarm->timer);
+                if (target_start_alarm->suspended) {
+                    // Reactivating it restarts it with what it now has left
+                    target_start_alarm->remaining_sec = target_start_alarm->timer.time - current_time;
+                }
+
+                // The display thread reads the message and interval while it
+                // prints, with only its own mutex
+                bool message_changed = false, interval_changed = false;
+                display_thread_t *owner = find_display_thread(target_start_alarm);
+                if (owner != NULL) {
+                    display_lock(owner);
+                }
 
-                // Update the message safely
-                 if (strcmp(target_start_alarm->message, current_change_alarm->message) != 0) {
-                    strncpy(target_start_alarm->message, current_change_alarm->message, sizeof(target_start_alarm->message) - 1);
-                    target_start_alarm->message[sizeof(target_start_alarm->message) - 1] = '\0';
-                    target_start_alarm->message_changed = 1;
-                    printf("Change Alarm Thread Has Changed Alarm(%d) Message at %ld: Group(%d) Message(%s)\n",
-                           target_start_alarm->alarm_id, current_time, target_start_alarm->group_id, target_start_alarm->message);
+                // Messages are interned, so equal messages are the same pointer
+                if (target_start_alarm->message != current_change_alarm->message) {
+                    string_arena_release(&message_arena, target_start_alarm->message);
+                    string_arena_hold(&message_arena, current_change_alarm->message);
+                    target_start_alarm->message = current_change_alarm->message;
+                    message_changed = true;
+                    output_printf("Change Alarm Thread Has Changed Alarm(%d) Message at %ld: Group(%d) Message(%s)\n",
+                                  target_start_alarm->alarm_id, current_time, target_start_alarm->group_id, target_start_alarm->message);
                 }
 
                 // Check if interval changed
                 if (target_start_alarm->interval != current_change_alarm->interval) {
                     target_start_alarm->interval = current_change_alarm->interval;
-                    target_start_alarm->interval_changed = 1;
-                    printf("Change Alarm Thread Has Changed Alarm(%d) Interval at %ld: New Interval(%d)\n",
-                           target_start_alarm->alarm_id, current_time, target_start_alarm->interval);
+                    interval_changed = true;
+                    output_printf("Change Alarm Thread Has Changed Alarm(%d) Interval at %ld: New Interval(%d)\n",
+                                  target_start_alarm->alarm_id, current_time, target_start_alarm->interval);
                 }
 
-                target_start_alarm->group_id = current_change_alarm->group_id;
                 target_start_alarm->interval = current_change_alarm->interval; // Corrected line
-                target_start_alarm->changed_group = 1;
+                if (owner != NULL) {
+                    display_expires(owner, target_start_alarm->timer.time); // It may expire sooner
+                    display_unlock(owner);
+                }
+
+                if (target_start_alarm->group_id != current_change_alarm->group_id) {
+                    regroup_alarm(target_start_alarm, current_change_alarm->group_id);
+                }
+
+                // Tell the display thread the alarm is on now, after any move
+                display_post(target_start_alarm, FROM_CHANGE, DISPLAY_GROUP_CHANGED);
+                if (message_changed) {
+                    display_post(target_start_alarm, FROM_CHANGE, DISPLAY_MESSAGE_CHANGED);
+                }
+                if (interval_changed) {
+                    display_post(target_start_alarm, FROM_CHANGE, DISPLAY_INTERVAL_CHANGED);
+                }
 
-                printf("Change Alarm Thread Has Changed Alarm(%d) at %ld: Group(%d) Message(%s)\n",
-                       target_start_alarm->alarm_id, current_time, target_start_alarm->group_id, target_start_alarm->message);
-                printf("Updated_Interval: %d\n", target_start_alarm->interval);
+                output_printf("Change Alarm Thread Has Changed Alarm(%d) at %ld: Group(%d) Message(%s)\n",
+                              target_start_alarm->alarm_id, current_time, target_start_alarm->group_id, target_start_alarm->message);
+                output_printf("Updated_Interval: %d\n", target_start_alarm->interval);
+                event_log_write(EVENT_CHANGED, target_start_alarm->alarm_id, target_start_alarm->group_id, pthread_self());
+                expiry_changed(target_start_alarm);
 
             } else {
-                printf("Invalid Change Alarm Request(%d) at %ld: Group(%d)\n",
-                       current_change_alarm->alarm_id, current_time, current_change_alarm->group_id);
+                output_printf("Invalid Change Alarm Request(%d) at %ld: Group(%d)\n",
+                              current_change_alarm->alarm_id, current_time, current_change_alarm->group_id);
+            }
+            shard_unlock(shard);
+            if (regroup) {
+                alarm_unlock();
             }
 
-            // Remove the Change_Alarm request from the change_alarm_list
-            if (prev_change_alarm == NULL) {
-                change_alarm_list = next_change_alarm;
-            } else {
-                prev_change_alarm->link = next_change_alarm;
+            free_alarm(current_change_alarm);
+        }
+    }
+    return NULL;
+}
+
+// Record that a worker thread has handled a group request, so that the group
+// commands waiting behind it go ahead. The caller must hold alarm_mutex.
+void group_command_handled(alarm_t *request) {
+    alarm_group_t *group = group_find(request->group_id);
+    if (request->command_pending && group != NULL) {
+        group->command_pending = false;
+        group_put(group);
+    }
+    pthread_cond_broadcast(&group_command_done);
+}
+
+// Take a Start_Alarm off the alarm list and have it freed. The caller must
+// hold the mutex of the alarm's shard.
+void cancel_start_alarm(alarm_t *alarm, time_t current_time) {
+    output_printf(
+        "Alarm(%d) Cancelled and Removed from Global List at %ld: "
+        "Group(%d) %ld %d %ld %s\n",
+        alarm->alarm_id, current_time,
+        alarm->group_id, alarm->timestamp,
+        alarm->interval, alarm->timer.time,
+        alarm->message);
+    event_log_write(EVENT_CANCELLED, alarm->alarm_id, alarm->group_id, pthread_self());
+
+    // Remove the Start_Alarm from the global queue
+    retire_start_alarm(alarm);
+
+    // Have its display thread take it out and free it. An unassigned
+    // alarm is freed by the start alarm thread when it comes off
+    // start_queue.
+    display_post(alarm, FROM_CANCEL, DISPLAY_CANCEL);
+}
+
+// Cancel the alarms of a group that were started before a Cancel_Group
+// request. The caller must hold alarm_mutex and every shard's mutex.
+void cancel_group(alarm_t *request, time_t current_time) {
+    int count = 0;
+
+    group_command_handled(request);
+
+    // Going backwards, each alarm moved into a gap has been looked at. The
+    // members are dropped once the last is cancelled, but by then i is 0.
+    for (int shard = 0; shard < consumer_count; shard++) {
+        group_members_t *members = members_find(&consumer_shards[shard], request->group_id);
+        for (int i = members == NULL ? -1 : members->member_count - 1; i >= 0; i--) {
+            alarm_t *alarm = members->members[i];
+            if (alarm->timestamp <= request->timestamp) {
+                cancel_start_alarm(alarm, current_time);
+                count++;
             }
-            free(current_change_alarm);
-            current_change_alarm = next_change_alarm;
         }
+    }
+    output_printf("Cancel_Group(%d): %d Alarms Cancelled at %ld\n", request->group_id, count, current_time);
+}
 
-        pthread_mutex_unlock(&alarm_mutex);
-        sleep(1);
+// Take a shard's alarms that have expired off its alarm_queue. The caller
+// must hold the shard's mutex.
+void expire_alarms(consumer_shard_t *shard, time_t current_time) {
+    timer_node_t *node;
+
+    // Only alarms that are due come off the queue
+    while ((node = timer_queue_pop_expired(&shard->alarm_queue, current_time)) != NULL) {
+        alarm_t *expired_alarm = timer_entry(node, alarm_t, timer);
+        record_lateness(expired_alarm->timer.time);
+        alarm_index_remove(&shard->alarm_index, expired_alarm->alarm_id);
+        view_remove(expired_alarm);
+        group_leave(expired_alarm);
+
+        // Start_Alarm expired - Remove from global queue
+        // **CRITICAL CHANGE:** Do NOT free the alarm here. Let the display
+        // thread, or the start alarm thread if unassigned, handle it.
+        output_printf(
+            "Alarm(%d) Expired and Removed from Global List at %ld (but not freed): "
+            "Group(%d) %ld %d %ld %s\n",
+            expired_alarm->alarm_id, current_time, expired_alarm->group_id,
+            expired_alarm->timestamp, expired_alarm->interval,
+            expired_alarm->timer.time, expired_alarm->message);
+        event_log_write(EVENT_EXPIRED, expired_alarm->alarm_id, expired_alarm->group_id, pthread_self());
     }
-    return NULL;
 }
 
 void *cancel_alarm_thread(void *arg) {
+    metrics_name_thread("Cancel Alarm Thread");
     while (1) {
-        pthread_mutex_lock(&alarm_mutex);
-        alarm_t *current_alarm = alarm_list;
-        alarm_t *prev_alarm = NULL;
-        time_t current_time = time(NULL);
-
-        while (current_alarm != NULL) {
-            alarm_t *next_alarm = current_alarm->link;
-
-            if (strcmp(current_alarm->request_type, "Cancel_Alarm") == 0) {
-                alarm_t *target_start_alarm = NULL;
-
-                // Find the corresponding Start_Alarm with an earlier timestamp
-                alarm_t *temp_alarm = alarm_list;
-                while (temp_alarm != NULL) {
-                    if (temp_alarm->alarm_id == current_alarm->alarm_id &&
-                        strcmp(temp_alarm->request_type, "Start_Alarm") == 0 &&
-                        temp_alarm->timestamp < current_alarm->timestamp) {
-                        target_start_alarm = temp_alarm;
-                        break;
-                    }
-                    temp_alarm = temp_alarm->link;
-                }
+        alarm_t *current_alarm;
+        time_t current_time = tick_clock_now();
+
+        while ((current_alarm = request_queue_pop(&cancel_queue)) != NULL) {
+            if (current_alarm->request_type == CANCEL_GROUP) {
+                alarm_lock_all();
+                cancel_group(current_alarm, current_time);
+                alarm_unlock_all();
+                free_alarm(current_alarm);
+                continue;
+            }
 
-                if (target_start_alarm != NULL) {
-                    // Start_Alarm found with earlier timestamp
-                    printf(
-                        "Alarm(%d) Cancelled and Removed from Global List at %ld: "
-                        "Group(%d) %ld %d %ld %s\n",
-                        current_alarm->alarm_id, current_time,
-                        target_start_alarm->group_id, target_start_alarm->timestamp,
-                        target_start_alarm->interval, target_start_alarm->time,
-                        target_start_alarm->message);
-
-                    // Mark the Start_Alarm for cancellation in the display threads
-                    display_thread_t *curr_display_thread = display_threads;
-                    while (curr_display_thread != NULL) {
-                        for (int i = 0; i < curr_display_thread->alarm_count; i++) {
-                            if (curr_display_thread->alarms[i] == target_start_alarm) {
-                                curr_display_thread->alarms[i]->cancelled = 1;
-                                break;
-                            }
-                        }
-                        curr_display_thread = curr_display_thread->next;
-                    }
-
-                    // Remove the Start_Alarm from the global list
-                    if (prev_alarm == NULL) {
-                        alarm_list = target_start_alarm->link;
-                    } else {
-                        prev_alarm->link = target_start_alarm->link;
-                    }
-
-                    // Remove the Cancel_Alarm request
-                    alarm_t *temp = alarm_list;
-                    alarm_t *prev = NULL;
-                    while (temp != NULL) {
-                        if (temp == current_alarm) {
-                            if (prev == NULL) {
-                                alarm_list = temp->link;
-                            } else {
-                                prev->link = temp->link;
-                            }
-                            break;
-                        }
-                        prev = temp;
-                        temp = temp->link;
-                    }
-                    free(current_alarm); // Free the Cancel_Alarm request
-
-                    current_alarm = next_alarm;
-                    continue;
-                } else {
-                    printf("Cancel Alarm Thread: Alarm(%d) not found.\n",
-                           current_alarm->alarm_id);
-                }
+            // Find the corresponding Start_Alarm with an earlier timestamp
+            consumer_shard_t *shard = alarm_shard(current_alarm->alarm_id);
+            shard_lock(shard);
+            alarm_t *target_start_alarm = find_start_alarm(shard, current_alarm->alarm_id,
+                                                           current_alarm->timestamp);
+            command_handled(shard, target_start_alarm);
 
-                // Remove the Cancel_Alarm request even if no matching Start_Alarm was found
-                if (prev_alarm == NULL) {
-                    alarm_list = next_alarm;
-                } else {
-                    prev_alarm->link = next_alarm;
-                }
-                free(current_alarm);
-                current_alarm = next_alarm;
-                continue;
-            } else if (strcmp(current_alarm->request_type, "Start_Alarm") == 0 &&
-                       current_alarm->time <= current_time) {
-                // Start_Alarm expired - Remove from global list
-                // **CRITICAL CHANGE:** Do NOT free here. Let display thread handle it.
-                printf(
-                    "Alarm(%d) Expired and Removed from Global List at %ld (but not freed): "
-                    "Group(%d) %ld %d %ld %s\n",
-                    current_alarm->alarm_id, current_time, current_alarm->group_id,
-                    current_alarm->timestamp, current_alarm->interval,
-                    current_alarm->time, current_alarm->message);
-
-                if (prev_alarm == NULL) {
-                    alarm_list = next_alarm;
-                } else {
-                    prev_alarm->link = next_alarm;
-                }
-                //free(current_alarm); // Do NOT free here!
-                current_alarm = next_alarm;
-                continue;
+            if (target_start_alarm != NULL) {
+                // Start_Alarm found with earlier timestamp
+                cancel_start_alarm(target_start_alarm, current_time);
+            } else {
+                output_printf("Cancel Alarm Thread: Alarm(%d) not found.\n",
+                              current_alarm->alarm_id);
             }
+            shard_unlock(shard);
 
-            prev_alarm = current_alarm;
-            current_alarm = next_alarm;
-        next_iteration:;
+            // Remove the Cancel_Alarm request even if no matching Start_Alarm was found
+            free_alarm(current_alarm);
         }
-        pthread_mutex_unlock(&alarm_mutex);
-        sleep(1);
+
+        // Each shard's expired alarms come off its queue. An alarm queued
+        // meanwhile sets current_expiry, as it is 0 until all are looked at.
+        pthread_mutex_lock(&cancel_queue.mutex);
+        current_expiry = 0;
+        pthread_mutex_unlock(&cancel_queue.mutex);
+        time_t deadline = 0;
+        for (int i = 0; i < consumer_count; i++) {
+            shard_lock(&consumer_shards[i]);
+            expire_alarms(&consumer_shards[i], current_time);
+            time_t next = timer_queue_next(&consumer_shards[i].alarm_queue);
+            shard_unlock(&consumer_shards[i]);
+            if (next != 0 && (deadline == 0 || next < deadline)) {
+                deadline = next;
+            }
+        }
+
+        // Sleep until the earliest Start_Alarm expires or a Cancel_Alarm
+        // arrives. expiry_changed() signals if an earlier expiry is queued.
+        pthread_mutex_lock(&cancel_queue.mutex);
+        if (current_expiry != 0 && (deadline == 0 || current_expiry < deadline)) {
+            deadline = current_expiry;
+        }
+        current_expiry = deadline;
+        while (cancel_queue.head == NULL && current_expiry == deadline) {
+            int status = deadline == 0
+                ? pthread_cond_wait(&cancel_queue.cond, &cancel_queue.mutex)
+                : tick_clock_timedwait(&cancel_queue.cond, &cancel_queue.mutex, deadline);
+            if (status == ETIMEDOUT) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&cancel_queue.mutex);
     }
     return NULL;
 }
 
-void *suspend_reactivate_alarm_thread(void *arg) {
-    while (1) {
-        pthread_mutex_lock(&alarm_mutex);
-        alarm_t *current_alarm = alarm_list;
-        alarm_t *prev_alarm = NULL;
-        time_t current_time = time(NULL);
-
-        while (current_alarm != NULL) {
-            alarm_t *next_alarm = current_alarm->link;
-
-            if (strcmp(current_alarm->request_type, "Suspend_Alarm") == 0) {
-                alarm_t *target_alarm = alarm_list;
-                while (target_alarm != NULL) {
-    printf("DEBUG: Target Alarm ID: %d, Current Alarm ID: %d\n", target_alarm->alarm_id, current_alarm->alarm_id);
-    printf("DEBUG: Target Alarm Request: %s, Current Alarm Request: %s\n", target_alarm->request_type, current_alarm->request_type);
-    printf("DEBUG: Target Alarm Timestamp: %ld, Current Alarm Timestamp: %ld\n", target_alarm->timestamp, current_alarm->timestamp);
+// Suspend a Start_Alarm, keeping the time it has left. The caller must hold
+// the mutex of the alarm's shard.
+void suspend_start_alarm(alarm_t *alarm, time_t current_time) {
+    alarm->suspended = 1;
+    view_update(alarm);
+    alarm->remaining_sec = alarm->timer.time - current_time;
+
+    if (alarm->suspended_printed == 0) {
+        output_printf("Alarm(%d) Suspended at %ld: Group(%d) %ld %ld %s\n",
+                      alarm->alarm_id, current_time, alarm->group_id,
+                      alarm->timestamp, alarm->timer.time, alarm->message);
+        alarm->suspended_printed = 1;
+    }
+    event_log_write(EVENT_SUSPENDED, alarm->alarm_id, alarm->group_id, pthread_self());
+    display_post(alarm, FROM_SUSPEND_REACTIVATE, DISPLAY_SUSPEND);
+}
 
-    if (target_alarm->alarm_id == current_alarm->alarm_id &&
-        strcmp(target_alarm->request_type, "Start_Alarm") == 0 &&
-        target_alarm->timestamp < current_alarm->timestamp) {
+// Reactivate a Start_Alarm, which expires after the time it had left. The
+// caller must hold the mutex of the alarm's shard.
+void reactivate_start_alarm(alarm_t *alarm, time_t current_time) {
+    alarm->suspended = 0;
+    view_update(alarm);
+    alarm->timer.time = tick_clock_deadline(alarm->remaining_sec);
+    alarm->remaining_sec = 0; // Reset remaining time
+    timer_queue_update(&alarm_shard(alarm->alarm_id)->alarm_queue, &alarm->timer);
+    output_printf("Alarm(%d) Reactivated at %ld: Group(%d) %ld %ld %s\n",
+                  alarm->alarm_id, current_time, alarm->group_id,
+                  alarm->timestamp, alarm->timer.time, alarm->message);
+    event_log_write(EVENT_REACTIVATED, alarm->alarm_id, alarm->group_id, pthread_self());
+    expiry_changed(alarm);
+    display_post(alarm, FROM_SUSPEND_REACTIVATE, DISPLAY_REACTIVATE);
+}
 
-        printf("DEBUG: Match Found - Target Alarm ID: %d\n", target_alarm->alarm_id);
+// Suspend, or reactivate, the alarms of a group that were started before a
+// Suspend_Group or Reactivate_Group request. Alarms already in that state
+// are left alone. The caller must hold alarm_mutex and every shard's mutex.
+void suspend_reactivate_group(alarm_t *request, time_t current_time) {
+    bool suspend = request->request_type == SUSPEND_GROUP;
+    int count = 0;
 
-        target_alarm->suspend_status = 1;
-        target_alarm->remaining_sec = target_alarm->time - current_time;
+    group_command_handled(request);
 
-        if (target_alarm->suspended_printed == 0) {
-            printf("Alarm(%d) Suspended at %ld: Group(%d) %ld %ld %s\n",
-                   target_alarm->alarm_id, current_time, target_alarm->group_id,
-                   target_alarm->timestamp, target_alarm->time, target_alarm->message);
-            target_alarm->suspended_printed = 1;
+    for (int shard = 0; shard < consumer_count; shard++) {
+        group_members_t *members = members_find(&consumer_shards[shard], request->group_id);
+        for (int i = 0; members != NULL && i < members->member_count; i++) {
+            alarm_t *alarm = members->members[i];
+            if (alarm->timestamp > request->timestamp || alarm->suspended == suspend) {
+                continue;
+            }
+            if (suspend) {
+                suspend_start_alarm(alarm, current_time);
+            } else {
+                reactivate_start_alarm(alarm, current_time);
+            }
+            count++;
         }
-        break;
     }
-    target_alarm = target_alarm->link;
+    output_printf("%s(%d): %d Alarms %s at %ld\n", request_type_names[request->request_type],
+                  request->group_id, count, suspend ? "Suspended" : "Reactivated", current_time);
 }
-                if (target_alarm == NULL) {
-                    printf("Suspend Alarm Thread: Alarm(%d) not found.\n", current_alarm->alarm_id);
-                }
 
-                if (prev_alarm == NULL) {
-                    alarm_list = next_alarm;
-                } else {
-                    prev_alarm->link = next_alarm;
-                }
-                free(current_alarm);
-                current_alarm = next_alarm;
+void *suspend_reactivate_alarm_thread(void *arg) {
+    metrics_name_thread("Suspend/Reactivate Alarm Thread");
+    while (1) {
+        request_queue_wait(&suspend_reactivate_queue);
+        alarm_t *current_alarm;
+        time_t current_time = tick_clock_now();
+
+        while ((current_alarm = request_queue_pop(&suspend_reactivate_queue)) != NULL) {
+            if (current_alarm->request_type == SUSPEND_GROUP || current_alarm->request_type == REACTIVATE_GROUP) {
+                alarm_lock_all();
+                suspend_reactivate_group(current_alarm, current_time);
+                alarm_unlock_all();
+                free_alarm(current_alarm);
                 continue;
-            } else if (strcmp(current_alarm->request_type, "Reactivate_Alarm") == 0) {
-                alarm_t *target_alarm = alarm_list;
-                while (target_alarm != NULL) {
-                    if (target_alarm->alarm_id == current_alarm->alarm_id &&
-                        strcmp(target_alarm->request_type, "Start_Alarm") == 0 &&
-                        target_alarm->timestamp < current_alarm->timestamp) {
-                        target_alarm->suspend_status = 0;
-                        target_alarm->time = current_time + target_alarm->remaining_sec;
-                        target_alarm->remaining_sec = 0; // Reset remaining time
-                        target_alarm->last_printed = current_time - target_alarm->interval;
-                        printf("Alarm(%d) Reactivated at %ld: Group(%d) %ld %ld %s\n",
-                               target_alarm->alarm_id, current_time, target_alarm->group_id,
-                               target_alarm->timestamp, target_alarm->time, target_alarm->message);
-                        break;
-                    }
-                    target_alarm = target_alarm->link;
-                }
-                if (target_alarm == NULL) {
-                    printf("Reactivate Alarm Thread: Alarm(%d) not found.\n", current_alarm->alarm_id);
-                }
+            }
+
+            consumer_shard_t *shard = alarm_shard(current_alarm->alarm_id);
+            shard_lock(shard);
+            alarm_t *target_alarm = find_start_alarm(shard, current_alarm->alarm_id,
+                                                     current_alarm->timestamp);
+            command_handled(shard, target_alarm);
 
-                if (prev_alarm == NULL) {
-                    alarm_list = next_alarm;
+            switch (current_alarm->request_type) {
+            case SUSPEND_ALARM:
+                if (target_alarm != NULL) {
+                    suspend_start_alarm(target_alarm, current_time);
                 } else {
-                    prev_alarm->link = next_alarm;
+                    output_printf("Suspend Alarm Thread: Alarm(%d) not found.\n", current_alarm->alarm_id);
                 }
-                free(current_alarm);
-                current_alarm = next_alarm;
-                continue;
+                break;
+            case REACTIVATE_ALARM:
+                if (target_alarm != NULL) {
+                    reactivate_start_alarm(target_alarm, current_time);
+                } else {
+                    output_printf("Reactivate Alarm Thread: Alarm(%d) not found.\n", current_alarm->alarm_id);
+                }
+                break;
+            default:
+                break;
             }
-            prev_alarm = current_alarm;
-            current_alarm = next_alarm;
+            shard_unlock(shard);
+            free_alarm(current_alarm);
         }
-
-        pthread_mutex_unlock(&alarm_mutex);
-        sleep(1);
     }
     return NULL;
 }
 
-//start_alarm_request processing
-void start_alarm(char *line) {
+// Allocate a request and fill in every field, so the consumer and worker
+// threads can use it as it is. Fields a request type does not use are 0.
+// Returns NULL if there is no memory.
+alarm_t *new_request(request_type_t request_type, int alarm_id, int group_id,
+                     int seconds, int interval, const char *message) {
+    alarm_t *alarm = (alarm_t *)pool_alloc(&alarm_pool);
+    if (alarm == NULL) {
+        return NULL;
+    }
+    memset(alarm, 0, sizeof(alarm_t));
+    atomic_init(&alarm->mail, 0);
+    alarm->owner = -1;
+    alarm->view_slot = -1;
+    alarm->request_type = request_type;
+    alarm->alarm_id = alarm_id;
+    alarm->group_id = group_id;
+    alarm->seconds = seconds;
+    alarm->interval = interval;
+    alarm->message = string_arena_intern(&message_arena, message);
+    if (alarm->message == NULL) {
+        pool_free(&alarm_pool, alarm);
+        return NULL;
+    }
+    alarm->timestamp = tick_clock_now();
+    timer_node_init(&alarm->timer, tick_clock_deadline(seconds)); // Total duration, from the next whole tick
+    timer_node_init(&alarm->print_timer, 0);
+    return alarm;
+}
+
+//start_alarm_request processing. The alarm now belongs to the alarm list,
+// in its shard, which the calling consumer handles.
+void start_alarm(alarm_t *alarm) {
+    consumer_shard_t *shard = alarm_shard(alarm->alarm_id);
     int status;
-    alarm_t *alarm, **last, *next;
 
-    // Memory allocation
-    alarm = (alarm_t *)malloc(sizeof(alarm_t));
-    if (alarm == NULL) {
-        perror("Allocate alarm");
+    status = shard_lock(shard);
+    if (status != 0) {
+        perror("Lock mutex");
+        free_alarm(alarm);
         return;
     }
 
-    //Modified scanf to include interval
-    if (sscanf(line, "Start_Alarm(%d): %d %d %d %64[^\n]", &alarm->alarm_id, &alarm->group_id, &alarm->seconds, &alarm->interval, alarm->message) < 5) {
-        fprintf(stderr, "Bad command\n");
-        free(alarm);
+    // Checking for uniqueness of alarm_id
+    if (alarm_index_find(&shard->alarm_index, alarm->alarm_id) != NULL) {
+        output_printf("Error: Alarm ID %d is already in use.\n", alarm->alarm_id);
+        free_alarm(alarm);
+        shard_unlock(shard);
         return;
-    } else {
-        // Mutex lock before insertion
-        alarm->timestamp = time(NULL);
-        alarm->suspend_status = 0;
-        alarm->suspended_printed = 0; // Initialize suspended_printed
-        strcpy(alarm->request_type, "Start_Alarm");
-        alarm->time = time(NULL) + alarm->seconds; // Total duration
-        alarm->last_printed = 0;
-        alarm->changed_group = 0;
-        alarm->message_changed = 0;
-        alarm->interval_changed = 0;
-        alarm->cancelled = 0;
-
-        status = pthread_mutex_lock(&alarm_mutex);
-        if (status != 0) {
-            perror("Lock mutex");
-            free(alarm);
-            return;
-        }
-
-        // Checking for uniqueness of alarm_id
-        next = alarm_list;
-        while (next != NULL) {
-            if (next->alarm_id == alarm->alarm_id) {
-                printf("Error: Alarm ID %d is already in use.\n", alarm->alarm_id);
-                free(alarm);
-                pthread_mutex_unlock(&alarm_mutex);
-                return;
-            }
-            next = next->link;
-        }
+    }
 
-        // Insertion process
-        last = &alarm_list;
-        next = *last;
-        while (next != NULL && next->time < alarm->time) {
-            last = &next->link;
-            next = next->link;
-        }
+    if (group_join(alarm) != 0) {
+        output_printf("Error: no memory to add Alarm(%d) to Group(%d).\n", alarm->alarm_id, alarm->group_id);
+        free_alarm(alarm);
+        shard_unlock(shard);
+        return;
+    }
 
-        alarm->link = *last;
-        *last = alarm;
-        printf("Start_Alarm: alarm_list address after adding: %p\n", (void *)alarm_list);
+    // Insertion process
+    timer_queue_insert(&shard->alarm_queue, &alarm->timer);
+    alarm_index_insert(&shard->alarm_index, alarm->alarm_id, alarm);
+    view_insert(alarm);
+    request_queue_push(&start_queue, alarm);
+    expiry_changed(alarm);
+    output_printf("Start_Alarm: alarm_queue size after adding: %d\n", timer_queue_count(&shard->alarm_queue));
 
-        // Printing confirmation
-        printf("Start_Alarm(%d) Request Inserted Into Alarm List: %d %d %s\n", alarm->alarm_id, alarm->time, alarm->interval, alarm->message);
+    // Printing confirmation
+    output_printf("Start_Alarm(%d) Request Inserted Into Alarm List: %ld %d %s\n", alarm->alarm_id, alarm->timer.time, alarm->interval, alarm->message);
+    event_log_write(EVENT_INSERTED, alarm->alarm_id, alarm->group_id, pthread_self());
 
-        // DEBUG
+    // DEBUG
 #ifdef DEBUG
-        printf("[list: ");
-        for (next = alarm_list; next != NULL; next = next->link) {
-            time_t now = time(NULL);
-            printf("(%d sec) [\"%s\"] ", (int)(next->time - now), next->message);
-        }
-        printf("]\n");
-#endif
-
-        // Unlock mutex after successful insertion
-        status = pthread_mutex_unlock(&alarm_mutex);
-        if (status != 0) {
-            perror("Unlock mutex");
-            free(alarm);
-            return;
-        }
+    output_printf("[queue: ");
+    for (timer_node_t *node = timer_queue_first(&shard->alarm_queue); node != NULL;
+         node = timer_queue_iter_next(&shard->alarm_queue, node)) {
+        alarm_t *next = timer_entry(node, alarm_t, timer);
+        time_t now = tick_clock_now();
+        output_printf("(%g sec) [\"%s\"] ", tick_clock_seconds(next->timer.time - now), next->message);
     }
-}
-
-void remove_processed_alarms() {
-    pthread_mutex_lock(&alarm_mutex);
-    alarm_t *alarm = alarm_list;
-    alarm_t *prev = NULL;
+    output_printf("]\n");
+#endif
 
-    while (alarm != NULL) {
-        if (alarm->processed) {
-            // Remove processed alarm from the list
-            if (prev == NULL) {
-                alarm_list = alarm->link;  // Removing head of the list
-            } else {
-                prev->link = alarm->link;  // Removing from the middle or end
-            }
-            free(alarm);  // Free the alarm memory
-            alarm = (prev == NULL) ? alarm_list : prev->link;
-        } else {
-            prev = alarm;
-            alarm = alarm->link;
-        }
+    // Unlock mutex after successful insertion
+    status = shard_unlock(shard);
+    if (status != 0) {
+        perror("Unlock mutex");
     }
-    pthread_mutex_unlock(&alarm_mutex);
 }
 
-void change_alarm(char *line) {
+// Add a batch of Start_Alarm requests, chained through link, to the alarm
+// list under one lock: they are all for alarms in the calling consumer's
+// shard. The timer queue takes them all at once, so a large batch is
+// heapified rather than inserted one at a time.
+void start_alarms(alarm_t *batch) {
+    consumer_shard_t *shard = alarm_shard(batch->alarm_id);
+    timer_node_t *nodes[REQUEST_BATCH];
+    alarm_t *alarm, *next, *earliest = NULL;
+    int count = 0;
     int status;
-    alarm_t *new_alarm;
 
-    new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-    if (new_alarm == NULL) {
-        perror("Allocate alarm");
+    status = shard_lock(shard);
+    if (status != 0) {
+        perror("Lock mutex");
+        for (alarm = batch; alarm != NULL; alarm = next) {
+            next = alarm->link;
+            free_alarm(alarm);
+        }
         return;
     }
 
-    // Modified scanf to include interval
-    if (sscanf(line, "Change_Alarm(%d): %d %d %d %64[^\n]", &new_alarm->alarm_id, &new_alarm->group_id, &new_alarm->seconds, &new_alarm->interval, new_alarm->message) < 5) {
-        fprintf(stderr, "Bad command\n");
-        free(new_alarm);
-        return;
+    for (alarm = batch; alarm != NULL; alarm = next) {
+        next = alarm->link;
+        alarm->request_type = START_ALARM;
+        if (alarm_index_insert(&shard->alarm_index, alarm->alarm_id, alarm) != 0) {
+            output_printf("Error: Alarm ID %d is already in use.\n", alarm->alarm_id);
+            free_alarm(alarm);
+            continue;
+        }
+        if (group_join(alarm) != 0) {
+            output_printf("Error: no memory to add Alarm(%d) to Group(%d).\n", alarm->alarm_id, alarm->group_id);
+            alarm_index_remove(&shard->alarm_index, alarm->alarm_id);
+            free_alarm(alarm);
+            continue;
+        }
+        nodes[count++] = &alarm->timer;
+        view_insert(alarm);
+        request_queue_push(&start_queue, alarm);
+        event_log_write(EVENT_INSERTED, alarm->alarm_id, alarm->group_id, pthread_self());
+        if (earliest == NULL || alarm->timer.time < earliest->timer.time) {
+            earliest = alarm;
+        }
     }
+    timer_queue_insert_many(&shard->alarm_queue, nodes, count);
+    if (earliest != NULL) {
+        expiry_changed(earliest);
+    }
+    output_printf("Start_Alarm: %d Requests Inserted Into Alarm List as a Batch: alarm_queue size after adding: %d\n",
+                  count, timer_queue_count(&shard->alarm_queue));
 
-    new_alarm->timestamp = time(NULL);
-    new_alarm->suspend_status = 0;
-    strcpy(new_alarm->request_type, "Change_Alarm");
-    new_alarm->time = time(NULL) + new_alarm->seconds;
-    new_alarm->last_printed = 0;
-    new_alarm->changed_group = 0;
-    new_alarm->message_changed = 0;
-    new_alarm->interval_changed = 0;
-    new_alarm->cancelled = 0;
-
-    status = pthread_mutex_lock(&alarm_mutex);
+    status = shard_unlock(shard);
     if (status != 0) {
-        perror("Lock mutex");
-        free(new_alarm);
-        return;
+        perror("Unlock mutex");
     }
+}
 
-    new_alarm->link = change_alarm_list;
-    change_alarm_list = new_alarm;
-
-    printf("Change_Alarm(%d) Request Inserted Into Change Alarm List: %d %d %s\n", new_alarm->alarm_id, new_alarm->time, new_alarm->interval, new_alarm->message);
+// Queue a Change_Alarm request for the change alarm thread, which frees it.
+void change_alarm(alarm_t *new_alarm) {
+    consumer_shard_t *shard = alarm_shard(new_alarm->alarm_id);
+    int status;
 
-    printf("[change list: ");
-    alarm_t *next;
-    for (next = change_alarm_list; next != NULL; next = next->link) {
-        time_t now = time(NULL);
-        printf("(%d sec) [\"%s\"] ", (int)(next->time - now), next->message);
+    status = shard_lock(shard);
+    if (status != 0) {
+        perror("Lock mutex");
+        free_alarm(new_alarm);
+        return;
     }
-    printf("]\n");
 
+    // The change alarm thread takes the shard's mutex before it frees the
+    // request, so it may still be printed
+    queue_command(shard, &change_queue, new_alarm);
 
+    output_printf("Change_Alarm(%d) Request Inserted Into Change Alarm List: %ld %d %s\n", new_alarm->alarm_id, new_alarm->timer.time, new_alarm->interval, new_alarm->message);
 
+    print_request_queue("change list", &change_queue);
 
-    status = pthread_mutex_unlock(&alarm_mutex);
+    status = shard_unlock(shard);
     if (status != 0) {
         perror("Unlock mutex");
-        free(new_alarm);
-        return;
     }
 }
 
-void cancel_alarm(char *line) {
+// Queue a Cancel_Alarm request for the cancel alarm thread, which frees it.
+void cancel_alarm(alarm_t *new_alarm) {
+    consumer_shard_t *shard = alarm_shard(new_alarm->alarm_id);
     int status;
-    alarm_t *new_alarm, **last, *next;
 
-    new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-    if (new_alarm == NULL) {
-        perror("Allocate alarm");
+    status = shard_lock(shard);
+    if (status != 0) {
+        perror("Lock mutex");
+        free_alarm(new_alarm);
         return;
     }
 
-    if (sscanf(line, "Cancel_Alarm(%d)", &new_alarm->alarm_id) < 1) {
-        fprintf(stderr, "Bad command\n");
-        free(new_alarm);
-        return;
+    queue_command(shard, &cancel_queue, new_alarm);
+
+    output_printf("Cancel_Alarm(%d) Request Inserted Into Alarm List\n", new_alarm->alarm_id);
+
+#ifdef DEBUG
+    print_request_queue("list", &cancel_queue);
+#endif
+
+    status = shard_unlock(shard);
+    if (status != 0) {
+        perror("Unlock mutex");
     }
+}
 
-    new_alarm->timestamp = time(NULL);
-    strcpy(new_alarm->request_type, "Cancel_Alarm");
-    new_alarm->cancelled = 0;
+// Queue a Suspend_Alarm or Reactivate_Alarm request for the suspend/reactivate
+// alarm thread, which frees it.
+void suspend_reactivate_alarm(alarm_t *new_alarm) {
+    consumer_shard_t *shard = alarm_shard(new_alarm->alarm_id);
+    int status;
 
-    status = pthread_mutex_lock(&alarm_mutex);
+    status = shard_lock(shard);
     if (status != 0) {
         perror("Lock mutex");
-        free(new_alarm);
+        free_alarm(new_alarm);
         return;
     }
 
-    last = &alarm_list;
-    next = *last;
-    while (next != NULL && next->time < new_alarm->time) {
-        last = &next->link;
-        next = next->link;
-    }
-
-    new_alarm->link = *last;
-    *last = new_alarm;
+    queue_command(shard, &suspend_reactivate_queue, new_alarm);
 
-    printf("Cancel_Alarm(%d) Request Inserted Into Alarm List\n", new_alarm->alarm_id);
+    output_printf("%s(%d) Request Inserted Into Alarm List\n",
+                  request_type_names[new_alarm->request_type], new_alarm->alarm_id);
 
 #ifdef DEBUG
-    printf("[list: ");
-    for (next = alarm_list; next != NULL; next = next->link) {
-        time_t now = time(NULL);
-        printf("(%d sec) [\"%s\"] ", (int)(next->time - now), next->message);
-    }
-    printf("]\n");
+    print_request_queue("list", &suspend_reactivate_queue);
 #endif
 
-    status = pthread_mutex_unlock(&alarm_mutex);
+    status = shard_unlock(shard);
     if (status != 0) {
         perror("Unlock mutex");
-        free(new_alarm);
-        return;
     }
 }
 
-void suspend_alarm(char *line) {
-    int status;
-    alarm_t *new_alarm, **last, *next;
+// Whether the calling consumer is the last to take a request sent to every
+// consumer. The caller must hold alarm_mutex.
+bool last_consumer(alarm_t *request) {
+    return --request->consumers_left == 0;
+}
 
-    new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-    if (new_alarm == NULL) {
-        perror("Allocate alarm");
-        return;
+// Take a View_Alarms request from a consumer's buffer. The last consumer to
+// take it queues it for the view alarms thread, which frees it.
+void view_alarms(alarm_t *new_alarm) {
+    alarm_lock();
+    bool last = last_consumer(new_alarm);
+    if (last) {
+        request_queue_push(&view_queue, new_alarm);
     }
+    alarm_unlock();
 
-    if (sscanf(line, "Suspend_Alarm(%d)", &new_alarm->alarm_id) < 1) {
-        fprintf(stderr, "Bad command\n");
-        free(new_alarm);
-        return;
+    if (last) {
+        output_printf("View_Alarms Request Inserted Into Alarm List\n");
     }
+}
 
-    new_alarm->timestamp = time(NULL);
-    strcpy(new_alarm->request_type, "Suspend_Alarm");
-    new_alarm->cancelled = 0;
+// Show a report, such as metrics_report, as one piece of output.
+void print_report(void (*report)(FILE *)) {
+    char *text;
+    size_t length;
+    FILE *file = open_memstream(&text, &length);
 
-    status = pthread_mutex_lock(&alarm_mutex);
-    if (status != 0) {
-        perror("Lock mutex");
-        free(new_alarm);
+    if (file == NULL) {
+        perror("Report");
         return;
     }
+    report(file);
+    fclose(file);
+    output_write(text, length);
+    free(text);
+}
+
+// Take a Stats request from a consumer's buffer. The last consumer to take
+// it prints the runtime metrics, and frees it.
+void stats_request(alarm_t *request) {
+    alarm_lock();
+    bool last = last_consumer(request);
+    alarm_unlock();
+
+    if (last) {
+        print_report(metrics_report);
+        free_alarm(request);
+    }
+}
 
-    last = &alarm_list;
-    next = *last;
-    while (next != NULL && next->time < new_alarm->time) {
-        last = &next->link;
-        next = next->link;
+// Print the alarms in a group for a View_Group request. The group's members
+// in each shard are read with every shard's mutex held, which takes time in
+// proportion to the size of the group. The caller must hold alarm_mutex and
+// every shard's mutex.
+void view_group(alarm_t *request) {
+    time_t view_time = tick_clock_now();
+    int count = 1;
+
+    group_command_handled(request);
+
+    output_printf("View Group(%d) at View Time %ld:\n", request->group_id, view_time);
+    for (int shard = 0; shard < consumer_count; shard++) {
+        group_members_t *members = members_find(&consumer_shards[shard], request->group_id);
+        for (int i = 0; members != NULL && i < members->member_count; i++) {
+            alarm_t *alarm = members->members[i];
+            display_thread_t *owner = find_display_thread(alarm);
+            if (owner != NULL) {
+                output_printf("%d. Alarm(%d): Group(%d) Status %d Assigned Display Thread %lu\n",
+                              count++, alarm->alarm_id, alarm->group_id, alarm->suspended, owner->thread_id);
+            } else {
+                output_printf("%d. Alarm(%d): Group(%d) Status %d Assigned Display Thread (Not Found)\n",
+                              count++, alarm->alarm_id, alarm->group_id, alarm->suspended);
+            }
+        }
     }
+    output_printf("View Group(%d) request %ld Alarm Requests Viewed at View Time %ld printed by View Alarms Thread %lu\n",
+                  request->group_id, request->timestamp, view_time, pthread_self());
+}
 
-    new_alarm->link = *last;
-    *last = new_alarm;
+// Print the alarms for each View_Alarms request. The view is read from
+// view_table under view_epoch, with no lock, so the other threads go on
+// starting, printing and expiring alarms while it is printed; each alarm is
+// shown as its record was at some moment during the view.
+void *view_alarms_thread(void *arg) {
+    int reader = epoch_register(&view_epoch);
 
-    printf("Suspend_Alarm(%d) Request Inserted Into Alarm List\n", new_alarm->alarm_id);
+    metrics_name_thread("View Alarms Thread");
+    while (1) {
+        request_queue_wait(&view_queue);
+        alarm_t *current_alarm = request_queue_pop(&view_queue);
+        if (current_alarm->request_type == VIEW_GROUP) {
+            alarm_lock_all();
+            view_group(current_alarm);
+            alarm_unlock_all();
+            free_alarm(current_alarm);
+            continue;
+        }
 
-#ifdef DEBUG
-    printf("[list: ");
-    for (next = alarm_list; next != NULL; next = next->link) {
-        time_t now = time(NULL);
-        printf("(%d sec) [\"%s\"] ", (int)(next->time - now), next->message);
+        time_t view_time = tick_clock_now();
+        int count = 1;
+        output_printf("View Alarms at View Time %ld:\n", view_time);
+        epoch_enter(&view_epoch, reader);
+        view_table_t *table = atomic_load_explicit(&view_table, memory_order_acquire);
+        for (int i = 0; table != NULL && i < table->size; i++) {
+            alarm_view_t *view = atomic_load_explicit(&table->slots[i], memory_order_acquire);
+            if (view == NULL) {
+                continue;
+            }
+            if (view->owner != 0) {
+                output_printf("%d. Alarm(%d): Group(%d) Status %d Assigned Display Thread %lu\n",
+                              count++, view->alarm_id, view->group_id, view->suspend_status, view->owner);
+            } else {
+                output_printf("%d. Alarm(%d): Group(%d) Status %d Assigned Display Thread (Not Found)\n",
+                              count++, view->alarm_id, view->group_id, view->suspend_status);
+            }
+        }
+        epoch_exit(&view_epoch, reader);
+        output_printf("View Alarms request %ld Alarm Requests Viewed at View Time %ld printed by View Alarms Thread %lu\n",
+                      current_alarm->timestamp, view_time, pthread_self());
+
+        pthread_mutex_lock(&view_mutex);
+        epoch_reclaim(&view_epoch); // Free what was retired during the view
+        pthread_mutex_unlock(&view_mutex);
+        free_alarm(current_alarm);
     }
-    printf("]\n");
-#endif
+    return NULL;
+}
+// Whether a request is for a group, rather than for one alarm.
+bool is_group_request(alarm_t *request) {
+    return request->request_type >= CANCEL_GROUP;
+}
 
-    status = pthread_mutex_unlock(&alarm_mutex);
-    if (status != 0) {
-        perror("Unlock mutex");
-        free(new_alarm);
-        return;
+// Circular buffer functions
+void insert_into_buffer(consumer_shard_t *shard, alarm_t *alarm) {
+    // The consumer may take and free the request as soon as it is in the
+    // buffer, so copy what the message needs first.
+    request_type_t request_type = alarm->request_type;
+    int id = is_group_request(alarm) ? alarm->group_id : alarm->alarm_id;
+    time_t timestamp = alarm->timestamp;
+    long blocked_ns;
+    size_t index = ring_push(&shard->circular_buffer, alarm, &blocked_ns);
+    metrics_record(METRIC_RING_OCCUPANCY, ring_count(&shard->circular_buffer));
+    if (blocked_ns > 0) {
+        metrics_record(METRIC_RING_BLOCKED, blocked_ns);
     }
+    output_printf("Alarm Thread has Inserted %s Request(%d) at %ld into Circular_Buffer Index: %zu\n",
+                  request_type_names[request_type], id, timestamp, index);
 }
 
-void reactivate_alarm(char *line) {
-    int status;
-    alarm_t *new_alarm, **last, *next;
+alarm_t *retrieve_from_buffer(consumer_shard_t *shard) {
+    size_t index;
+    alarm_t *alarm = ring_pop(&shard->circular_buffer, &index);
+    output_printf("Consumer Thread has Retrieved %s Request(%d) at %ld from Circular_Buffer Index: %zu\n",
+                  request_type_names[alarm->request_type], is_group_request(alarm) ? alarm->group_id : alarm->alarm_id,
+                  alarm->timestamp, index);
+    return alarm;
+}
 
-    new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-    if (new_alarm == NULL) {
-        perror("Allocate alarm");
-        return;
+// Convert a number of seconds from a command, which may have a fraction,
+// to ticks. Returns 0, or -1 if that many ticks do not fit in an int.
+int seconds_to_ticks(double seconds, int *ticks) {
+    if (!(seconds >= INT_MIN && seconds <= INT_MAX)) {
+        return -1; // Too many ticks at any rate, or not a number
     }
-
-    if (sscanf(line, "Reactivate_Alarm(%d)", &new_alarm->alarm_id) < 1) {
-        fprintf(stderr, "Bad command\n");
-        free(new_alarm);
-        return;
+    time_t value = tick_clock_ticks(seconds);
+    if (value < INT_MIN || value > INT_MAX) {
+        return -1;
     }
+    *ticks = (int)value;
+    return 0;
+}
 
-    new_alarm->timestamp = time(NULL);
-    strcpy(new_alarm->request_type, "Reactivate_Alarm");
-    new_alarm->cancelled = 0;
-
-    status = pthread_mutex_lock(&alarm_mutex);
-    if (status != 0) {
-        perror("Lock mutex");
-        free(new_alarm);
+// Start_Alarm requests parsed from one chunk of input and not yet sent, one
+// chain (through link) for each consumer. Used only by main.
+typedef struct request_batch {
+    alarm_t *head;
+    alarm_t **tail;
+    int count;
+} request_batch_t;
+
+request_batch_t *request_batches;
+
+// Send a consumer's pending Start_Alarms. Several take one circular buffer
+// entry: the first request, retagged START_ALARM_BATCH, with the rest
+// chained behind it.
+void flush_batch(request_batch_t *batch) {
+    if (batch->count == 0) {
         return;
     }
-
-    last = &alarm_list;
-    next = *last;
-    while (next != NULL && next->time < new_alarm->time) {
-        last = &next->link;
-        next = next->link;
+    if (batch->count > 1) {
+        batch->head->request_type = START_ALARM_BATCH;
     }
+    insert_into_buffer(&consumer_shards[batch - request_batches], batch->head);
+    batch->head = NULL;
+    batch->tail = &batch->head;
+    batch->count = 0;
+}
 
-    new_alarm->link = *last;
-    *last = new_alarm;
-
-    printf("Reactivate_Alarm(%d) Request Inserted Into Alarm List\n", new_alarm->alarm_id);
+void flush_batches(void) {
+    for (int i = 0; i < consumer_count; i++) {
+        flush_batch(&request_batches[i]);
+    }
+}
 
-#ifdef DEBUG
-    printf("[list: ");
-    for (next = alarm_list; next != NULL; next = next->link) {
-        time_t now = time(NULL);
-        printf("(%d sec) [\"%s\"] ", (int)(next->time - now), next->message);
+// Build a Start_Alarm request and add it to its consumer's batch, which is
+// sent once it is full or the input runs out. Returns 0, or -1 if there is
+// no memory.
+int batch_request(int alarm_id, int group_id, int seconds, int interval, const char *message) {
+    alarm_t *request = new_request(START_ALARM, alarm_id, group_id, seconds, interval, message);
+    if (request == NULL) {
+        return -1;
     }
-    printf("]\n");
-#endif
+    request_batch_t *batch = &request_batches[(unsigned int)alarm_id % consumer_count];
+    request->link = NULL;
+    *batch->tail = request;
+    batch->tail = &request->link;
+    if (++batch->count == REQUEST_BATCH) {
+        flush_batch(batch);
+    }
+    return 0;
+}
 
-    status = pthread_mutex_unlock(&alarm_mutex);
-    if (status != 0) {
-        perror("Unlock mutex");
-        free(new_alarm);
-        return;
+// Build a request and pass it to the consumer thread for its alarm, after
+// any Start_Alarms still batched for that consumer.
+// Returns 0, or -1 if there is no memory.
+int submit_request(request_type_t request_type, int alarm_id, int group_id,
+                   int seconds, int interval, const char *message) {
+    alarm_t *request = new_request(request_type, alarm_id, group_id, seconds, interval, message);
+    if (request == NULL) {
+        return -1;
     }
+    flush_batch(&request_batches[(unsigned int)alarm_id % consumer_count]);
+    insert_into_buffer(alarm_shard(alarm_id), request);
+    return 0;
 }
 
-void view_alarms(char *line) {
-    alarm_t *new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-    new_alarm->time = time(NULL);
-    new_alarm->alarm_request = 1;
-    strcpy(new_alarm->message, "View Alarms Request");
-    strcpy(new_alarm->request_type, "View_Alarms");
-    new_alarm->cancelled = 0;
-    pthread_mutex_lock(&alarm_mutex);
-    new_alarm->link = alarm_list;
-    alarm_list = new_alarm;
-    pthread_mutex_unlock(&alarm_mutex);
+// Pass a request to every consumer thread, after the Start_Alarms batched
+// for each. Each consumer takes it once it has handled every request before
+// it in its buffer, and the last to take it acts on it, so it comes after
+// every command before it.
+void broadcast_request(alarm_t *request) {
+    request->consumers_left = consumer_count;
+    flush_batches();
+    for (int i = 0; i < consumer_count; i++) {
+        insert_into_buffer(&consumer_shards[i], request);
+    }
+}
 
-    printf("View_Alarms Request Inserted Into Alarm List\n");
+// Build a request that is not for one alarm, such as a group request, and
+// pass it to every consumer thread. Returns 0, or -1 if there is no memory.
+int submit_broadcast_request(request_type_t request_type, int group_id, const char *message) {
+    alarm_t *request = new_request(request_type, 0, group_id, 0, 0, message);
+    if (request == NULL) {
+        return -1;
+    }
+    broadcast_request(request);
+    return 0;
 }
 
-void *view_alarms_thread(void *arg) {
-    while (1) {
-        pthread_mutex_lock(&alarm_mutex);
-        alarm_t *current_alarm = alarm_list;
-        alarm_t *prev_alarm = NULL;
-        time_t view_time = time(NULL);
-
-        while (current_alarm != NULL) {
-            alarm_t *next_alarm = current_alarm->link;
-
-            if (strcmp(current_alarm->request_type, "View_Alarms") == 0) {
-                printf("View Alarms at View Time %ld:\n", view_time);
-                int count = 1;
-
-                alarm_t *temp_alarm = alarm_list;
-                while (temp_alarm != NULL) {
-                    if (strcmp(temp_alarm->request_type, "Start_Alarm") == 0) {
-                        display_thread_t *display_thread = display_threads;
-                        pthread_t assigned_thread_id = 0; // Initialize to 0
-                        bool thread_found = false;
-
-                        while (display_thread != NULL) {
-                            for (int i = 0; i < display_thread->alarm_count; i++) {
-                                if (display_thread->alarms[i] != NULL && display_thread->alarms[i]->alarm_id == temp_alarm->alarm_id) {
-                                    assigned_thread_id = display_thread->thread_id;
-                                    thread_found = true;
-                                    break;
-                                }
-                            }
-                            if (thread_found) break;
-                            display_thread = display_thread->next;
-                        }
-
-                        if (thread_found) {
-                            printf("%d. Alarm(%d): Group(%d) Status %d Assigned Display Thread %lu\n",
-                                   count++, temp_alarm->alarm_id, temp_alarm->group_id, temp_alarm->suspend_status, assigned_thread_id);
-                        } else {
-                            printf("%d. Alarm(%d): Group(%d) Status %d Assigned Display Thread (Not Found)\n",
-                                   count++, temp_alarm->alarm_id, temp_alarm->group_id, temp_alarm->suspend_status);
-                        }
-                    }
-                    temp_alarm = temp_alarm->link;
-                }
+// Take a group request from a consumer's buffer. The last consumer to take
+// it queues it for the worker thread for its type, which frees it, once
+// every group command queued before it for the same group has been handled.
+// Each type has its own worker, so without this a View_Group could overtake
+// an earlier Cancel_Group. The request's command_pending says whether it
+// holds its group's.
+void group_request(alarm_t *request) {
+    alarm_lock();
+    if (last_consumer(request)) {
+        alarm_group_t *group;
+        while ((group = group_find(request->group_id)) != NULL && group->command_pending) {
+            alarm_wait(&group_command_done, 0);
+        }
+        group = group_get(request->group_id);
+        if (group != NULL) {
+            group->command_pending = true;
+            request->command_pending = 1;
+        }
+        switch (request->request_type) {
+        case CANCEL_GROUP:
+            request_queue_push(&cancel_queue, request);
+            break;
+        case SUSPEND_GROUP:
+        case REACTIVATE_GROUP:
+            request_queue_push(&suspend_reactivate_queue, request);
+            break;
+        default:
+            request_queue_push(&view_queue, request);
+            break;
+        }
+        output_printf("%s(%d) Request Inserted Into Alarm List\n",
+                      request_type_names[request->request_type], request->group_id);
+    }
+    alarm_unlock();
+}
 
-                printf("View Alarms request %ld Alarm Requests Viewed at View Time %ld printed by View Alarms Thread %lu\n",
-                       current_alarm->timestamp, view_time, pthread_self());
+void *consumer_thread(void *arg) {
+    consumer_shard_t *shard = (consumer_shard_t *)arg;
 
-                if (prev_alarm == NULL) {
-                    alarm_list = next_alarm;
-                } else {
-                    prev_alarm->link = next_alarm;
-                }
-                free(current_alarm);
-                current_alarm = next_alarm;
-                break;
-            }
-            prev_alarm = current_alarm;
-            current_alarm = next_alarm;
+    metrics_name_thread("Consumer Thread %d", (int)(shard - consumer_shards));
+    while (1) {
+        alarm_t *alarm = retrieve_from_buffer(shard);
+
+        // The request was parsed by main; hand it on as it is. Each handler
+        // takes over the request and frees it when it is done.
+        switch (alarm->request_type) {
+        case START_ALARM:
+            start_alarm(alarm);
+            break;
+        case CHANGE_ALARM:
+            change_alarm(alarm);
+            break;
+        case CANCEL_ALARM:
+            cancel_alarm(alarm);
+            break;
+        case SUSPEND_ALARM:
+        case REACTIVATE_ALARM:
+            suspend_reactivate_alarm(alarm);
+            break;
+        case VIEW_ALARMS:
+            view_alarms(alarm);
+            break;
+        case START_ALARM_BATCH:
+            start_alarms(alarm);
+            break;
+        case STATS:
+            stats_request(alarm);
+            break;
+        case CANCEL_GROUP:
+        case SUSPEND_GROUP:
+        case REACTIVATE_GROUP:
+        case VIEW_GROUP:
+            group_request(alarm);
+            break;
         }
-
-        pthread_mutex_unlock(&alarm_mutex);
-        sleep(1);
     }
     return NULL;
 }
-// Circular buffer functions
-void insert_into_buffer(alarm_t *alarm) {
-    pthread_mutex_lock(&buffer_mutex);
-    while (buffer_count == CIRCULAR_BUFFER_SIZE) {
-        pthread_cond_wait(&buffer_not_full, &buffer_mutex);
-    }
-    circular_buffer[buffer_tail] = alarm;
-    buffer_tail = (buffer_tail + 1) % CIRCULAR_BUFFER_SIZE;
-    buffer_count++;
-    pthread_cond_signal(&buffer_not_empty);
-    printf("Alarm Thread has Inserted %s Request(%d) at %ld into Circular_Buffer Index: %d\n",
-           alarm->request_type, alarm->alarm_id, alarm->timestamp, (buffer_tail - 1 + CIRCULAR_BUFFER_SIZE) % CIRCULAR_BUFFER_SIZE);
-    pthread_mutex_unlock(&buffer_mutex);
-}
-
-alarm_t *retrieve_from_buffer() {
-    pthread_mutex_lock(&buffer_mutex);
-    while (buffer_count == 0) {
-        pthread_cond_wait(&buffer_not_empty, &buffer_mutex);
-    }
-    alarm_t *alarm = circular_buffer[buffer_head];
-    buffer_head = (buffer_head + 1) % CIRCULAR_BUFFER_SIZE;
-    buffer_count--;
-    pthread_cond_signal(&buffer_not_full);
-    printf("Consumer Thread has Retrieved %s Request(%d) at %ld from Circular_Buffer Index: %d\n",
-           alarm->request_type, alarm->alarm_id, alarm->timestamp, (buffer_head - 1 + CIRCULAR_BUFFER_SIZE) % CIRCULAR_BUFFER_SIZE);
-    pthread_mutex_unlock(&buffer_mutex);
-    return alarm;
+
+// Report the pools' counters. Once the pools have grown to the working set,
+// the number of mallocs stops changing.
+void print_pool_stats(void) {
+    pool_stats_t stats;
+
+    pool_stats(&alarm_pool, &stats);
+    output_printf("Alarm pool: %lu mallocs, %lu objects, %lu allocations, %lu frees\n",
+                  stats.slabs, stats.objects, stats.allocs, stats.frees);
+    pool_stats(&group_pool, &stats);
+    output_printf("Group pool: %lu mallocs, %lu objects, %lu allocations, %lu frees\n",
+                  stats.slabs, stats.objects, stats.allocs, stats.frees);
+    pool_stats(&members_pool, &stats);
+    output_printf("Members pool: %lu mallocs, %lu objects, %lu allocations, %lu frees\n",
+                  stats.slabs, stats.objects, stats.allocs, stats.frees);
+    pool_stats(&view_pool, &stats);
+    output_printf("View pool: %lu mallocs, %lu objects, %lu allocations, %lu frees\n",
+                  stats.slabs, stats.objects, stats.allocs, stats.frees);
 }
 
-void *consumer_thread(void *arg) {
+#ifdef LOCK_PROFILE
+// Shows the lock profile each time SIGUSR1 arrives. main blocks the
+// signals in arg before it starts any thread, so only this thread takes
+// them, with sigwait, and can do what a signal handler could not.
+void *lock_profile_thread(void *arg) {
+    sigset_t *signals = (sigset_t *)arg;
+    int signal_number;
+
     while (1) {
-        alarm_t *alarm = retrieve_from_buffer();
-        if (alarm == NULL) {
-            sleep(1);
-            continue;
+        if (sigwait(signals, &signal_number) == 0) {
+            print_report(lock_profile_report);
         }
-        char line[256]; // Assuming a maximum line length of 256
-        snprintf(line, sizeof(line), "%s(%d): %d %d %s",
-                 alarm->request_type, alarm->alarm_id, alarm->group_id,
-                 alarm->seconds, alarm->message);
-
-        if (strcmp(alarm->request_type, "Start_Alarm") == 0) {
-            start_alarm(line);
-        } else if (strcmp(alarm->request_type, "Change_Alarm") == 0) {
-            change_alarm(line);
-        } else if (strcmp(alarm->request_type, "Cancel_Alarm") == 0) {
-            cancel_alarm(line);
-        } else if (strcmp(alarm->request_type, "Suspend_Alarm") == 0) {
-            suspend_alarm(line);
-        } else if (strcmp(alarm->request_type, "Reactivate_Alarm") == 0) {
-            reactivate_alarm(line);
-        } else if (strcmp(alarm->request_type, "View_Alarms") == 0) {
-            view_alarms(line);
-        }
-        free(alarm);
     }
     return NULL;
 }
+#endif
 
-int main(int argc, char *argv[]) {
-    int status;
-    char line[128];
-    pthread_t display_thread;
-    pthread_t view_thread;
-    pthread_t consumer_thread_id;
-    pthread_t start_alarm_tid, change_alarm_tid, cancel_alarm_tid, suspend_reactivate_tid;
-    display_thread_t *display_thread_data = (display_thread_t *)malloc(sizeof(display_thread_t));
-    if (display_thread_data == NULL) {
-        perror("Allocate display thread");
-        return 1;
+// Write the metrics report to stats_path. It is written to stats_temp_path,
+// which then replaces stats_path, so a reader never sees part of a report.
+// Both the stats thread and main at exit write it, one at a time.
+void write_stats(void) {
+    static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+    FILE *file;
+
+    pthread_mutex_lock(&stats_mutex);
+    file = fopen(stats_temp_path, "w");
+    if (file == NULL) {
+        perror(stats_temp_path);
+    } else {
+        metrics_report(file);
+        if (fclose(file) != 0 || rename(stats_temp_path, stats_path) != 0) {
+            perror(stats_path);
+        }
     }
+    pthread_mutex_unlock(&stats_mutex);
+}
 
-    display_thread_data->alarm_count = 0;
-    memset(display_thread_data->alarms, 0, sizeof(display_thread_data->alarms));
-    display_thread_data->next = NULL;
+// With --stats, writes the report every stats_interval seconds.
+void *stats_thread(void *arg) {
+    while (1) {
+        sleep(stats_interval);
+        write_stats();
+    }
+    return NULL;
+}
 
-    status = pthread_create(&display_thread, NULL, display_alarm_thread, display_thread_data);
+// Parse one command line and pass it on. Start_Alarms are batched, so the
+// caller must flush_batches() before it waits for more input.
+void handle_command(const char *line) {
+    command_t command;
+    command_error_t error;
+    int seconds = 0, interval = 0;
+    int status = 0;
+
+    // Start_Alarm(id): group seconds interval message
+    // Change_Alarm(id): group seconds interval message
+    // Cancel_Alarm(id), Suspend_Alarm(id), Reactivate_Alarm(id), View_Alarms
+    // Cancel_Group(group), Suspend_Group(group), Reactivate_Group(group), View_Group(group)
+    // Stats
+    // Seconds and interval may have a fraction; they are kept in ticks.
+    if (command_parse(line, &command, &error) != 0) {
+        fprintf(stderr, "Bad command: %s at column %d\n", error.reason, error.column);
+        metrics_count(METRIC_BAD_COMMANDS, 1);
+        return;
+    }
+    metrics_count(command.kind, 1);
+    if (command.kind == COMMAND_START_ALARM || command.kind == COMMAND_CHANGE_ALARM) {
+        if (seconds_to_ticks(command.seconds, &seconds) != 0 ||
+            seconds_to_ticks(command.interval, &interval) != 0) {
+            fprintf(stderr, "Bad command: seconds or interval out of range\n");
+            return;
+        }
+    }
+    switch (command.kind) {
+    case COMMAND_START_ALARM:
+        status = batch_request(command.alarm_id, command.group_id, seconds, interval, command.message);
+        break;
+    case COMMAND_CHANGE_ALARM:
+        status = submit_request(CHANGE_ALARM, command.alarm_id, command.group_id, seconds, interval, command.message);
+        break;
+    case COMMAND_CANCEL_ALARM:
+        status = submit_request(CANCEL_ALARM, command.alarm_id, 0, 0, 0, "");
+        break;
+    case COMMAND_SUSPEND_ALARM:
+        status = submit_request(SUSPEND_ALARM, command.alarm_id, 0, 0, 0, "");
+        break;
+    case COMMAND_REACTIVATE_ALARM:
+        status = submit_request(REACTIVATE_ALARM, command.alarm_id, 0, 0, 0, "");
+        break;
+    case COMMAND_VIEW_ALARMS:
+        status = submit_broadcast_request(VIEW_ALARMS, 0, "View Alarms Request");
+        break;
+    case COMMAND_CANCEL_GROUP:
+        status = submit_broadcast_request(CANCEL_GROUP, command.group_id, "");
+        break;
+    case COMMAND_SUSPEND_GROUP:
+        status = submit_broadcast_request(SUSPEND_GROUP, command.group_id, "");
+        break;
+    case COMMAND_REACTIVATE_GROUP:
+        status = submit_broadcast_request(REACTIVATE_GROUP, command.group_id, "");
+        break;
+    case COMMAND_VIEW_GROUP:
+        status = submit_broadcast_request(VIEW_GROUP, command.group_id, "");
+        break;
+    case COMMAND_STATS:
+        status = submit_broadcast_request(STATS, 0, "");
+        break;
+    }
     if (status != 0) {
-        perror("Create display alarm thread");
-        return 1;
+        perror("Allocate alarm");
     }
+}
 
-    printf("Display Alarm Thread %lu Created at %ld\n", display_thread, time(NULL));
-    pthread_create(&consumer_thread_id, NULL, consumer_thread, NULL);
-    printf("Consumer Thread %lu Created at %ld\n", consumer_thread_id, time(NULL));
-    pthread_create(&view_thread, NULL, view_alarms_thread, NULL);
-    printf("View Alarms Thread %lu Created at %ld\n", view_thread, time(NULL));
-    pthread_create(&start_alarm_tid, NULL, start_alarm_thread, NULL);
-    pthread_create(&change_alarm_tid, NULL, change_alarm_thread, NULL);
-    pthread_create(&cancel_alarm_tid, NULL, cancel_alarm_thread, NULL);
-    pthread_create(&suspend_reactivate_tid, NULL, suspend_reactivate_alarm_thread, NULL);
-
-    sem_init(&read_count_mutex, 0, 1);
-    sem_init(&resource_mutex, 0, 1);
+// Read commands from fd in large chunks until end of file, handling each
+// complete line. The Start_Alarms in a chunk go to the consumers in batches,
+// all of which are sent before the next read, which may block. If prompt is
+// true, a prompt is printed before each read.
+void read_commands(int fd, bool prompt) {
+    static char input[INPUT_CHUNK + 1];
+    size_t length = 0;
+    char *line, *newline;
+    ssize_t count;
 
     while (1) {
-        printf("alarm> ");
-
-        if (fgets(line, sizeof(line), stdin) == NULL) exit(0);
-
-        if (strlen(line) <= 1) continue;
-
-        if (strncmp(line, "Start_Alarm", 11) == 0) {
-            alarm_t *new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-            if (new_alarm == NULL) {
-                perror("Allocate alarm");
+        if (prompt) {
+            output_printf("alarm> ");
+        }
+        count = read(fd, input + length, INPUT_CHUNK - length);
+        if (count < 0) {
+            if (errno == EINTR) {
                 continue;
             }
-            if (sscanf(line, "Start_Alarm(%d): %d %d %64[^\n]", &new_alarm->alarm_id, &new_alarm->group_id, &new_alarm->seconds, new_alarm->message) < 4) {
-                fprintf(stderr, "Bad command\n");
-                free(new_alarm);
-                continue;
+            perror("Read commands");
+            return;
+        }
+        if (count == 0) {
+            if (length > 0) {
+                input[length] = '\0';
+                handle_command(input); // Last line, with no newline
             }
+            flush_batches();
+            return;
+        }
+        length += count;
 
-            new_alarm->timestamp = time(NULL);
-            new_alarm->suspend_status = 0;
-            strcpy(new_alarm->request_type, "Start_Alarm");
-            new_alarm->time = time(NULL) + new_alarm->seconds;
-            new_alarm->interval = new_alarm->seconds; // Initialize interval
-            new_alarm->last_printed = 0;
-            new_alarm->changed_group = 0;
-
-            insert_into_buffer(new_alarm);
-        } else if (strncmp(line, "Change_Alarm", 12) == 0) {
-            alarm_t *new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-            if (new_alarm == NULL) {
-                perror("Allocate alarm");
-                continue;
-            }
-            if (sscanf(line, "Change_Alarm(%d): %d %d %64[^\n]", &new_alarm->alarm_id, &new_alarm->group_id, &new_alarm->seconds, new_alarm->message) < 4) {
-                fprintf(stderr, "Bad command\n");
-                free(new_alarm);
-                continue;
+        line = input;
+        while ((newline = memchr(line, '\n', input + length - line)) != NULL) {
+            *newline = '\0';
+            if (newline > line) {
+                handle_command(line);
             }
+            line = newline + 1;
+        }
+        if (line == input && length == INPUT_CHUNK) {
+            input[length] = '\0';
+            handle_command(input); // A line too long for the buffer
+            line = input + length;
+        }
+        flush_batches();
+        length -= line - input;
+        memmove(input, line, length);
+    }
+}
 
-            new_alarm->timestamp = time(NULL);
-            new_alarm->suspend_status = 0;
-            strcpy(new_alarm->request_type, "Change_Alarm");
-            new_alarm->time = time(NULL) + new_alarm->seconds;
-            new_alarm->interval = new_alarm->seconds; // Initialize interval
-            new_alarm->last_printed = 0;
-            new_alarm->changed_group = 0;
-
-            insert_into_buffer(new_alarm);
-        } else if (strncmp(line, "Cancel_Alarm", 12) == 0) {
-            alarm_t *new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-            if (new_alarm == NULL) {
-                perror("Allocate alarm");
+int main(int argc, char *argv[]) {
+    int status;
+    pthread_t view_thread, stats_tid;
+    pthread_t start_alarm_tid, change_alarm_tid, cancel_alarm_tid, suspend_reactivate_tid;
+    int option;
+    long buffer_size = CIRCULAR_BUFFER_SIZE;
+    int ticks_per_second = TICK_CLOCK_SECONDS;
+    char *end;
+    char *load_path = NULL;
+    char *events_path = NULL;
+    static const struct option long_options[] = {
+        {"load", required_argument, NULL, 'l'},
+        {"events", required_argument, NULL, 'E'},
+        {"stats", required_argument, NULL, 'S'},
+        {"stats-interval", required_argument, NULL, 'I'},
+        {NULL, 0, NULL, 0}
+    };
+
+    // --load file (or -l) reads commands from a file before standard input,
+    // --events file logs alarm events to a binary file (see event_log.h),
+    // --stats file writes the metrics report to a file every
+    // --stats-interval seconds (10 by default) and at exit,
+    // -q heap|wheel selects the timer queue used for expiry and printing,
+    // -b the capacity of each circular buffer, -c the number of consumers,
+    // -d the number of display threads, -m millisecond times
+    display_thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (display_thread_count < 1) {
+        display_thread_count = 1;
+    }
+    while ((option = getopt_long(argc, argv, "q:b:c:d:ml:", long_options, NULL)) != -1) {
+        if (option == 'l') {
+            load_path = optarg;
+            continue;
+        }
+        if (option == 'E') {
+            events_path = optarg;
+            continue;
+        }
+        if (option == 'S') {
+            stats_path = optarg;
+            continue;
+        }
+        if (option == 'I') {
+            stats_interval = (int)strtol(optarg, &end, 10);
+            if (*end == '\0' && stats_interval > 0) {
                 continue;
             }
-            if (sscanf(line, "Cancel_Alarm(%d)", &new_alarm->alarm_id) < 1) {
-                fprintf(stderr, "Bad command\n");
-                free(new_alarm);
+        }
+        if (option == 'm') {
+            ticks_per_second = TICK_CLOCK_MILLISECONDS;
+            continue;
+        }
+        if (option == 'q' && timer_queue_kind_parse(optarg, &timer_queue_kind) == 0) {
+            continue;
+        }
+        if (option == 'b') {
+            buffer_size = strtol(optarg, &end, 10);
+            if (*end == '\0' && buffer_size > 0) {
                 continue;
             }
-
-            new_alarm->timestamp = time(NULL);
-            strcpy(new_alarm->request_type, "Cancel_Alarm");
-
-            insert_into_buffer(new_alarm);
-        } else if (strncmp(line, "Suspend_Alarm", 13) == 0
-    ) {
-            alarm_t *new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-            if (new_alarm == NULL) {
-                perror("Allocate alarm");
+        }
+        if (option == 'c') {
+            consumer_count = (int)strtol(optarg, &end, 10);
+            if (*end == '\0' && consumer_count > 0) {
                 continue;
             }
-            if (sscanf(line, "Suspend_Alarm(%d)", &new_alarm->alarm_id) < 1) {
-                fprintf(stderr, "Bad command\n");
-                free(new_alarm);
+        }
+        if (option == 'd') {
+            display_thread_count = (int)strtol(optarg, &end, 10);
+            if (*end == '\0' && display_thread_count > 0) {
                 continue;
             }
+        }
+        fprintf(stderr, "Usage: %s [-q heap|wheel] [-b buffer_size] [-c consumers] [-d display_threads] [-m] [--load file] [--events file] [--stats file] [--stats-interval seconds]\n", argv[0]);
+        return 1;
+    }
+    tick_clock_init(ticks_per_second);
+    status = metrics_init(metric_counter_names, METRIC_COUNTERS,
+                          metric_histogram_names, METRIC_HISTOGRAMS,
+                          metric_gauge_names, METRIC_GAUGES);
+    if (status != 0) {
+        fprintf(stderr, "Start metrics: %s\n", strerror(status));
+        return 1;
+    }
+    metrics_name_thread("Main Thread");
+#ifdef LOCK_PROFILE
+    // SIGUSR1 shows the lock profile, which is also shown at exit. It is
+    // blocked before any thread starts, so that every thread inherits that.
+    static sigset_t profile_signals;
+    pthread_t lock_profile_tid;
+
+    sigemptyset(&profile_signals);
+    sigaddset(&profile_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &profile_signals, NULL);
+#endif
+    status = profiled_mutex_init(&alarm_mutex, "alarm_mutex");
+    if (status != 0) {
+        fprintf(stderr, "Create alarm_mutex: %s\n", strerror(status));
+        return 1;
+    }
+    // Output goes through a writer thread, so no thread blocks on the
+    // terminal while it holds a mutex
+    if (output_init() != 0) {
+        fprintf(stderr, "Start output thread\n");
+        return 1;
+    }
+#ifdef LOCK_PROFILE
+    pthread_create(&lock_profile_tid, NULL, lock_profile_thread, &profile_signals);
+#endif
+    if (events_path != NULL) {
+        status = event_log_open(events_path, EVENT_LOG_RECORDS);
+        if (status != 0) {
+            fprintf(stderr, "%s: %s\n", events_path, strerror(status));
+            return 1;
+        }
+    }
+    if (pool_init(&alarm_pool, "alarm_pool", sizeof(alarm_t), POOL_SLAB_OBJECTS) != 0 ||
+        pool_init(&group_pool, "group_pool", sizeof(alarm_group_t), POOL_SLAB_OBJECTS) != 0 ||
+        pool_init(&members_pool, "members_pool", sizeof(group_members_t), POOL_SLAB_OBJECTS) != 0 ||
+        pool_init(&view_pool, "view_pool", sizeof(alarm_view_t), POOL_SLAB_OBJECTS) != 0 ||
+        string_arena_init(&message_arena, "message_arena") != 0) {
+        fprintf(stderr, "Create pools\n");
+        return 1;
+    }
+    epoch_init(&view_epoch);
+    consumer_shards = (consumer_shard_t *)malloc(consumer_count * sizeof(consumer_shard_t));
+    if (consumer_shards == NULL) {
+        perror("Allocate consumer shards");
+        return 1;
+    }
+    for (int i = 0; i < consumer_count; i++) {
+        consumer_shard_t *shard = &consumer_shards[i];
+
+        status = ring_init(&shard->circular_buffer, (size_t)buffer_size);
+        if (status == EINVAL) {
+            fprintf(stderr, "Circular buffer size must be a power of 2\n");
+            return 1;
+        } else if (status != 0) {
+            fprintf(stderr, "Create circular buffer: %s\n", strerror(status));
+            return 1;
+        }
+        snprintf(shard->mutex_name, sizeof(shard->mutex_name), "Shard %d mutex", i);
+        status = profiled_mutex_init(&shard->mutex, shard->mutex_name);
+        if (status == 0) {
+            status = pthread_cond_init(&shard->command_done, NULL);
+        }
+        if (status != 0) {
+            fprintf(stderr, "Create shard mutex: %s\n", strerror(status));
+            return 1;
+        }
+        timer_queue_init(&shard->alarm_queue, timer_queue_kind, tick_clock_now());
+        shard->alarm_index = (alarm_index_t)ALARM_INDEX_INITIALIZER;
+        shard->group_index = (alarm_index_t)ALARM_INDEX_INITIALIZER;
+    }
 
-            new_alarm->timestamp = time(NULL);
-            strcpy(new_alarm->request_type, "Suspend_Alarm");
-
-            insert_into_buffer(new_alarm);
-        } else if (strncmp(line, "Reactivate_Alarm", 16) == 0) {
-            alarm_t *new_alarm = (alarm_t *)malloc(sizeof(alarm_t));
-            if (new_alarm == NULL) {
-                perror("Allocate alarm");
-                continue;
-            }
-            if (sscanf(line, "Reactivate_Alarm(%d)", &new_alarm->alarm_id) < 1) {
-                fprintf(stderr, "Bad command\n");
-                free(new_alarm);
-                continue;
+    display_threads = (display_thread_t *)calloc(display_thread_count, sizeof(display_thread_t));
+    if (display_threads == NULL) {
+        perror("Allocate display threads");
+        return 1;
+    }
+    // Timed waits use CLOCK_MONOTONIC, so setting the clock does not stretch them
+    if (tick_clock_cond_init(&cancel_queue.cond) != 0) {
+        perror("Create cancel condition");
+        return 1;
+    }
+    for (int i = 0; i < display_thread_count; i++) {
+        snprintf(display_threads[i].mutex_name, sizeof(display_threads[i].mutex_name), "Display Thread %d mutex", i);
+        status = profiled_mutex_init(&display_threads[i].mutex, display_threads[i].mutex_name);
+        if (status != 0) {
+            fprintf(stderr, "Create display mutex: %s\n", strerror(status));
+            return 1;
+        }
+        atomic_init(&display_threads[i].load, 0);
+        for (int from = 0; from < DISPLAY_SENDERS; from++) {
+            status = mailbox_init(&display_threads[i].mailboxes[from]);
+            if (status != 0) {
+                fprintf(stderr, "Create display mailbox: %s\n", strerror(status));
+                return 1;
             }
+        }
+        timer_queue_init(&display_threads[i].print_queue, timer_queue_kind, tick_clock_now());
+        if (tick_clock_cond_init(&display_threads[i].wakeup) != 0) {
+            perror("Create display condition");
+            return 1;
+        }
+        status = pthread_create(&display_threads[i].thread_id, NULL, display_alarm_thread, &display_threads[i]);
+        if (status != 0) {
+            perror("Create display alarm thread");
+            return 1;
+        }
+        output_printf("Display Alarm Thread %lu Created at %ld\n", display_threads[i].thread_id, tick_clock_now());
+    }
+    for (int i = 0; i < consumer_count; i++) {
+        pthread_create(&consumer_shards[i].thread_id, NULL, consumer_thread, &consumer_shards[i]);
+        output_printf("Consumer Thread %lu Created at %ld\n", consumer_shards[i].thread_id, tick_clock_now());
+    }
+    pthread_create(&view_thread, NULL, view_alarms_thread, NULL);
+    output_printf("View Alarms Thread %lu Created at %ld\n", view_thread, tick_clock_now());
+    pthread_create(&start_alarm_tid, NULL, start_alarm_thread, NULL);
+    pthread_create(&change_alarm_tid, NULL, change_alarm_thread, NULL);
+    pthread_create(&cancel_alarm_tid, NULL, cancel_alarm_thread, NULL);
+    pthread_create(&suspend_reactivate_tid, NULL, suspend_reactivate_alarm_thread, NULL);
+    if (stats_path != NULL) {
+        stats_temp_path = malloc(strlen(stats_path) + sizeof(".tmp"));
+        if (stats_temp_path == NULL) {
+            perror("Allocate stats path");
+            return 1;
+        }
+        sprintf(stats_temp_path, "%s.tmp", stats_path);
+        pthread_create(&stats_tid, NULL, stats_thread, NULL);
+    }
 
-            new_alarm->timestamp = time(NULL);
-            strcpy(new_alarm->request_type, "Reactivate_Alarm");
 
-            insert_into_buffer(new_alarm);
-        } else if (strncmp(line, "View_Alarms", 11) == 0) {
-            view_alarms(line);
-        } else {
-            fprintf(stderr, "Bad command\n");
+    request_batches = (request_batch_t *)calloc(consumer_count, sizeof(request_batch_t));
+    if (request_batches == NULL) {
+        perror("Allocate request batches");
+        return 1;
+    }
+    for (int i = 0; i < consumer_count; i++) {
+        request_batches[i].tail = &request_batches[i].head;
+    }
+
+    if (load_path != NULL) {
+        struct timespec load_start, load_end;
+        int fd = open(load_path, O_RDONLY);
+
+        if (fd < 0) {
+            perror(load_path);
+            return 1;
         }
+        clock_gettime(CLOCK_MONOTONIC, &load_start);
+        read_commands(fd, false);
+        clock_gettime(CLOCK_MONOTONIC, &load_end);
+        close(fd);
+        output_printf("Loaded %s in %.3f seconds\n", load_path,
+                      (load_end.tv_sec - load_start.tv_sec) + (load_end.tv_nsec - load_start.tv_nsec) / 1e9);
     }
 
+    read_commands(STDIN_FILENO, true);
+    print_pool_stats();
+    if (stats_path != NULL) {
+        write_stats();
+    }
+#ifdef LOCK_PROFILE
+    print_report(lock_profile_report);
+#endif
+    output_flush();
+    event_log_sync();
     return 0;
 }
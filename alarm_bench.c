@@ -0,0 +1,619 @@
+/*
+ * alarm_bench.c
+ *
+ * Benchmark New_Alarm_cond.c, with each combination of timer
+ * queue, consumer thread count and display thread count given,
+ * and report the results as CSV on standard output, one line for
+ * each combination.
+ *
+ * For each combination the program is run in high-resolution mode
+ * ("-m") with its commands on a pipe and its event log ("--events",
+ * see event_log.h) in a temporary file, which the benchmark maps
+ * and reads as the program writes it. The event log's timestamps
+ * are CLOCK_MONOTONIC, as are the benchmark's, so the time from
+ * sending a command to its effect can be measured directly. There
+ * are three phases, the first in a run of the program of its own,
+ * so the alarms it leaves do not slow the others' View_Alarms:
+ *
+ *  1. Ingest: Start_Alarms are written to the pipe as fast as it
+ *     takes them, and the rate is the number of alarms over the
+ *     time from the first write to the last alarm inserted.
+ *
+ *  2. Latency: a mix of commands (see workload.h) is sent at a
+ *     steady rate, and each command's latency is the time from
+ *     sending it to the event that shows its effect: inserted,
+ *     changed, cancelled, suspended or reactivated. View_Alarms
+ *     has no event, so it adds load but is not measured.
+ *
+ *  3. Jitter: Start_Alarms are sent with random seconds, up to a
+ *     second, and each alarm's jitter is the time it expired less
+ *     the time it was sent plus its seconds. Deadlines are rounded
+ *     up to a whole millisecond tick, so it is never negative.
+ *
+ * Times in the results are in microseconds. "missing" counts the
+ * effects and expiries that were not seen within a time limit.
+ *
+ * Usage: alarm_bench [-p program] [-q queues] [-c consumers]
+ *                    [-d displays] [-n alarms] [-l commands]
+ *                    [-r rate] [-j alarms] [-x mix]
+ *
+ * where queues, consumers and displays are lists separated by
+ * commas, such as "-q heap,wheel -c 1,4".
+ */
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "event_log.h"
+#include "workload.h"
+#include "errors.h"
+
+#define BENCH_LIST      8       /* values in a list, at most */
+#define BENCH_WAIT      30      /* seconds to wait for a phase's events */
+
+/*
+ * An event read from the log, or a command sent, stored with the
+ * type of the event that shows its effect.
+ */
+typedef struct bench_event_tag {
+    uint64_t            time;
+    int32_t             alarm_id;
+    uint32_t            type;
+} bench_event_t;
+
+typedef struct bench_events_tag {
+    bench_event_t       *events;
+    size_t              count;
+    size_t              size;
+} bench_events_t;
+
+/*
+ * The event log of the program being run, mapped read-only.
+ */
+typedef struct bench_log_tag {
+    event_log_header_t  *header;
+    event_record_t      *records;
+    size_t              map_size;
+    uint64_t            next;           /* next record to read */
+    bench_events_t      read;           /* records read so far */
+} bench_log_t;
+
+/*
+ * The effect event of each kind of command; EVENT_NONE if it has
+ * none.
+ */
+static const event_type_t bench_effects[WORKLOAD_KINDS] = {
+    EVENT_INSERTED, EVENT_CHANGED, EVENT_CANCELLED,
+    EVENT_SUSPENDED, EVENT_REACTIVATED, EVENT_NONE
+};
+
+#define BENCH_EFFECTS \
+    ((1u << EVENT_INSERTED) | (1u << EVENT_CHANGED) \
+    | (1u << EVENT_CANCELLED) | (1u << EVENT_SUSPENDED) \
+    | (1u << EVENT_REACTIVATED))
+
+static uint64_t bench_now (void)
+{
+    struct timespec now;
+
+    if (clock_gettime (CLOCK_MONOTONIC, &now) != 0)
+        errno_abort ("Get time");
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void bench_sleep_until (uint64_t when)
+{
+    struct timespec until;
+
+    until.tv_sec = when / 1000000000;
+    until.tv_nsec = when % 1000000000;
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL)
+        == EINTR)
+        ;
+}
+
+static void bench_add (
+    bench_events_t *list, uint64_t time, int alarm_id, uint32_t type)
+{
+    if (list->count == list->size) {
+        list->size = list->size == 0 ? 4096 : list->size * 2;
+        list->events = (bench_event_t*)realloc (
+            list->events, list->size * sizeof (bench_event_t));
+        if (list->events == NULL)
+            errno_abort ("Allocate events");
+    }
+    list->events[list->count].time = time;
+    list->events[list->count].alarm_id = alarm_id;
+    list->events[list->count].type = type;
+    list->count++;
+}
+
+/*
+ * Write all of a buffer to the program. Returns 0, or -1 if the
+ * program has gone.
+ */
+static int bench_write (int fd, const char *buffer, size_t length)
+{
+    ssize_t written;
+
+    while (length > 0) {
+        written = write (fd, buffer, length);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buffer += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/*
+ * Map the event log once the program has created it. Returns 0,
+ * or -1 if it has not appeared within a few seconds.
+ */
+static int bench_log_open (bench_log_t *log, const char *path)
+{
+    event_log_header_t header;
+    uint64_t give_up = bench_now () + 5000000000ULL;
+    int fd;
+
+    while (1) {
+        fd = open (path, O_RDONLY);
+        if (fd >= 0) {
+            if (read (fd, &header, sizeof (header)) == sizeof (header)
+                && memcmp (header.magic, EVENT_LOG_MAGIC,
+                    sizeof (header.magic)) == 0
+                && header.capacity > 0)
+                break;
+            close (fd);
+        }
+        if (bench_now () > give_up)
+            return -1;
+        bench_sleep_until (bench_now () + 1000000);
+    }
+    log->map_size = sizeof (event_log_header_t)
+        + header.capacity * sizeof (event_record_t);
+    log->header = (event_log_header_t*)mmap (
+        NULL, log->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (log->header == MAP_FAILED)
+        errno_abort ("Map event log");
+    log->records = (event_record_t*)(log->header + 1);
+    log->next = 0;
+    log->read.count = 0;
+    return 0;
+}
+
+static void bench_log_close (bench_log_t *log)
+{
+    munmap (log->header, log->map_size);
+}
+
+/*
+ * Read the records the program has finished writing, up to the
+ * first it has not.
+ */
+static void bench_log_read (bench_log_t *log)
+{
+    uint64_t count = atomic_load (&log->header->count);
+    event_record_t *record;
+    uint32_t type;
+
+    if (count > log->header->capacity)
+        count = log->header->capacity;
+    for (; log->next < count; log->next++) {
+        record = &log->records[log->next];
+        type = atomic_load_explicit (&record->type, memory_order_acquire);
+        if (type == EVENT_NONE)
+            break;
+        bench_add (&log->read, record->time, record->alarm_id, type);
+    }
+}
+
+/*
+ * Wait until the log has "want" events of the types in "mask" for
+ * alarms "first" to "last", counting from event "from". Returns
+ * the number seen, which is less than "want" if they did not all
+ * come within BENCH_WAIT seconds.
+ */
+static long bench_wait (bench_log_t *log, size_t from,
+    uint32_t mask, int first, int last, long want)
+{
+    uint64_t give_up = bench_now () + BENCH_WAIT * 1000000000ULL;
+    bench_event_t *event;
+    long seen = 0;
+
+    while (1) {
+        bench_log_read (log);
+        for (; from < log->read.count; from++) {
+            event = &log->read.events[from];
+            if ((mask & (1u << event->type)) && event->alarm_id >= first
+                && event->alarm_id <= last)
+                seen++;
+        }
+        if (seen >= want || bench_now () > give_up)
+            return seen;
+        bench_sleep_until (bench_now () + 1000000);
+    }
+}
+
+static int bench_compare (const void *a, const void *b)
+{
+    const bench_event_t *x = (const bench_event_t*)a;
+    const bench_event_t *y = (const bench_event_t*)b;
+
+    if (x->type != y->type)
+        return x->type < y->type ? -1 : 1;
+    if (x->alarm_id != y->alarm_id)
+        return x->alarm_id < y->alarm_id ? -1 : 1;
+    if (x->time != y->time)
+        return x->time < y->time ? -1 : 1;
+    return 0;
+}
+
+static int bench_compare_values (const void *a, const void *b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Pair each command with its effect: the nth command of a type
+ * for an alarm with the nth event of that type for that alarm,
+ * among the events from "from" on for alarms "first" to "last".
+ * Stores the delays (event time less command time, in ns) in
+ * "values", sorted, and returns how many there are.
+ */
+static long bench_match (bench_events_t *commands, bench_log_t *log,
+    size_t from, int first, int last, int64_t *values)
+{
+    bench_events_t effects = {NULL, 0, 0};
+    bench_event_t *event;
+    size_t i, j;
+    long count = 0;
+
+    for (i = from; i < log->read.count; i++) {
+        event = &log->read.events[i];
+        if ((BENCH_EFFECTS | (1u << EVENT_EXPIRED)) & (1u << event->type)
+            && event->alarm_id >= first && event->alarm_id <= last)
+            bench_add (&effects, event->time, event->alarm_id, event->type);
+    }
+    qsort (commands->events, commands->count, sizeof (bench_event_t),
+        bench_compare);
+    qsort (effects.events, effects.count, sizeof (bench_event_t),
+        bench_compare);
+    for (i = j = 0; i < commands->count && j < effects.count; ) {
+        bench_event_t *command = &commands->events[i];
+        bench_event_t *effect = &effects.events[j];
+
+        if (command->type == effect->type
+            && command->alarm_id == effect->alarm_id) {
+            values[count++] = (int64_t)(effect->time - command->time);
+            i++;
+            j++;
+        } else if (bench_compare (command, effect) < 0)
+            i++;
+        else
+            j++;
+    }
+    free (effects.events);
+    qsort (values, count, sizeof (int64_t), bench_compare_values);
+    return count;
+}
+
+/*
+ * Print the given percentiles of sorted values, in microseconds.
+ */
+static void bench_print_percentiles (int64_t *values, long count)
+{
+    static const int percentiles[] = {50, 90, 99, 100};
+    int i;
+    long index;
+
+    for (i = 0; i < 4; i++) {
+        if (count == 0) {
+            printf (",");
+            continue;
+        }
+        index = (count * percentiles[i]) / 100;
+        if (index >= count)
+            index = count - 1;
+        printf (",%.1f", values[index] / 1000.0);
+    }
+}
+
+/*
+ * Start the program with commands on a pipe, whose write end is
+ * returned in "input". Returns its process id.
+ */
+static pid_t bench_start (const char *program, const char *queue,
+    const char *consumers, const char *displays, const char *events,
+    int *input)
+{
+    int fds[2], null;
+    pid_t pid;
+
+    if (pipe (fds) != 0)
+        errno_abort ("Create pipe");
+    pid = fork ();
+    if (pid < 0)
+        errno_abort ("Fork");
+    if (pid == 0) {
+        null = open ("/dev/null", O_WRONLY);
+        dup2 (fds[0], STDIN_FILENO);
+        dup2 (null, STDOUT_FILENO);
+        dup2 (null, STDERR_FILENO);
+        close (fds[0]);
+        close (fds[1]);
+        execl (program, program, "-m", "-q", queue, "-c", consumers,
+            "-d", displays, "--events", events, (char*)NULL);
+        _exit (127);
+    }
+    close (fds[0]);
+    *input = fds[1];
+    return pid;
+}
+
+/*
+ * Start the program, as bench_start, and map its event log.
+ */
+static pid_t bench_launch (const char *program, const char *queue,
+    const char *consumers, const char *displays, char *events,
+    bench_log_t *log, int *input)
+{
+    pid_t pid;
+    int fd;
+
+    strcpy (events, "/tmp/alarm_bench.XXXXXX");
+    fd = mkstemp (events);
+    if (fd < 0)
+        errno_abort ("Create event log");
+    close (fd);
+    pid = bench_start (program, queue, consumers, displays, events, input);
+    if (bench_log_open (log, events) != 0) {
+        fprintf (stderr, "%s did not start\n", program);
+        exit (1);
+    }
+    return pid;
+}
+
+/*
+ * End the program's input, at which it exits, and remove its log.
+ */
+static void bench_finish (pid_t pid, char *events, bench_log_t *log,
+    int input)
+{
+    close (input);
+    if (waitpid (pid, NULL, 0) < 0)
+        errno_abort ("Wait for program");
+    bench_log_close (log);
+    unlink (events);
+}
+
+/*
+ * Write a command to the program, which must still be running.
+ */
+static void bench_send (int input, const char *line, size_t length)
+{
+    if (bench_write (input, line, length) != 0) {
+        fprintf (stderr, "Program stopped\n");
+        exit (1);
+    }
+}
+
+/*
+ * Run the three phases against one configuration and print its
+ * line of results.
+ */
+static void bench_run (const char *program, const char *queue,
+    const char *consumers, const char *displays, long alarms,
+    long commands, double rate, long jitter_alarms, const char *mix)
+{
+    char events[32];
+    bench_log_t log = {NULL, NULL, 0, 0, {NULL, 0, 0}};
+    bench_events_t sent = {NULL, 0, 0};
+    workload_t workload;
+    char line[128], *buffer;
+    size_t length, from;
+    uint64_t start, last, interval;
+    int64_t *values;
+    long i, seen, missing = 0, count;
+    int input, alarm_id, first, status, ticks;
+    workload_kind_t kind;
+    pid_t pid;
+
+    printf ("%s,%s,%s", queue, consumers, displays);
+
+    /*
+     * 1. Ingest: the commands are made first, so the rate is the
+     * program's and not the generator's.
+     */
+    buffer = (char*)malloc (alarms * 64 + 1);
+    if (buffer == NULL)
+        errno_abort ("Allocate commands");
+    for (i = 0, length = 0; i < alarms; i++)
+        length += sprintf (buffer + length,
+            "Start_Alarm(%ld): %ld 100000 100000 m\n", i + 1, 1 + i % 100);
+    pid = bench_launch (program, queue, consumers, displays, events,
+        &log, &input);
+    start = bench_now ();
+    bench_send (input, buffer, length);
+    free (buffer);
+    seen = bench_wait (&log, 0, 1u << EVENT_INSERTED, 1, (int)alarms, alarms);
+    missing += alarms - seen;
+    for (i = 0, last = start; i < (long)log.read.count; i++)
+        if (log.read.events[i].type == EVENT_INSERTED
+            && log.read.events[i].time > last)
+            last = log.read.events[i].time;
+    printf (",%ld,%.3f,%.0f", alarms, (last - start) / 1e9,
+        last > start ? seen / ((last - start) / 1e9) : 0.0);
+    bench_finish (pid, events, &log, input);
+
+    /*
+     * 2. Latency, at a steady rate.
+     */
+    pid = bench_launch (program, queue, consumers, displays, events,
+        &log, &input);
+    log.read.count = 0;
+    first = 1;
+    from = 0;
+    status = workload_init (&workload, first, 1);
+    if (status != 0)
+        err_abort (status, "Init workload");
+    if (mix != NULL && workload_set_mix (&workload, mix) != 0) {
+        fprintf (stderr, "Bad mix \"%s\"\n", mix);
+        exit (1);
+    }
+    workload.seconds = 100000;
+    interval = (uint64_t)(1e9 / rate);
+    start = bench_now ();
+    for (i = 0; i < commands; i++) {
+        bench_sleep_until (start + i * interval);
+        kind = workload_next (&workload, line, sizeof (line), &alarm_id);
+        if (bench_effects[kind] != EVENT_NONE)
+            bench_add (&sent, bench_now (), alarm_id, bench_effects[kind]);
+        bench_send (input, line, strlen (line));
+    }
+    seen = bench_wait (&log, from, BENCH_EFFECTS,
+        first, workload.next_id - 1, (long)sent.count);
+    missing += (long)sent.count - seen;
+    values = (int64_t*)malloc ((sent.count + jitter_alarms + 1)
+        * sizeof (int64_t));
+    if (values == NULL)
+        errno_abort ("Allocate results");
+    count = bench_match (&sent, &log, from, first, workload.next_id - 1,
+        values);
+    printf (",%ld", count);
+    bench_print_percentiles (values, count);
+
+    /*
+     * 3. Expiry jitter. Each alarm's "command" time is when it
+     * should expire.
+     */
+    first = workload.next_id;
+    from = log.read.count;
+    sent.count = 0;
+    for (i = 0; i < jitter_alarms; i++) {
+        ticks = 1 + (int)(workload_random (&workload) % 1000);
+        sprintf (line, "Start_Alarm(%ld): 1 %d.%03d 100000 j\n",
+            first + i, ticks / 1000, ticks % 1000);
+        bench_add (&sent, bench_now () + ticks * 1000000ULL,
+            (int)(first + i), EVENT_EXPIRED);
+        bench_send (input, line, strlen (line));
+    }
+    workload_destroy (&workload);
+    seen = bench_wait (&log, from, 1u << EVENT_EXPIRED,
+        first, first + (int)jitter_alarms - 1, jitter_alarms);
+    missing += jitter_alarms - seen;
+    count = bench_match (&sent, &log, from,
+        first, first + (int)jitter_alarms - 1, values);
+    printf (",%ld", count);
+    bench_print_percentiles (values, count);
+    printf (",%ld\n", missing);
+    fflush (stdout);
+
+    bench_finish (pid, events, &log, input);
+    free (values);
+    free (sent.events);
+    free (log.read.events);
+}
+
+/*
+ * Split a list separated by commas, in place. Returns the number
+ * of values, or 0 if there are too many or one is empty.
+ */
+static int bench_split (char *list, char *values[BENCH_LIST])
+{
+    int count = 0;
+    char *value;
+
+    for (value = strtok (list, ","); value != NULL;
+            value = strtok (NULL, ",")) {
+        if (count == BENCH_LIST)
+            return 0;
+        values[count++] = value;
+    }
+    return count;
+}
+
+int main (int argc, char *argv[])
+{
+    char *program = "./New_Alarm_cond", *mix = NULL, *end = "";
+    char queue_list[64] = "heap,wheel", consumer_list[64] = "1,4";
+    char display_list[64] = "1,4";
+    char *queues[BENCH_LIST], *consumers[BENCH_LIST];
+    char *displays[BENCH_LIST];
+    int queue_count, consumer_count, display_count, q, c, d, option;
+    long alarms = 100000, commands = 10000, jitter_alarms = 2000;
+    double rate = 5000;
+
+    while ((option = getopt (argc, argv, "p:q:c:d:n:l:r:j:x:")) != -1) {
+        end = "";
+        switch (option) {
+            case 'p':
+                program = optarg;
+                break;
+            case 'q':
+                snprintf (queue_list, sizeof (queue_list), "%s", optarg);
+                break;
+            case 'c':
+                snprintf (consumer_list, sizeof (consumer_list), "%s", optarg);
+                break;
+            case 'd':
+                snprintf (display_list, sizeof (display_list), "%s", optarg);
+                break;
+            case 'n':
+                alarms = strtol (optarg, &end, 10);
+                break;
+            case 'l':
+                commands = strtol (optarg, &end, 10);
+                break;
+            case 'r':
+                rate = strtod (optarg, &end);
+                break;
+            case 'j':
+                jitter_alarms = strtol (optarg, &end, 10);
+                break;
+            case 'x':
+                mix = optarg;
+                break;
+            default:
+                end = "?";
+                break;
+        }
+        if (*end != '\0' || alarms < 1 || commands < 0 || rate <= 0
+            || jitter_alarms < 0)
+            break;
+    }
+    queue_count = bench_split (queue_list, queues);
+    consumer_count = bench_split (consumer_list, consumers);
+    display_count = bench_split (display_list, displays);
+    if (optind < argc || *end != '\0' || alarms < 1 || commands < 0
+        || rate <= 0 || jitter_alarms < 0 || queue_count == 0
+        || consumer_count == 0 || display_count == 0) {
+        fprintf (stderr, "Usage: %s [-p program] [-q queues] "
+            "[-c consumers] [-d displays] [-n alarms] [-l commands] "
+            "[-r rate] [-j alarms] [-x mix]\n", argv[0]);
+        return 1;
+    }
+    signal (SIGPIPE, SIG_IGN);
+
+    printf ("queue,consumers,displays,"
+        "ingest_alarms,ingest_seconds,ingest_per_second,"
+        "latency_commands,latency_p50_us,latency_p90_us,"
+        "latency_p99_us,latency_max_us,"
+        "jitter_alarms,jitter_p50_us,jitter_p90_us,"
+        "jitter_p99_us,jitter_max_us,missing\n");
+    for (q = 0; q < queue_count; q++)
+        for (c = 0; c < consumer_count; c++)
+            for (d = 0; d < display_count; d++)
+                bench_run (program, queues[q], consumers[c], displays[d],
+                    alarms, commands, rate, jitter_alarms, mix);
+    return 0;
+}
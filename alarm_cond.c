@@ -8,38 +8,56 @@
  * corresponds to the earliest timer request. If the main thread
  * enters an earlier timeout, it signals the condition variable
  * so that the alarm thread will wake up and process the earlier
- * timeout first, requeueing the later request.
+ * timeout first, leaving the later request queued.
+ *
+ * Pending alarms are kept in a timer queue (timer_queue.c)
+ * rather than a sorted list. By default the queue is a binary
+ * min-heap, so inserting an alarm is O(log n) and the earliest
+ * alarm is always at the root; "-q wheel" selects a hierarchical
+ * timing wheel instead, for O(1) insert and expiry.
+ *
+ * Times are kept in ticks of the tick clock (tick_clock.c): whole
+ * seconds by default, or with "-m", milliseconds of the monotonic
+ * clock, so that alarms may be given fractions of a second.
+ *
+ * With "-e", the program runs an event loop instead of the alarm
+ * thread: the main thread waits with epoll on both standard input
+ * and a timerfd armed for the earliest alarm, so commands and
+ * expirations are handled by one thread, with no mutex and no
+ * condition variable.
  */
 #include <pthread.h>
 #include <time.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include "errors.h"
+#include "timer_queue.h"
+#include "tick_clock.h"
 
 /*
- * The "alarm" structure now contains the time_t (time since the
- * Epoch, in seconds) for each alarm, so that they can be
- * sorted. Storing the requested number of seconds would not be
- * enough, since the "alarm thread" cannot tell how long it has
- * been on the list.
+ * The "alarm" structure now contains the expiration time (in
+ * ticks) for each alarm, so that they can be sorted. Storing the
+ * requested number of seconds would not be enough, since the
+ * "alarm thread" cannot tell how long it has been on the list.
  */
 typedef struct alarm_tag {
-    struct alarm_tag    *link;
-    int                 seconds;
-    time_t              time;   /* seconds from EPOCH */
-    char                message[64];
+    timer_node_t        timer;  /* timer.time: ticks, see tick_clock.h */
+    double              seconds;
+    char                message[65]; /* 64 characters and a nul */
 } alarm_t;
 
 pthread_mutex_t alarm_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t alarm_cond = PTHREAD_COND_INITIALIZER;
-alarm_t *alarm_list = NULL;
+pthread_cond_t alarm_cond;      /* times out on CLOCK_MONOTONIC */
+timer_queue_t alarm_queue;
 time_t current_alarm = 0;
 
 /*
- * Insert alarm entry on list, in order.
+ * Insert alarm entry on the queue.
  */
 void alarm_insert (alarm_t *alarm)
 {
     int status;
-    alarm_t **last, *next;
 
     /*
      * LOCKING PROTOCOL:
@@ -47,56 +65,59 @@ void alarm_insert (alarm_t *alarm)
      * This routine requires that the caller have locked the
      * alarm_mutex!
      */
-    last = &alarm_list;
-    next = *last;
-    while (next != NULL) {
-        if (next->time >= alarm->time) {
-            alarm->link = next;
-            *last = alarm;
-            break;
+    timer_queue_insert (&alarm_queue, &alarm->timer);
+#ifdef DEBUG
+    {
+        timer_node_t *node;
+        alarm_t *next;
+
+        printf ("[queue: ");
+        for (node = timer_queue_first (&alarm_queue); node != NULL;
+            node = timer_queue_iter_next (&alarm_queue, node)) {
+            next = timer_entry (node, alarm_t, timer);
+            printf ("%ld(%ld)[\"%s\"] ", next->timer.time,
+                next->timer.time - tick_clock_now (), next->message);
         }
-        last = &next->link;
-        next = next->link;
+        printf ("]\n");
     }
-    /*
-     * If we reached the end of the list, insert the new alarm
-     * there.  ("next" is NULL, and "last" points to the link
-     * field of the last item, or to the list header.)
-     */
-    if (next == NULL) {
-        *last = alarm;
-        alarm->link = NULL;
-    }
-#ifdef DEBUG
-    printf ("[list: ");
-    for (next = alarm_list; next != NULL; next = next->link)
-        printf ("%d(%d)[\"%s\"] ", next->time,
-            next->time - time (NULL), next->message);
-    printf ("]\n");
 #endif
     /*
      * Wake the alarm thread if it is not busy (that is, if
      * current_alarm is 0, signifying that it's waiting for
-     * work), or if the new alarm comes before the one on
+     * work), or if the new alarm comes before the time for
      * which the alarm thread is waiting.
      */
-    if (current_alarm == 0 || alarm->time < current_alarm) {
-        current_alarm = alarm->time;
+    if (current_alarm == 0 || alarm->timer.time < current_alarm) {
+        current_alarm = alarm->timer.time;
         status = pthread_cond_signal (&alarm_cond);
         if (status != 0)
             err_abort (status, "Signal cond");
     }
 }
 
+/*
+ * Print and free every alarm that is due at "now". The caller
+ * must have locked alarm_mutex, unless it is the event loop.
+ */
+void alarm_expire (time_t now)
+{
+    alarm_t *alarm;
+    timer_node_t *node;
+
+    while ((node = timer_queue_pop_expired (&alarm_queue, now)) != NULL) {
+        alarm = timer_entry (node, alarm_t, timer);
+        printf ("(%g) %s\n", alarm->seconds, alarm->message);
+        free (alarm);
+    }
+}
+
 /*
  * The alarm thread's start routine.
  */
 void *alarm_thread (void *arg)
 {
-    alarm_t *alarm;
-    struct timespec cond_time;
-    time_t now;
-    int status, expired;
+    time_t deadline;
+    int status;
 
     /*
      * Loop forever, processing commands. The alarm thread will
@@ -109,46 +130,186 @@ void *alarm_thread (void *arg)
         err_abort (status, "Lock mutex");
     while (1) {
         /*
-         * If the alarm list is empty, wait until an alarm is
+         * If the alarm queue is empty, wait until an alarm is
          * added. Setting current_alarm to 0 informs the insert
          * routine that the thread is not busy.
          */
         current_alarm = 0;
-        while (alarm_list == NULL) {
+        while (timer_queue_count (&alarm_queue) == 0) {
             status = pthread_cond_wait (&alarm_cond, &alarm_mutex);
             if (status != 0)
                 err_abort (status, "Wait on cond");
             }
-        alarm = alarm_list;
-        alarm_list = alarm->link;
-        now = time (NULL);
-        expired = 0;
-        if (alarm->time > now) {
+        alarm_expire (tick_clock_now ());
+        if (timer_queue_count (&alarm_queue) == 0)
+            continue;
+
+        /*
+         * Wait until the queue next has work to do, leaving the
+         * alarms queued. If an earlier alarm is inserted
+         * meanwhile, alarm_insert changes current_alarm and
+         * signals, and we go round again; there is nothing to
+         * requeue.
+         */
+        current_alarm = timer_queue_next (&alarm_queue);
 #ifdef DEBUG
-            printf ("[waiting: %d(%d)\"%s\"]\n", alarm->time,
-                alarm->time - time (NULL), alarm->message);
+        printf ("[waiting: %ld(%ld)]\n", current_alarm,
+            current_alarm - tick_clock_now ());
 #endif
-            cond_time.tv_sec = alarm->time;
-            cond_time.tv_nsec = 0;
-            current_alarm = alarm->time;
-            while (current_alarm == alarm->time) {
-                status = pthread_cond_timedwait (
-                    &alarm_cond, &alarm_mutex, &cond_time);
-                if (status == ETIMEDOUT) {
-                    expired = 1;
+        deadline = current_alarm;
+        while (current_alarm == deadline) {
+            status = tick_clock_timedwait (
+                &alarm_cond, &alarm_mutex, deadline);
+            if (status == ETIMEDOUT)
+                break;
+            if (status != 0)
+                err_abort (status, "Cond timedwait");
+        }
+    }
+}
+
+/*
+ * Parse a command line into a new alarm, timed from now. Returns
+ * NULL if the line is not a valid command. The deadline is kept
+ * in ticks, and waited for in nanoseconds, so seconds that are
+ * not a number (NaN or infinity), or that are too many for the
+ * deadline to be waited for, make the command invalid.
+ */
+alarm_t *alarm_parse (const char *line)
+{
+    alarm_t *alarm;
+    time_t deadline;
+
+    alarm = (alarm_t*)malloc (sizeof (alarm_t));
+    if (alarm == NULL)
+        errno_abort ("Allocate alarm");
+
+    /*
+     * Parse input line into seconds (%lf, which may have a
+     * fraction) and a message (%64[^\n]), consisting of up to
+     * 64 characters separated from the seconds by whitespace.
+     */
+    if (sscanf (line, "%lf %64[^\n]", 
+        &alarm->seconds, alarm->message) < 2
+        || tick_clock_after (alarm->seconds, &deadline) != 0) {
+        fprintf (stderr, "Bad command\n");
+        free (alarm);
+        return NULL;
+    }
+    timer_node_init (&alarm->timer, deadline);
+    return alarm;
+}
+
+/*
+ * Arm the timerfd for "deadline" (in ticks), or disarm it if the
+ * deadline is 0. A deadline that has passed fires at once.
+ */
+static void alarm_event_arm (int timer_fd, time_t deadline)
+{
+    struct itimerspec timer;
+
+    memset (&timer, 0, sizeof (timer));
+    if (deadline != 0
+        && tick_clock_monotonic (deadline, &timer.it_value) != 0)
+        timer.it_value.tv_nsec = 1;     /* 0 would disarm it */
+    if (timerfd_settime (timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) != 0)
+        errno_abort ("Arm timer");
+}
+
+/*
+ * The event loop run by "-e". One thread waits in epoll_wait for
+ * either a command on standard input or the timerfd, which is
+ * kept armed for the earliest alarm in the queue. Since nothing
+ * else touches the queue, the loop takes no lock.
+ */
+void alarm_event_loop (void)
+{
+    struct epoll_event event, events[2];
+    char input[256], *line, *newline;
+    size_t length = 0;
+    ssize_t count;
+    time_t armed = 0;
+    uint64_t expirations;
+    alarm_t *alarm;
+    int poll_fd, timer_fd, ready, i;
+
+    poll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (poll_fd < 0)
+        errno_abort ("Create epoll");
+    timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0)
+        errno_abort ("Create timerfd");
+    event.events = EPOLLIN;
+    event.data.fd = timer_fd;
+    if (epoll_ctl (poll_fd, EPOLL_CTL_ADD, timer_fd, &event) != 0)
+        errno_abort ("Watch timerfd");
+    event.data.fd = STDIN_FILENO;
+    if (epoll_ctl (poll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) != 0)
+        errno_abort ("Watch standard input (it must be a terminal or pipe)");
+
+    printf ("Alarm> ");
+    fflush (stdout);
+    while (1) {
+        ready = epoll_wait (poll_fd, events, 2, -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            errno_abort ("Wait for events");
+        }
+        for (i = 0; i < ready; i++) {
+            if (events[i].data.fd == timer_fd) {
+                /*
+                 * Just reset the timerfd; the queue says what is due.
+                 */
+                if (read (timer_fd, &expirations, sizeof (expirations)) < 0
+                    && errno != EAGAIN)
+                    errno_abort ("Read timerfd");
+                armed = 0;
+                continue;
+            }
+            count = read (STDIN_FILENO, input + length,
+                sizeof (input) - 1 - length);
+            if (count < 0) {
+                if (errno == EINTR || errno == EAGAIN)
+                    continue;
+                errno_abort ("Read standard input");
+            }
+            if (count == 0)
+                exit (0);
+            length += count;
+            input[length] = '\0';
+
+            /*
+             * Handle each complete line. A line too long for the
+             * buffer is taken as it is.
+             */
+            line = input;
+            while ((newline = strchr (line, '\n')) != NULL
+                || (line == input && length == sizeof (input) - 1)) {
+                if (newline != NULL)
+                    *newline = '\0';
+                if (strlen (line) > 0) {
+                    alarm = alarm_parse (line);
+                    if (alarm != NULL)
+                        alarm_insert (alarm);
+                }
+                printf ("Alarm> ");
+                if (newline == NULL) {
+                    line = input + length;
                     break;
                 }
-                if (status != 0)
-                    err_abort (status, "Cond timedwait");
+                line = newline + 1;
             }
-            if (!expired)
-                alarm_insert (alarm);
-        } else
-            expired = 1;
-        if (expired) {
-            printf ("(%d) %s\n", alarm->seconds, alarm->message);
-            free (alarm);
+            length -= line - input;
+            memmove (input, line, length);
+        }
+
+        alarm_expire (tick_clock_now ());
+        if (timer_queue_next (&alarm_queue) != armed) {
+            armed = timer_queue_next (&alarm_queue);
+            alarm_event_arm (timer_fd, armed);
         }
+        fflush (stdout);
     }
 }
 
@@ -158,6 +319,30 @@ int main (int argc, char *argv[])
     char line[128];
     alarm_t *alarm;
     pthread_t thread;
+    timer_queue_kind_t kind = TIMER_QUEUE_HEAP;
+    int ticks_per_second = TICK_CLOCK_SECONDS;
+    int event_loop = 0;
+    int option;
+
+    while ((option = getopt (argc, argv, "q:me")) != -1) {
+        if (option == 'm')
+            ticks_per_second = TICK_CLOCK_MILLISECONDS;
+        else if (option == 'e')
+            event_loop = 1;
+        else if (option != 'q' || timer_queue_kind_parse (optarg, &kind) != 0) {
+            fprintf (stderr, "Usage: %s [-q heap|wheel] [-m] [-e]\n", argv[0]);
+            exit (1);
+        }
+    }
+    status = tick_clock_init (ticks_per_second);
+    if (status != 0)
+        err_abort (status, "Set tick clock");
+    status = tick_clock_cond_init (&alarm_cond);
+    if (status != 0)
+        err_abort (status, "Init cond");
+    timer_queue_init (&alarm_queue, kind, tick_clock_now ());
+    if (event_loop)
+        alarm_event_loop ();
 
     status = pthread_create (
         &thread, NULL, alarm_thread, NULL);
@@ -167,27 +352,14 @@ int main (int argc, char *argv[])
         printf ("Alarm> ");
         if (fgets (line, sizeof (line), stdin) == NULL) exit (0);
         if (strlen (line) <= 1) continue;
-        alarm = (alarm_t*)malloc (sizeof (alarm_t));
-        if (alarm == NULL)
-            errno_abort ("Allocate alarm");
-
-        /*
-         * Parse input line into seconds (%d) and a message
-         * (%64[^\n]), consisting of up to 64 characters
-         * separated from the seconds by whitespace.
-         */
-        if (sscanf (line, "%d %64[^\n]", 
-            &alarm->seconds, alarm->message) < 2) {
-            fprintf (stderr, "Bad command\n");
-            free (alarm);
-        } else {
+        alarm = alarm_parse (line);
+        if (alarm != NULL) {
             status = pthread_mutex_lock (&alarm_mutex);
             if (status != 0)
                 err_abort (status, "Lock mutex");
-            alarm->time = time (NULL) + alarm->seconds;
             /*
-             * Insert the new alarm into the list of alarms,
-             * sorted by expiration time.
+             * Insert the new alarm into the queue of alarms,
+             * ordered by expiration time.
              */
             alarm_insert (alarm);
             status = pthread_mutex_unlock (&alarm_mutex);
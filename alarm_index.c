@@ -0,0 +1,129 @@
+/*
+ * alarm_index.c
+ *
+ * Open-addressing hash index of alarms by id. See alarm_index.h.
+ */
+#include "alarm_index.h"
+#include "errors.h"
+
+#define ALARM_INDEX_MIN_SIZE 64
+
+/*
+ * Home slot of an id. The ids are small integers chosen by the
+ * user, often consecutive, so mix the bits before masking.
+ */
+static int alarm_index_slot (alarm_index_t *index, int id)
+{
+    unsigned int hash = (unsigned int)id;
+
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bU;
+    hash ^= hash >> 16;
+    return (int)(hash & (unsigned int)(index->size - 1));
+}
+
+/*
+ * Find the slot holding "id", or the free slot that ends its
+ * probe run.
+ */
+static int alarm_index_probe (alarm_index_t *index, int id)
+{
+    int slot = alarm_index_slot (index, id);
+
+    while (index->entries[slot].alarm != NULL
+        && index->entries[slot].id != id)
+        slot = (slot + 1) & (index->size - 1);
+    return slot;
+}
+
+/*
+ * Double the table (or allocate the first one), and re-insert
+ * every entry.
+ */
+static void alarm_index_grow (alarm_index_t *index)
+{
+    alarm_index_entry_t *old = index->entries;
+    int old_size = index->size;
+    int slot;
+
+    index->size = old_size == 0 ? ALARM_INDEX_MIN_SIZE : old_size * 2;
+    index->entries = (alarm_index_entry_t*)calloc (
+        index->size, sizeof (alarm_index_entry_t));
+    if (index->entries == NULL)
+        errno_abort ("Grow alarm index");
+    for (slot = 0; slot < old_size; slot++)
+        if (old[slot].alarm != NULL)
+            index->entries[alarm_index_probe (index, old[slot].id)]
+                = old[slot];
+    free (old);
+}
+
+void alarm_index_destroy (alarm_index_t *index)
+{
+    free (index->entries);
+    index->entries = NULL;
+    index->count = index->size = 0;
+}
+
+/*
+ * Add an alarm under "id". Returns 0 on success,
+ * or -1 if an alarm with that id is already indexed.
+ */
+int alarm_index_insert (alarm_index_t *index, int id, void *alarm)
+{
+    alarm_index_entry_t *entry;
+
+    if ((index->count + 1) * 2 > index->size)
+        alarm_index_grow (index);
+    entry = &index->entries[alarm_index_probe (index, id)];
+    if (entry->alarm != NULL)
+        return -1;
+    entry->alarm = alarm;
+    entry->id = id;
+    index->count++;
+    return 0;
+}
+
+/*
+ * Return the entry for "id", or NULL if there is none. The entry
+ * may move when the index is next modified.
+ */
+alarm_index_entry_t *alarm_index_find (alarm_index_t *index, int id)
+{
+    alarm_index_entry_t *entry;
+
+    if (index->count == 0)
+        return NULL;
+    entry = &index->entries[alarm_index_probe (index, id)];
+    return entry->alarm == NULL ? NULL : entry;
+}
+
+/*
+ * Remove the entry for "id", if any. Entries later in the same
+ * probe run are shifted back into the hole, unless that would
+ * move one before its home slot.
+ */
+void alarm_index_remove (alarm_index_t *index, int id)
+{
+    int mask = index->size - 1;
+    int hole, slot, home;
+
+    if (index->count == 0)
+        return;
+    hole = alarm_index_probe (index, id);
+    if (index->entries[hole].alarm == NULL)
+        return;
+    index->count--;
+    slot = hole;
+    while (1) {
+        slot = (slot + 1) & mask;
+        if (index->entries[slot].alarm == NULL)
+            break;
+        home = alarm_index_slot (index, index->entries[slot].id);
+        if (((slot - home) & mask) < ((slot - hole) & mask))
+            continue;
+        index->entries[hole] = index->entries[slot];
+        hole = slot;
+    }
+    index->entries[hole].alarm = NULL;
+}
@@ -0,0 +1,37 @@
+/*
+ * alarm_index.h
+ *
+ * A hash index from alarm id to the live alarm with that id, so
+ * that commands naming an alarm (Change_Alarm, Cancel_Alarm, ...)
+ * find it in constant time instead of searching the timer queue
+ * and every display thread.
+ *
+ * The index uses open addressing with linear probing, in a table
+ * that is kept no more than half full. Removal shifts later
+ * entries of the same probe run back, so there are no tombstones
+ * and lookups never slow down as alarms come and go.
+ *
+ * Like the timer queues, the index does no locking of its own.
+ */
+#ifndef __alarm_index_h
+#define __alarm_index_h
+
+typedef struct alarm_index_entry_tag {
+    void                *alarm; /* NULL if the slot is free */
+    int                 id;
+} alarm_index_entry_t;
+
+typedef struct alarm_index_tag {
+    alarm_index_entry_t *entries;
+    int                 count;
+    int                 size;   /* slots in entries, a power of 2 */
+} alarm_index_t;
+
+#define ALARM_INDEX_INITIALIZER {NULL, 0, 0}
+
+extern void alarm_index_destroy (alarm_index_t *index);
+extern int alarm_index_insert (alarm_index_t *index, int id, void *alarm);
+extern alarm_index_entry_t *alarm_index_find (alarm_index_t *index, int id);
+extern void alarm_index_remove (alarm_index_t *index, int id);
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * alarm_load.c
+ *
+ * Print a workload of New_Alarm_cond.c commands (see workload.h),
+ * to be loaded with "--load file" or piped to the program.
+ *
+ * Usage: alarm_load [-n count] [-x mix] [-g groups] [-s seconds]
+ *                   [-i interval] [-f first_id] [-r seed]
+ *
+ * "mix" gives the weight of each kind of command, such as
+ * "start=60,change=15,cancel=10,suspend=5,reactivate=5,view=5"
+ * (the default); kinds not named are not made.
+ */
+#include <stdint.h>
+#include "workload.h"
+#include "errors.h"
+
+int main (int argc, char *argv[])
+{
+    workload_t workload;
+    char line[128];
+    long count = 1000, i;
+    int first_id = 1, option, status, alarm_id;
+    uint64_t seed = 1;
+    char *mix = NULL, *end;
+    double seconds = 1000, interval = 100;
+    int groups = 10;
+
+    while ((option = getopt (argc, argv, "n:x:g:s:i:f:r:")) != -1) {
+        switch (option) {
+            case 'n':
+                count = strtol (optarg, &end, 10);
+                break;
+            case 'x':
+                mix = optarg;
+                end = "";
+                break;
+            case 'g':
+                groups = (int)strtol (optarg, &end, 10);
+                break;
+            case 's':
+                seconds = strtod (optarg, &end);
+                break;
+            case 'i':
+                interval = strtod (optarg, &end);
+                break;
+            case 'f':
+                first_id = (int)strtol (optarg, &end, 10);
+                break;
+            case 'r':
+                seed = strtoull (optarg, &end, 10);
+                break;
+            default:
+                end = "?";
+                break;
+        }
+        if (*end != '\0' || count < 0 || groups < 1 || seconds < 0
+            || interval < 0 || first_id < 0) {
+            fprintf (stderr, "Usage: %s [-n count] [-x mix] [-g groups] "
+                "[-s seconds] [-i interval] [-f first_id] [-r seed]\n",
+                argv[0]);
+            return 1;
+        }
+    }
+
+    status = workload_init (&workload, first_id, seed);
+    if (status != 0)
+        err_abort (status, "Init workload");
+    if (mix != NULL && workload_set_mix (&workload, mix) != 0) {
+        fprintf (stderr, "%s: bad mix \"%s\"\n", argv[0], mix);
+        return 1;
+    }
+    workload.groups = groups;
+    workload.seconds = seconds;
+    workload.interval = interval;
+    for (i = 0; i < count; i++) {
+        workload_next (&workload, line, sizeof (line), &alarm_id);
+        fputs (line, stdout);
+    }
+    workload_destroy (&workload);
+    if (fflush (stdout) != 0)
+        errno_abort ("Write workload");
+    return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * command.c
+ *
+ * Single-pass command parser. See command.h.
+ */
+#include <limits.h>
+#include <string.h>
+#include "command.h"
+
+/*
+ * What follows each keyword.
+ */
+#define COMMAND_NOTHING 0       /* View_Alarms, Stats */
+#define COMMAND_ID      1       /* (id) */
+#define COMMAND_FIELDS  2       /* (id): group seconds interval message */
+#define COMMAND_GROUP   3       /* (group) */
+
+static const struct {
+    const char          *name;
+    int                 length;
+    command_kind_t      kind;
+    int                 form;
+} command_keywords[] = {
+    {"Start_Alarm", 11, COMMAND_START_ALARM, COMMAND_FIELDS},
+    {"Change_Alarm", 12, COMMAND_CHANGE_ALARM, COMMAND_FIELDS},
+    {"Cancel_Alarm", 12, COMMAND_CANCEL_ALARM, COMMAND_ID},
+    {"Suspend_Alarm", 13, COMMAND_SUSPEND_ALARM, COMMAND_ID},
+    {"Reactivate_Alarm", 16, COMMAND_REACTIVATE_ALARM, COMMAND_ID},
+    {"View_Alarms", 11, COMMAND_VIEW_ALARMS, COMMAND_NOTHING},
+    {"Cancel_Group", 12, COMMAND_CANCEL_GROUP, COMMAND_GROUP},
+    {"Suspend_Group", 13, COMMAND_SUSPEND_GROUP, COMMAND_GROUP},
+    {"Reactivate_Group", 16, COMMAND_REACTIVATE_GROUP, COMMAND_GROUP},
+    {"View_Group", 10, COMMAND_VIEW_GROUP, COMMAND_GROUP},
+    {"Stats", 5, COMMAND_STATS, COMMAND_NOTHING}
+};
+
+#define COMMAND_KEYWORDS \
+    (int)(sizeof (command_keywords) / sizeof (command_keywords[0]))
+
+/*
+ * Blanks that may separate the parts of a command. These are
+ * tested directly, since isspace() depends on the locale.
+ */
+static int command_is_space (char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static const char *command_skip_space (const char *next)
+{
+    while (command_is_space (*next))
+        next++;
+    return next;
+}
+
+/*
+ * Record why, and where, the line failed to parse. Returns -1.
+ */
+static int command_fail (
+    command_error_t *error, const char *line, const char *at,
+    const char *reason)
+{
+    error->reason = reason;
+    error->column = (int)(at - line) + 1;
+    return -1;
+}
+
+/*
+ * Convert a decimal integer, with an optional sign, at *next, and
+ * advance *next past it. Returns 0, -1 if there is no number, or
+ * 1 if it does not fit in an int (*next is left at the number).
+ */
+static int command_integer (const char **next, int *value)
+{
+    const char *digit = *next;
+    long long result = 0;
+    int negative = 0;
+
+    if (*digit == '-' || *digit == '+')
+        negative = *digit++ == '-';
+    if (*digit < '0' || *digit > '9')
+        return -1;
+    do {
+        result = result * 10 + (*digit++ - '0');
+        if (result > (long long)INT_MAX + 1)
+            return 1;
+    } while (*digit >= '0' && *digit <= '9');
+    if (negative)
+        result = -result;
+    if (result > INT_MAX)
+        return 1;
+    *value = (int)result;
+    *next = digit;
+    return 0;
+}
+
+/*
+ * Convert a decimal number, with an optional sign and fraction
+ * ("2", "0.25", "-1.5", ".5"), at *next, and advance *next past
+ * it. The digits are gathered into one integer and divided by the
+ * power of ten the fraction implies, which is exact for any
+ * number of up to 15 digits. Returns 0, or -1 if there is no
+ * number.
+ */
+static int command_decimal (const char **next, double *value)
+{
+    const char *digit = *next;
+    double mantissa = 0.0, divisor = 1.0;
+    int negative = 0, digits = 0;
+
+    if (*digit == '-' || *digit == '+')
+        negative = *digit++ == '-';
+    for (; *digit >= '0' && *digit <= '9'; digit++, digits++)
+        mantissa = mantissa * 10.0 + (*digit - '0');
+    if (*digit == '.')
+        for (digit++; *digit >= '0' && *digit <= '9'; digit++, digits++) {
+            mantissa = mantissa * 10.0 + (*digit - '0');
+            divisor *= 10.0;
+        }
+    if (digits == 0)
+        return -1;
+    *value = negative ? -mantissa / divisor : mantissa / divisor;
+    *next = digit;
+    return 0;
+}
+
+/*
+ * Check that a field of Start_Alarm or Change_Alarm is followed by
+ * a blank and then more of the line. "missing" says what the next
+ * field is, if the line ends instead. Returns 0, or -1 with the
+ * error set.
+ */
+static int command_field_end (
+    const char *line, const char *next, command_error_t *error,
+    const char *unended, const char *missing)
+{
+    if (*command_skip_space (next) == '\0')
+        return command_fail (
+            error, line, command_skip_space (next), missing);
+    if (!command_is_space (*next))
+        return command_fail (error, line, next, unended);
+    return 0;
+}
+
+/*
+ * Parse a command line, which must not include the newline. On
+ * success, fill in "command" and return 0. Otherwise return -1,
+ * with "error" saying what was expected where.
+ */
+int command_parse (
+    const char *line, command_t *command, command_error_t *error)
+{
+    const char *next = command_skip_space (line);
+    const char *word = next;
+    int keyword, status;
+
+    while ((*next >= 'A' && *next <= 'Z') || (*next >= 'a' && *next <= 'z')
+        || *next == '_')
+        next++;
+    for (keyword = 0; keyword < COMMAND_KEYWORDS; keyword++)
+        if (command_keywords[keyword].length == next - word
+            && memcmp (command_keywords[keyword].name, word, next - word) == 0)
+            break;
+    if (keyword == COMMAND_KEYWORDS)
+        return command_fail (error, line, word, "unknown command");
+    command->kind = command_keywords[keyword].kind;
+
+    if (command_keywords[keyword].form != COMMAND_NOTHING) {
+        next = command_skip_space (next);
+        if (*next != '(')
+            return command_fail (error, line, next, "expected '('");
+        next = command_skip_space (next + 1);
+        if (command_keywords[keyword].form == COMMAND_GROUP) {
+            status = command_integer (&next, &command->group_id);
+            if (status < 0)
+                return command_fail (error, line, next, "expected group");
+            if (status > 0)
+                return command_fail (error, line, next, "group out of range");
+        } else {
+            status = command_integer (&next, &command->alarm_id);
+            if (status < 0)
+                return command_fail (error, line, next, "expected alarm id");
+            if (status > 0)
+                return command_fail (
+                    error, line, next, "alarm id out of range");
+        }
+        next = command_skip_space (next);
+        if (*next != ')')
+            return command_fail (error, line, next, "expected ')'");
+        next++;
+    }
+
+    if (command_keywords[keyword].form != COMMAND_FIELDS) {
+        next = command_skip_space (next);
+        if (*next != '\0')
+            return command_fail (
+                error, line, next, "unexpected text after command");
+        return 0;
+    }
+
+    next = command_skip_space (next);
+    if (*next != ':')
+        return command_fail (error, line, next, "expected ':'");
+    next = command_skip_space (next + 1);
+    status = command_integer (&next, &command->group_id);
+    if (status < 0)
+        return command_fail (error, line, next, "expected group");
+    if (status > 0)
+        return command_fail (error, line, next, "group out of range");
+    if (command_field_end (line, next, error,
+            "expected blank after group", "expected seconds") != 0)
+        return -1;
+    next = command_skip_space (next);
+    if (command_decimal (&next, &command->seconds) != 0)
+        return command_fail (error, line, next, "expected seconds");
+    if (command_field_end (line, next, error,
+            "expected blank after seconds", "expected interval") != 0)
+        return -1;
+    next = command_skip_space (next);
+    if (command_decimal (&next, &command->interval) != 0)
+        return command_fail (error, line, next, "expected interval");
+    if (command_field_end (line, next, error,
+            "expected blank after interval", "expected message") != 0)
+        return -1;
+    command->message = command_skip_space (next);
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * command.h
+ *
+ * Parser for the commands of New_Alarm_cond.c:
+ *
+ *      Start_Alarm(id): group seconds interval message
+ *      Change_Alarm(id): group seconds interval message
+ *      Cancel_Alarm(id)
+ *      Suspend_Alarm(id)
+ *      Reactivate_Alarm(id)
+ *      View_Alarms
+ *      Cancel_Group(group)
+ *      Suspend_Group(group)
+ *      Reactivate_Group(group)
+ *      View_Group(group)
+ *      Stats
+ *
+ * The parser makes one pass over the line, recognizing the
+ * keyword and converting the numbers as it goes, and it neither
+ * copies nor allocates: the message is returned as a pointer into
+ * the line. It replaces sscanf(), which interprets its format and
+ * consults the locale on every call. Seconds and intervals are
+ * decimal numbers that may have a fraction; ids and groups are
+ * integers. When a line does not parse, the parser reports what
+ * it expected and the column at which it failed.
+ *
+ * The parser does not depend on the rest of the program, so any
+ * thread may use it.
+ */
+#ifndef __command_h
+#define __command_h
+
+typedef enum command_kind_tag {
+    COMMAND_START_ALARM,
+    COMMAND_CHANGE_ALARM,
+    COMMAND_CANCEL_ALARM,
+    COMMAND_SUSPEND_ALARM,
+    COMMAND_REACTIVATE_ALARM,
+    COMMAND_VIEW_ALARMS,
+    COMMAND_CANCEL_GROUP,
+    COMMAND_SUSPEND_GROUP,
+    COMMAND_REACTIVATE_GROUP,
+    COMMAND_VIEW_GROUP,
+    COMMAND_STATS
+} command_kind_t;
+
+typedef struct command_tag {
+    command_kind_t      kind;
+    int                 alarm_id;       /* not for group commands */
+    int                 group_id;       /* Start, Change and group commands */
+    double              seconds;        /* Start and Change only */
+    double              interval;       /* Start and Change only */
+    const char          *message;       /* Start and Change only; points
+                                           into the line, up to its end */
+} command_t;
+
+typedef struct command_error_tag {
+    const char          *reason;        /* such as "expected group" */
+    int                 column;         /* from 1 */
+} command_error_t;
+
+extern int command_parse (
+    const char *line, command_t *command, command_error_t *error);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * epoch.c
+ *
+ * Epoch-based reclamation. See epoch.h.
+ */
+#include <stddef.h>
+#include "epoch.h"
+
+/*
+ * Initialize an epoch. It starts at 1, since a reader's 0 means
+ * "outside".
+ */
+void epoch_init (epoch_t *epoch)
+{
+    int i;
+
+    atomic_init (&epoch->global, 1);
+    for (i = 0; i < EPOCH_READERS; i++)
+        atomic_init (&epoch->readers[i], 0);
+    atomic_init (&epoch->reader_count, 0);
+    for (i = 0; i < 3; i++)
+        epoch->retired[i] = NULL;
+    epoch->retired_count = 0;
+}
+
+/*
+ * Register a reader, returning its number for epoch_enter and
+ * epoch_exit, or -1 if there are EPOCH_READERS already.
+ */
+int epoch_register (epoch_t *epoch)
+{
+    int reader = atomic_fetch_add (&epoch->reader_count, 1);
+
+    if (reader >= EPOCH_READERS) {
+        atomic_fetch_sub (&epoch->reader_count, 1);
+        return -1;
+    }
+    return reader;
+}
+
+/*
+ * Begin a read-side section. Until epoch_exit, nothing that the
+ * reader can reach will be freed.
+ */
+void epoch_enter (epoch_t *epoch, int reader)
+{
+    atomic_store (&epoch->readers[reader], atomic_load (&epoch->global));
+}
+
+void epoch_exit (epoch_t *epoch, int reader)
+{
+    atomic_store_explicit (&epoch->readers[reader], 0, memory_order_release);
+}
+
+/*
+ * Free the objects retired two epochs ago and advance the epoch,
+ * if every reader in a section has seen the current one.
+ */
+void epoch_reclaim (epoch_t *epoch)
+{
+    unsigned long global = atomic_load (&epoch->global), seen;
+    epoch_node_t *node, *next;
+    int reader, readers = atomic_load (&epoch->reader_count);
+
+    for (reader = 0; reader < readers && reader < EPOCH_READERS; reader++) {
+        seen = atomic_load (&epoch->readers[reader]);
+        if (seen != 0 && seen != global)
+            return;
+    }
+    for (node = epoch->retired[(global + 1) % 3]; node != NULL; node = next) {
+        next = node->next;
+        epoch->retired_count--;
+        node->free (node);
+    }
+    epoch->retired[(global + 1) % 3] = NULL;
+    atomic_store (&epoch->global, global + 1);
+}
+
+/*
+ * Retire an object that readers can no longer find, to be freed
+ * by "free" once none can still be using it.
+ */
+void epoch_retire (epoch_t *epoch, epoch_node_t *node, epoch_free_t free)
+{
+    unsigned long global = atomic_load (&epoch->global);
+
+    node->free = free;
+    node->next = epoch->retired[global % 3];
+    epoch->retired[global % 3] = node;
+    epoch->retired_count++;
+    epoch_reclaim (epoch);
+}
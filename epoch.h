@@ -0,0 +1,53 @@
+/*
+ * epoch.h
+ *
+ * Epoch-based reclamation, so that readers can walk a shared
+ * structure with no lock while writers change it. A writer that
+ * unlinks an object does not free it at once, but retires it; it
+ * is freed only when every reader that might still hold a pointer
+ * to it has finished.
+ *
+ * There is a global epoch. A reader announces the epoch it saw on
+ * entering a read-side section and withdraws on leaving. Objects
+ * are retired into one of three lists, by the epoch at the time.
+ * The epoch advances only when every reader inside a section has
+ * seen the current one, and when it advances from e to e+1 the
+ * objects retired in e-2 are freed: no reader can still be inside
+ * the section in which it could have found them.
+ *
+ * Readers take no lock and never wait. Writers must be serialized
+ * by the caller (in New_Alarm_cond.c, by view_mutex), since
+ * epoch_retire and epoch_reclaim share the retired lists.
+ */
+#ifndef __epoch_h
+#define __epoch_h
+
+#include <stdatomic.h>
+
+#define EPOCH_READERS   8       /* registered readers, at most */
+
+typedef struct epoch_node_tag epoch_node_t;
+typedef void (*epoch_free_t) (epoch_node_t *node);
+
+struct epoch_node_tag {
+    epoch_node_t        *next;
+    epoch_free_t        free;   /* frees the object holding the node */
+};
+
+typedef struct epoch_tag {
+    atomic_ulong        global;
+    atomic_ulong        readers[EPOCH_READERS]; /* epoch seen, 0 if outside */
+    atomic_int          reader_count;
+    epoch_node_t        *retired[3];
+    unsigned long       retired_count;
+} epoch_t;
+
+extern void epoch_init (epoch_t *epoch);
+extern int epoch_register (epoch_t *epoch);
+extern void epoch_enter (epoch_t *epoch, int reader);
+extern void epoch_exit (epoch_t *epoch, int reader);
+extern void epoch_retire (
+    epoch_t *epoch, epoch_node_t *node, epoch_free_t free);
+extern void epoch_reclaim (epoch_t *epoch);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * event_decode.c
+ *
+ * Render an event log written by New_Alarm_cond ("--events file")
+ * as text, in the format the program itself prints. A record does
+ * not hold the alarm's message or its times, so the lines end at
+ * the group. Times are converted back into the ticks the program
+ * used, with the clock offset saved in the log's header.
+ *
+ * Usage: event_decode file
+ */
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "event_log.h"
+#include "errors.h"
+
+/*
+ * Print one record.
+ */
+static void event_print (event_record_t *record, long ticks)
+{
+    int id = record->alarm_id, group = record->group_id;
+    unsigned long thread = (unsigned long)record->thread;
+
+    switch (atomic_load (&record->type)) {
+        case EVENT_INSERTED:
+            printf ("Start_Alarm(%d) Request Inserted Into Alarm List "
+                "at %ld: Group(%d)\n", id, ticks, group);
+            break;
+        case EVENT_ASSIGNED:
+            printf ("Alarm (%d) Assigned to Display Thread (%lu) "
+                "at %ld: Group(%d)\n", id, thread, ticks, group);
+            break;
+        case EVENT_PRINTED:
+            printf ("Alarm (%d) Printed by Alarm Display Thread %lu "
+                "at %ld: Group(%d)\n", id, thread, ticks, group);
+            break;
+        case EVENT_CHANGED:
+            printf ("Change Alarm Thread Has Changed Alarm(%d) "
+                "at %ld: Group(%d)\n", id, ticks, group);
+            break;
+        case EVENT_SUSPENDED:
+            printf ("Alarm(%d) Suspended at %ld: Group(%d)\n",
+                id, ticks, group);
+            break;
+        case EVENT_REACTIVATED:
+            printf ("Alarm(%d) Reactivated at %ld: Group(%d)\n",
+                id, ticks, group);
+            break;
+        case EVENT_CANCELLED:
+            printf ("Alarm(%d) Cancelled and Removed from Global List "
+                "at %ld: Group(%d)\n", id, ticks, group);
+            break;
+        case EVENT_EXPIRED:
+            printf ("Alarm(%d) Expired and Removed from Global List "
+                "at %ld: Group(%d)\n", id, ticks, group);
+            break;
+        default:
+            printf ("Unknown event %" PRIu32 " for Alarm(%d) at %ld\n",
+                atomic_load (&record->type), id, ticks);
+            break;
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    event_log_header_t *header;
+    event_record_t *records;
+    struct stat info;
+    uint64_t count, i, stored, unfinished = 0;
+    long long tick_ns;
+    int fd;
+
+    if (argc != 2) {
+        fprintf (stderr, "Usage: %s file\n", argv[0]);
+        return 1;
+    }
+    fd = open (argv[1], O_RDONLY);
+    if (fd < 0 || fstat (fd, &info) != 0)
+        errno_abort (argv[1]);
+    if ((size_t)info.st_size < sizeof (event_log_header_t)) {
+        fprintf (stderr, "%s: not an event log\n", argv[1]);
+        return 1;
+    }
+    header = (event_log_header_t*)mmap (
+        NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+        errno_abort ("Map event log");
+    if (memcmp (header->magic, EVENT_LOG_MAGIC, sizeof (header->magic)) != 0
+        || header->record_size != sizeof (event_record_t)
+        || header->ticks_per_second == 0) {
+        fprintf (stderr, "%s: not an event log\n", argv[1]);
+        return 1;
+    }
+
+    /*
+     * The program may still be running and logging; read only the
+     * records that fit in the file.
+     */
+    count = atomic_load (&header->count);
+    stored = count < header->capacity ? count : header->capacity;
+    if (stored > (info.st_size - sizeof (event_log_header_t))
+            / sizeof (event_record_t))
+        stored = (info.st_size - sizeof (event_log_header_t))
+            / sizeof (event_record_t);
+    records = (event_record_t*)(header + 1);
+    tick_ns = 1000000000LL / header->ticks_per_second;
+    for (i = 0; i < stored; i++) {
+        if (atomic_load (&records[i].type) == EVENT_NONE) {
+            unfinished++;
+            continue;
+        }
+        event_print (&records[i],
+            (long)(((long long)records[i].time + header->tick_offset)
+                / tick_ns));
+    }
+    if (unfinished > 0)
+        fprintf (stderr, "%" PRIu64 " events were still being written\n",
+            unfinished);
+    if (count > stored)
+        fprintf (stderr, "%" PRIu64 " events did not fit in the log\n",
+            count - stored);
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * event_log.c
+ *
+ * Memory-mapped binary event log. See event_log.h.
+ */
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "event_log.h"
+#include "tick_clock.h"
+#include "errors.h"
+
+static event_log_header_t *event_log_header;    /* NULL if not logging */
+static event_record_t *event_log_records;
+static size_t event_log_size;
+
+/*
+ * Create (or replace) the log file "path", with room for
+ * "capacity" records, and start logging to it. Call after
+ * tick_clock_init. Returns 0, or an error number.
+ */
+int event_log_open (const char *path, uint64_t capacity)
+{
+    event_log_header_t *header;
+    int fd, status;
+
+    if (capacity == 0)
+        return EINVAL;
+    fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return errno;
+    event_log_size = sizeof (event_log_header_t)
+        + capacity * sizeof (event_record_t);
+    if (ftruncate (fd, (off_t)event_log_size) != 0) {
+        status = errno;
+        close (fd);
+        return status;
+    }
+    header = (event_log_header_t*)mmap (
+        NULL, event_log_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        status = errno;
+        close (fd);
+        return status;
+    }
+    memcpy (header->magic, EVENT_LOG_MAGIC, sizeof (header->magic));
+    header->record_size = sizeof (event_record_t);
+    header->ticks_per_second = (uint32_t)tick_clock_ticks (1.0);
+    header->tick_offset = tick_clock_offset ();
+    header->capacity = capacity;
+    atomic_init (&header->count, 0);
+    close (fd);
+    event_log_records = (event_record_t*)(header + 1);
+    event_log_header = header;
+    return 0;
+}
+
+/*
+ * Log an event, if the log is open. Any thread may call this.
+ */
+void event_log_write (
+    event_type_t type, int alarm_id, int group_id, pthread_t thread)
+{
+    event_record_t *record;
+    struct timespec now;
+    uint64_t index;
+
+    if (event_log_header == NULL)
+        return;
+    index = atomic_fetch_add_explicit (
+        &event_log_header->count, 1, memory_order_relaxed);
+    if (index >= event_log_header->capacity)
+        return;
+    if (clock_gettime (CLOCK_MONOTONIC, &now) != 0)
+        errno_abort ("Get time");
+    record = &event_log_records[index];
+    record->time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    record->thread = (uint64_t)thread;
+    record->alarm_id = alarm_id;
+    record->group_id = group_id;
+    atomic_store_explicit (&record->type, type, memory_order_release);
+}
+
+/*
+ * Write the log out to the file. The mapping stays in place, since
+ * other threads may still be logging; events they log afterward
+ * reach the file when the process exits.
+ */
+void event_log_sync (void)
+{
+    if (event_log_header == NULL)
+        return;
+    if (msync (event_log_header, event_log_size, MS_SYNC) != 0)
+        errno_abort ("Sync event log");
+}
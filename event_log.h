@@ -0,0 +1,69 @@
+/*
+ * event_log.h
+ *
+ * A binary log of alarm lifecycle events, for tools that would
+ * otherwise have to parse the program's text output. Each event is
+ * one fixed-size record (what happened, to which alarm and group,
+ * in which thread, and when, in nanoseconds of CLOCK_MONOTONIC),
+ * appended to a file mapped into memory: logging an event is an
+ * atomic increment to claim a record and a few stores, with no
+ * system call and no lock.
+ *
+ * The file starts with a header that gives the record size and
+ * count, and what is needed to turn the timestamps back into the
+ * ticks the program prints. The file is sized for a fixed number
+ * of records when it is opened, but it is sparse, so only the
+ * records written take space on disk; events past that number are
+ * counted but not stored. A record's type is stored last, so a
+ * reader can tell a record still being written (EVENT_NONE).
+ *
+ * event_decode.c renders a log as text, in the program's format.
+ */
+#ifndef __event_log_h
+#define __event_log_h
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define EVENT_LOG_MAGIC         "ALARMEV1"
+#define EVENT_LOG_RECORDS       (4 * 1024 * 1024)       /* default capacity */
+
+typedef enum event_type_tag {
+    EVENT_NONE,                 /* record not (yet) written */
+    EVENT_INSERTED,
+    EVENT_ASSIGNED,             /* thread is the display thread */
+    EVENT_PRINTED,
+    EVENT_CHANGED,
+    EVENT_SUSPENDED,
+    EVENT_REACTIVATED,
+    EVENT_CANCELLED,
+    EVENT_EXPIRED,
+    EVENT_TYPES
+} event_type_t;
+
+typedef struct event_record_tag {
+    uint64_t            time;           /* CLOCK_MONOTONIC, ns */
+    uint64_t            thread;
+    int32_t             alarm_id;
+    int32_t             group_id;
+    _Atomic uint32_t    type;           /* stored last */
+    uint32_t            reserved;
+} event_record_t;
+
+typedef struct event_log_header_tag {
+    char                magic[8];
+    uint32_t            record_size;
+    uint32_t            ticks_per_second;
+    int64_t             tick_offset;    /* tick clock - CLOCK_MONOTONIC, ns */
+    uint64_t            capacity;       /* records the file has room for */
+    _Atomic uint64_t    count;          /* events logged, stored or not */
+    char                pad[24];
+} event_log_header_t;
+
+extern int event_log_open (const char *path, uint64_t capacity);
+extern void event_log_write (
+    event_type_t type, int alarm_id, int group_id, pthread_t thread);
+extern void event_log_sync (void);
+
+#endif
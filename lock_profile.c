@@ -0,0 +1,268 @@
+/*
+ * lock_profile.c
+ *
+ * Contention profile of mutexes. See lock_profile.h. Everything
+ * here is compiled only with -DLOCK_PROFILE.
+ */
+#include "lock_profile.h"
+
+#ifdef LOCK_PROFILE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "errors.h"
+
+static pthread_mutex_t lock_profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static profiled_mutex_t *lock_profile_mutexes; /* newest first */
+
+static unsigned long long lock_profile_now (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Add a time to a histogram.
+ */
+static void lock_profile_record (
+    unsigned long histogram[], unsigned long long *total,
+    unsigned long long *max, unsigned long long ns)
+{
+    int bucket = ns == 0 ? 0 : 64 - __builtin_clzll (ns);
+
+    if (bucket >= LOCK_PROFILE_BUCKETS)
+        bucket = LOCK_PROFILE_BUCKETS - 1;
+    histogram[bucket]++;
+    *total += ns;
+    if (ns > *max)
+        *max = ns;
+}
+
+/*
+ * Find the record of a site, or make one. The table is hashed by
+ * line; a site that finds it full shares the last slot with every
+ * other such site. The caller must hold the mutex.
+ */
+static lock_site_t *lock_profile_site (
+    profiled_mutex_t *mutex, const char *file, int line)
+{
+    int slot = (unsigned)line % (LOCK_PROFILE_SITES - 1);
+    int tries;
+    lock_site_t *site;
+
+    for (tries = 0; tries < LOCK_PROFILE_SITES - 1; tries++) {
+        site = &mutex->sites[slot];
+        if (site->file == NULL) {
+            site->file = file;
+            site->line = line;
+            return site;
+        }
+        if (site->line == line
+            && (site->file == file || strcmp (site->file, file) == 0))
+            return site;
+        slot = (slot + 1) % (LOCK_PROFILE_SITES - 1);
+    }
+    site = &mutex->sites[LOCK_PROFILE_SITES - 1];
+    site->file = "(other sites)";
+    return site;
+}
+
+/*
+ * Initialize a mutex and add it to those reported. Call before
+ * any other thread uses it. Returns 0, or an error number.
+ */
+int profiled_mutex_init (profiled_mutex_t *mutex, const char *name)
+{
+    int status;
+
+    status = pthread_mutex_init (&mutex->mutex, NULL);
+    if (status != 0)
+        return status;
+    mutex->name = name;
+    mutex->holder = NULL;
+    mutex->locked_at = 0;
+    memset (mutex->sites, 0, sizeof (mutex->sites));
+    status = pthread_mutex_lock (&lock_profile_mutex);
+    if (status != 0)
+        return status;
+    mutex->next = lock_profile_mutexes;
+    lock_profile_mutexes = mutex;
+    return pthread_mutex_unlock (&lock_profile_mutex);
+}
+
+/*
+ * Lock a mutex from the site "file":"line". Returns the status of
+ * pthread_mutex_lock.
+ */
+int profiled_mutex_lock_at (
+    profiled_mutex_t *mutex, const char *file, int line)
+{
+    unsigned long long start = 0;
+    int status, contended = 0;
+
+    status = pthread_mutex_trylock (&mutex->mutex);
+    if (status == EBUSY) {
+        contended = 1;
+        start = lock_profile_now ();
+        status = pthread_mutex_lock (&mutex->mutex);
+    }
+    if (status != 0)
+        return status;
+    mutex->locked_at = lock_profile_now ();
+    mutex->holder = lock_profile_site (mutex, file, line);
+    mutex->holder->acquisitions++;
+    if (contended) {
+        mutex->holder->contended++;
+        lock_profile_record (mutex->holder->wait, &mutex->holder->wait_total,
+            &mutex->holder->wait_max, mutex->locked_at - start);
+    }
+    return 0;
+}
+
+/*
+ * Record how long the mutex has been held, by the site that
+ * locked it. The caller must hold the mutex.
+ */
+void profiled_mutex_waiting_at (profiled_mutex_t *mutex)
+{
+    lock_site_t *site = mutex->holder;
+
+    if (site == NULL)
+        return;
+    site->holds++;
+    lock_profile_record (site->hold, &site->hold_total, &site->hold_max,
+        lock_profile_now () - mutex->locked_at);
+    mutex->holder = NULL;
+}
+
+/*
+ * Note that a condition wait at "file":"line" has locked the
+ * mutex again.
+ */
+void profiled_mutex_woken_at (
+    profiled_mutex_t *mutex, const char *file, int line)
+{
+    mutex->locked_at = lock_profile_now ();
+    mutex->holder = lock_profile_site (mutex, file, line);
+}
+
+int profiled_mutex_unlock_at (profiled_mutex_t *mutex)
+{
+    profiled_mutex_waiting_at (mutex);
+    return pthread_mutex_unlock (&mutex->mutex);
+}
+
+/*
+ * Return the upper bound of the bucket holding the given fraction
+ * of a histogram's "count" values.
+ */
+static unsigned long long lock_profile_percentile (
+    const unsigned long histogram[], unsigned long count, double fraction)
+{
+    unsigned long seen = 0, wanted = (unsigned long)(count * fraction);
+    int bucket;
+
+    for (bucket = 0; bucket < LOCK_PROFILE_BUCKETS - 1; bucket++) {
+        seen += histogram[bucket];
+        if (seen > wanted)
+            break;
+    }
+    return 1ULL << bucket;
+}
+
+/*
+ * Sort sites by total time waited, most first, then by
+ * acquisitions.
+ */
+static int lock_profile_compare (const void *a, const void *b)
+{
+    const lock_site_t *x = (const lock_site_t*)a, *y = (const lock_site_t*)b;
+
+    if (x->wait_total != y->wait_total)
+        return x->wait_total < y->wait_total ? 1 : -1;
+    if (x->acquisitions != y->acquisitions)
+        return x->acquisitions < y->acquisitions ? 1 : -1;
+    return 0;
+}
+
+/*
+ * Print the profile of one mutex from a copy of its sites.
+ */
+static void lock_profile_print (
+    FILE *file, const char *name, lock_site_t sites[])
+{
+    unsigned long acquisitions = 0, contended = 0;
+    unsigned long long wait_total = 0;
+    lock_site_t *site;
+    int i;
+
+    for (i = 0; i < LOCK_PROFILE_SITES; i++) {
+        acquisitions += sites[i].acquisitions;
+        contended += sites[i].contended;
+        wait_total += sites[i].wait_total;
+    }
+    fprintf (file, "%s: %lu acquisitions, %lu contended (%.1f%%), "
+        "%llu ns waited\n", name, acquisitions, contended,
+        acquisitions == 0 ? 0.0 : 100.0 * contended / acquisitions,
+        wait_total);
+    qsort (sites, LOCK_PROFILE_SITES, sizeof (lock_site_t),
+        lock_profile_compare);
+    for (i = 0; i < LOCK_PROFILE_SITES; i++) {
+        site = &sites[i];
+        if (site->file == NULL || (site->acquisitions == 0 && site->holds == 0))
+            continue;
+        fprintf (file, "  %s:%d: %lu acquisitions, %lu contended",
+            site->file, site->line, site->acquisitions, site->contended);
+        if (site->contended > 0)
+            fprintf (file, ", wait mean %llu p50 <%llu p99 <%llu max %llu",
+                site->wait_total / site->contended,
+                lock_profile_percentile (site->wait, site->contended, 0.5),
+                lock_profile_percentile (site->wait, site->contended, 0.99),
+                site->wait_max);
+        if (site->holds > 0)
+            fprintf (file, ", %lu holds mean %llu p50 <%llu p99 <%llu "
+                "max %llu", site->holds, site->hold_total / site->holds,
+                lock_profile_percentile (site->hold, site->holds, 0.5),
+                lock_profile_percentile (site->hold, site->holds, 0.99),
+                site->hold_max);
+        fputc ('\n', file);
+    }
+}
+
+/*
+ * Print the profile of every profiled mutex. Each mutex is locked
+ * just long enough to copy its statistics, so the caller must not
+ * hold any of them.
+ */
+void lock_profile_report (FILE *file)
+{
+    lock_site_t *sites;
+    profiled_mutex_t *mutex;
+    int status;
+
+    sites = (lock_site_t*)malloc (sizeof (mutex->sites));
+    if (sites == NULL)
+        errno_abort ("Allocate lock profile");
+    status = pthread_mutex_lock (&lock_profile_mutex);
+    if (status != 0)
+        err_abort (status, "Lock profile list");
+    for (mutex = lock_profile_mutexes; mutex != NULL; mutex = mutex->next) {
+        status = pthread_mutex_lock (&mutex->mutex);
+        if (status != 0)
+            err_abort (status, "Lock profiled mutex");
+        memcpy (sites, mutex->sites, sizeof (mutex->sites));
+        status = pthread_mutex_unlock (&mutex->mutex);
+        if (status != 0)
+            err_abort (status, "Unlock profiled mutex");
+        lock_profile_print (file, mutex->name, sites);
+    }
+    status = pthread_mutex_unlock (&lock_profile_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock profile list");
+    free (sites);
+}
+
+#endif
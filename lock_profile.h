@@ -0,0 +1,99 @@
+/*
+ * lock_profile.h
+ *
+ * A mutex that can profile its own contention. Compiled with
+ * -DLOCK_PROFILE, a profiled_mutex_t records, for each place in
+ * the source it is locked from (its "site", taken from __FILE__
+ * and __LINE__, as err_abort does in errors.h):
+ *
+ *      - how many times it was locked there,
+ *      - how many of those had to wait because the mutex was held,
+ *      - how long those waits took, and
+ *      - how long the mutex was then held,
+ *
+ * and lock_profile_report prints them, busiest site first. The
+ * times are kept in power-of-2 histograms, in nanoseconds.
+ *
+ * The statistics for a mutex are only changed while it is held,
+ * so they need no lock of their own. An uncontended lock costs a
+ * pthread_mutex_trylock and one read of the clock (for the hold
+ * time); only a contended one also times the wait.
+ *
+ * Compiled without LOCK_PROFILE, profiled_mutex_t is a plain
+ * mutex and the macros are the plain pthread calls, so profiling
+ * costs nothing unless it is asked for.
+ *
+ * A condition wait releases the mutex and locks it again. Call
+ * profiled_mutex_waiting before the wait and profiled_mutex_woken
+ * after it: the time up to the wait counts as held, and the time
+ * from the wakeup counts as held again from the site of the wait.
+ * The time taken to relock the mutex cannot be told apart from the
+ * sleep, so it is not counted as waiting.
+ *
+ * A function that locks a mutex for its callers can pass their
+ * site on through the "_at" forms, which take the file and line.
+ */
+#ifndef __lock_profile_h
+#define __lock_profile_h
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define LOCK_PROFILE_SITES      48      /* each mutex, at most; the last
+                                           counts all the sites after */
+#define LOCK_PROFILE_BUCKETS    48      /* bucket b: below 2^b ns */
+
+typedef struct lock_site_tag {
+    const char          *file;          /* NULL while unused */
+    int                 line;
+    unsigned long       acquisitions;
+    unsigned long       contended;
+    unsigned long       holds;          /* including after waits */
+    unsigned long long  wait_total;     /* of contended acquisitions */
+    unsigned long long  wait_max;
+    unsigned long long  hold_total;
+    unsigned long long  hold_max;
+    unsigned long       wait[LOCK_PROFILE_BUCKETS];
+    unsigned long       hold[LOCK_PROFILE_BUCKETS];
+} lock_site_t;
+
+typedef struct profiled_mutex_tag {
+    pthread_mutex_t     mutex;
+#ifdef LOCK_PROFILE
+    const char          *name;
+    struct profiled_mutex_tag *next;    /* all profiled mutexes */
+    lock_site_t         *holder;        /* site it was locked from */
+    unsigned long long  locked_at;
+    lock_site_t         sites[LOCK_PROFILE_SITES];
+#endif
+} profiled_mutex_t;
+
+#ifdef LOCK_PROFILE
+# define profiled_mutex_lock(m) \
+    profiled_mutex_lock_at (m, __FILE__, __LINE__)
+# define profiled_mutex_unlock(m) profiled_mutex_unlock_at (m)
+# define profiled_mutex_waiting(m) profiled_mutex_waiting_at (m)
+# define profiled_mutex_woken(m) \
+    profiled_mutex_woken_at (m, __FILE__, __LINE__)
+
+extern int profiled_mutex_init (profiled_mutex_t *mutex, const char *name);
+extern int profiled_mutex_lock_at (
+    profiled_mutex_t *mutex, const char *file, int line);
+extern int profiled_mutex_unlock_at (profiled_mutex_t *mutex);
+extern void profiled_mutex_waiting_at (profiled_mutex_t *mutex);
+extern void profiled_mutex_woken_at (
+    profiled_mutex_t *mutex, const char *file, int line);
+extern void lock_profile_report (FILE *file);
+#else
+# define profiled_mutex_init(m, name) pthread_mutex_init (&(m)->mutex, NULL)
+# define profiled_mutex_lock(m) pthread_mutex_lock (&(m)->mutex)
+# define profiled_mutex_unlock(m) pthread_mutex_unlock (&(m)->mutex)
+# define profiled_mutex_waiting(m) ((void)0)
+# define profiled_mutex_woken(m) ((void)0)
+# define profiled_mutex_lock_at(m, file, line) pthread_mutex_lock (&(m)->mutex)
+# define profiled_mutex_unlock_at(m) pthread_mutex_unlock (&(m)->mutex)
+# define profiled_mutex_waiting_at(m) ((void)0)
+# define profiled_mutex_woken_at(m, file, line) ((void)0)
+#endif
+
+#endif
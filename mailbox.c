@@ -0,0 +1,113 @@
+/*
+ * mailbox.c
+ *
+ * Unbounded SPSC message queue. See mailbox.h.
+ */
+#include <stdlib.h>
+#include "mailbox.h"
+#include "errors.h"
+
+/*
+ * Initialize an empty mailbox. Returns 0, or an error number.
+ */
+int mailbox_init (mailbox_t *mailbox)
+{
+    mailbox_chunk_t *chunk;
+
+    chunk = (mailbox_chunk_t*)malloc (sizeof (mailbox_chunk_t));
+    if (chunk == NULL)
+        return ENOMEM;
+    atomic_init (&chunk->next, NULL);
+    mailbox->tail = mailbox->head = chunk;
+    atomic_init (&mailbox->posted, 0);
+    mailbox->taken = 0;
+    atomic_init (&mailbox->spare, NULL);
+    return 0;
+}
+
+/*
+ * Free a mailbox's chunks, with any messages still in them. Call
+ * once neither thread uses it.
+ */
+void mailbox_destroy (mailbox_t *mailbox)
+{
+    mailbox_chunk_t *chunk, *next;
+
+    for (chunk = mailbox->head; chunk != NULL; chunk = next) {
+        next = atomic_load (&chunk->next);
+        free (chunk);
+    }
+    free (atomic_load (&mailbox->spare));
+    mailbox->head = mailbox->tail = NULL;
+}
+
+/*
+ * Post a message; only the mailbox's producer may call this. The
+ * message is written before the count of messages is published, so
+ * the consumer never sees a half-written one. Returns 0, or ENOMEM
+ * if a new chunk was needed and there was no memory for it.
+ */
+int mailbox_post (mailbox_t *mailbox, int type, void *data)
+{
+    size_t posted;
+    mailbox_chunk_t *chunk;
+    mailbox_message_t *message;
+
+    posted = atomic_load_explicit (&mailbox->posted, memory_order_relaxed);
+    if (posted % MAILBOX_CHUNK == 0 && posted != 0) {
+        chunk = atomic_exchange_explicit (
+            &mailbox->spare, NULL, memory_order_acquire);
+        if (chunk == NULL) {
+            chunk = (mailbox_chunk_t*)malloc (sizeof (mailbox_chunk_t));
+            if (chunk == NULL)
+                return ENOMEM;
+        }
+        atomic_store_explicit (&chunk->next, NULL, memory_order_relaxed);
+        atomic_store_explicit (&mailbox->tail->next, chunk,
+            memory_order_relaxed);
+        mailbox->tail = chunk;
+    }
+    message = &mailbox->tail->messages[posted % MAILBOX_CHUNK];
+    message->type = type;
+    message->data = data;
+    atomic_store_explicit (&mailbox->posted, posted + 1,
+        memory_order_release);
+    return 0;
+}
+
+/*
+ * Take the oldest message; only the mailbox's consumer may call
+ * this. Returns 1 with the message, or 0 if the mailbox is empty.
+ * A chunk the consumer has read to the end is no longer written by
+ * the producer, which has already published a message in the next
+ * one, so it becomes the spare, unless there is one already.
+ */
+int mailbox_take (mailbox_t *mailbox, mailbox_message_t *message)
+{
+    mailbox_chunk_t *chunk;
+
+    if (mailbox->taken == atomic_load_explicit (
+            &mailbox->posted, memory_order_acquire))
+        return 0;
+    if (mailbox->taken % MAILBOX_CHUNK == 0 && mailbox->taken != 0) {
+        chunk = mailbox->head;
+        mailbox->head = atomic_load_explicit (
+            &chunk->next, memory_order_relaxed);
+        chunk = atomic_exchange_explicit (
+            &mailbox->spare, chunk, memory_order_release);
+        free (chunk);
+    }
+    *message = mailbox->head->messages[mailbox->taken % MAILBOX_CHUNK];
+    mailbox->taken++;
+    return 1;
+}
+
+/*
+ * Whether the mailbox has no message to take. Only its consumer
+ * may ask.
+ */
+int mailbox_empty (mailbox_t *mailbox)
+{
+    return mailbox->taken == atomic_load_explicit (
+        &mailbox->posted, memory_order_acquire);
+}
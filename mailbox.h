@@ -0,0 +1,67 @@
+/*
+ * mailbox.h
+ *
+ * An unbounded single-producer, single-consumer queue of typed
+ * messages. Exactly one thread posts to a mailbox and exactly one
+ * other thread takes from it. Each keeps its own position, and the
+ * only shared state is the count of messages posted, so neither
+ * side takes a lock or waits for the other.
+ *
+ * Messages are kept in chunks of MAILBOX_CHUNK, which are linked
+ * as they fill, so a post never blocks and never fails while
+ * there is memory: a producer that holds a lock its consumer needs
+ * can post without deadlock, which a bounded ring could not
+ * promise. The consumer hands each chunk it has read back to the
+ * producer as a spare for the next one it needs, so a mailbox that
+ * keeps up allocates nothing after its first two chunks.
+ *
+ * A mailbox does not wake its consumer. The producer signals
+ * whatever condition variable the consumer sleeps on, and the
+ * consumer checks mailbox_empty, with that condition's mutex held,
+ * before it waits.
+ */
+#ifndef __mailbox_h
+#define __mailbox_h
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define MAILBOX_CHUNK           64      /* messages in each chunk */
+#define MAILBOX_CACHE_LINE      64
+
+typedef struct mailbox_message_tag {
+    int                 type;           /* the program's own codes */
+    void                *data;
+} mailbox_message_t;
+
+typedef struct mailbox_chunk_tag {
+    struct mailbox_chunk_tag *_Atomic next;
+    mailbox_message_t   messages[MAILBOX_CHUNK];
+} mailbox_chunk_t;
+
+/*
+ * The producer's fields and the consumer's are kept on separate
+ * cache lines, so each side only reads the other's line when it
+ * looks for messages.
+ */
+typedef struct mailbox_tag {
+    mailbox_chunk_t     *tail;          /* producer: chunk it writes */
+    atomic_size_t       posted;         /* messages ever posted */
+    char                pad0[MAILBOX_CACHE_LINE
+                             - sizeof (mailbox_chunk_t*)
+                             - sizeof (atomic_size_t)];
+    mailbox_chunk_t     *head;          /* consumer: chunk it reads */
+    size_t              taken;          /* messages ever taken */
+    char                pad1[MAILBOX_CACHE_LINE
+                             - sizeof (mailbox_chunk_t*)
+                             - sizeof (size_t)];
+    mailbox_chunk_t *_Atomic spare;     /* read chunk, for reuse */
+} mailbox_t;
+
+extern int mailbox_init (mailbox_t *mailbox);
+extern void mailbox_destroy (mailbox_t *mailbox);
+extern int mailbox_post (mailbox_t *mailbox, int type, void *data);
+extern int mailbox_take (mailbox_t *mailbox, mailbox_message_t *message);
+extern int mailbox_empty (mailbox_t *mailbox);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * metrics.c
+ *
+ * Per-thread metrics, added up when reported. See metrics.h.
+ */
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include "metrics.h"
+#include "errors.h"
+
+static pthread_key_t metrics_key;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static metrics_thread_t *_Atomic metrics_threads;
+static const char *const *metrics_counter_names;
+static const char *const *metrics_histogram_names;
+static const char *const *metrics_gauge_names;
+static int metrics_counter_count;
+static int metrics_histogram_count;
+static int metrics_gauge_count;
+
+/*
+ * Set up the metrics with the names of the counters, histograms
+ * and gauges, which must stay in place. Call before any other
+ * thread is created. Returns 0, or an error number.
+ */
+int metrics_init (
+    const char *const counters[], int counter_count,
+    const char *const histograms[], int histogram_count,
+    const char *const gauges[], int gauge_count)
+{
+    if (counter_count > METRICS_COUNTERS
+        || histogram_count > METRICS_HISTOGRAMS
+        || gauge_count > METRICS_GAUGES)
+        return EINVAL;
+    metrics_counter_names = counters;
+    metrics_counter_count = counter_count;
+    metrics_histogram_names = histograms;
+    metrics_histogram_count = histogram_count;
+    metrics_gauge_names = gauges;
+    metrics_gauge_count = gauge_count;
+    return pthread_key_create (&metrics_key, NULL);
+}
+
+/*
+ * Return the calling thread's block, creating and registering it
+ * the first time the thread records anything.
+ */
+static metrics_thread_t *metrics_thread (void)
+{
+    metrics_thread_t *thread;
+    int status;
+
+    thread = (metrics_thread_t*)pthread_getspecific (metrics_key);
+    if (thread != NULL)
+        return thread;
+    thread = (metrics_thread_t*)calloc (1, sizeof (metrics_thread_t));
+    if (thread == NULL)
+        errno_abort ("Allocate metrics");
+    snprintf (thread->name, sizeof (thread->name), "thread %lu",
+        (unsigned long)pthread_self ());
+    status = pthread_setspecific (metrics_key, thread);
+    if (status != 0)
+        err_abort (status, "Set metrics");
+    status = pthread_mutex_lock (&metrics_mutex);
+    if (status != 0)
+        err_abort (status, "Lock metrics");
+    thread->next = atomic_load (&metrics_threads);
+    atomic_store_explicit (&metrics_threads, thread, memory_order_release);
+    status = pthread_mutex_unlock (&metrics_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock metrics");
+    return thread;
+}
+
+/*
+ * Add to a value only the calling thread writes. Others may read
+ * it at any time, so it is stored atomically, but there is no
+ * need for an atomic add.
+ */
+static void metrics_add (_Atomic uint64_t *value, uint64_t n)
+{
+    atomic_store_explicit (value,
+        atomic_load_explicit (value, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+/*
+ * Name the calling thread in reports.
+ */
+void metrics_name_thread (const char *format, ...)
+{
+    metrics_thread_t *thread = metrics_thread ();
+    va_list args;
+
+    va_start (args, format);
+    vsnprintf (thread->name, sizeof (thread->name), format, args);
+    va_end (args);
+}
+
+void metrics_count (int counter, uint64_t n)
+{
+    metrics_add (&metrics_thread ()->counters[counter], n);
+}
+
+void metrics_record (int histogram, uint64_t value)
+{
+    metrics_histogram_t *record = &metrics_thread ()->histograms[histogram];
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll (value);
+
+    if (bucket >= METRICS_BUCKETS)
+        bucket = METRICS_BUCKETS - 1;
+    metrics_add (&record->buckets[bucket], 1);
+    metrics_add (&record->count, 1);
+    metrics_add (&record->sum, value);
+    if (value > atomic_load_explicit (&record->max, memory_order_relaxed))
+        atomic_store_explicit (&record->max, value, memory_order_relaxed);
+}
+
+void metrics_set (int gauge, int64_t value)
+{
+    metrics_thread_t *thread = metrics_thread ();
+    unsigned set;
+
+    atomic_store_explicit (&thread->gauges[gauge], value,
+        memory_order_relaxed);
+    set = atomic_load_explicit (&thread->gauges_set, memory_order_relaxed);
+    if ((set & (1u << gauge)) == 0)
+        atomic_store_explicit (&thread->gauges_set, set | (1u << gauge),
+            memory_order_relaxed);
+}
+
+/*
+ * CLOCK_MONOTONIC in nanoseconds, for timing what is recorded.
+ */
+uint64_t metrics_now (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Return the upper bound of the bucket holding the given fraction
+ * of a histogram's values.
+ */
+static uint64_t metrics_percentile (
+    const uint64_t buckets[], uint64_t count, double fraction)
+{
+    uint64_t seen = 0, wanted = (uint64_t)(count * fraction);
+    int bucket;
+
+    for (bucket = 0; bucket < METRICS_BUCKETS - 1; bucket++) {
+        seen += buckets[bucket];
+        if (seen > wanted)
+            break;
+    }
+    return 1ULL << bucket;
+}
+
+/*
+ * Write a report of every metric, added up over the threads. Any
+ * thread may make a report, at any time.
+ */
+void metrics_report (FILE *file)
+{
+    metrics_thread_t *thread, *first;
+    metrics_histogram_t *part;
+    uint64_t buckets[METRICS_BUCKETS], counter, count, sum, max, value;
+    int i, bucket;
+
+    first = atomic_load_explicit (&metrics_threads, memory_order_acquire);
+    for (i = 0; i < metrics_counter_count; i++) {
+        counter = 0;
+        for (thread = first; thread != NULL; thread = thread->next)
+            counter += atomic_load_explicit (
+                &thread->counters[i], memory_order_relaxed);
+        fprintf (file, "%s: %llu\n", metrics_counter_names[i],
+            (unsigned long long)counter);
+    }
+    for (i = 0; i < metrics_histogram_count; i++) {
+        memset (buckets, 0, sizeof (buckets));
+        count = sum = max = 0;
+        for (thread = first; thread != NULL; thread = thread->next) {
+            part = &thread->histograms[i];
+            for (bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+                buckets[bucket] += atomic_load_explicit (
+                    &part->buckets[bucket], memory_order_relaxed);
+            sum += atomic_load_explicit (&part->sum, memory_order_relaxed);
+            value = atomic_load_explicit (&part->max, memory_order_relaxed);
+            if (value > max)
+                max = value;
+        }
+        for (bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+            count += buckets[bucket];
+        if (count == 0) {
+            fprintf (file, "%s: none\n", metrics_histogram_names[i]);
+            continue;
+        }
+        fprintf (file, "%s: count %llu mean %llu p50 <%llu p90 <%llu "
+            "p99 <%llu max %llu\n", metrics_histogram_names[i],
+            (unsigned long long)count, (unsigned long long)(sum / count),
+            (unsigned long long)metrics_percentile (buckets, count, 0.5),
+            (unsigned long long)metrics_percentile (buckets, count, 0.9),
+            (unsigned long long)metrics_percentile (buckets, count, 0.99),
+            (unsigned long long)max);
+    }
+    for (thread = first; thread != NULL; thread = thread->next)
+        for (i = 0; i < metrics_gauge_count; i++)
+            if (atomic_load_explicit (&thread->gauges_set,
+                    memory_order_relaxed) & (1u << i))
+                fprintf (file, "%s: %s %lld\n", thread->name,
+                    metrics_gauge_names[i], (long long)atomic_load_explicit (
+                        &thread->gauges[i], memory_order_relaxed));
+}
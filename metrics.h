@@ -0,0 +1,62 @@
+/*
+ * metrics.h
+ *
+ * Runtime counters, histograms and gauges, cheap enough to update
+ * on every command and every lock. Each thread has its own block
+ * of them, which only it writes: an update is a load and a store
+ * to memory no other thread writes, with no lock and no atomic
+ * read-modify-write, so updates from different threads never
+ * contend for a cache line. A report adds up the blocks of all
+ * threads when it is made, so it may be a moment out of date but
+ * costs the threads being measured nothing.
+ *
+ * The program names its counters, histograms and gauges when it
+ * calls metrics_init, and refers to them by index from then on.
+ * Counters and histograms are summed over the threads; gauges,
+ * such as a thread's current number of alarms, are reported for
+ * each thread that has set one. A histogram has a bucket for each
+ * power of 2, so its percentiles are reported as the bucket's
+ * upper bound: "p99 <2048" means 99% of the values were below
+ * 2048.
+ */
+#ifndef __metrics_h
+#define __metrics_h
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define METRICS_COUNTERS        32      /* each, at most */
+#define METRICS_HISTOGRAMS      8
+#define METRICS_GAUGES          4
+#define METRICS_BUCKETS         64      /* bucket b: values below 2^b */
+
+typedef struct metrics_histogram_tag {
+    _Atomic uint64_t    buckets[METRICS_BUCKETS];
+    _Atomic uint64_t    count;
+    _Atomic uint64_t    sum;
+    _Atomic uint64_t    max;
+} metrics_histogram_t;
+
+typedef struct metrics_thread_tag {
+    struct metrics_thread_tag *next;    /* all blocks, for reports */
+    char                name[32];
+    _Atomic uint64_t    counters[METRICS_COUNTERS];
+    _Atomic int64_t     gauges[METRICS_GAUGES];
+    atomic_uint         gauges_set;     /* bit for each gauge set */
+    metrics_histogram_t histograms[METRICS_HISTOGRAMS];
+} metrics_thread_t;
+
+extern int metrics_init (
+    const char *const counters[], int counter_count,
+    const char *const histograms[], int histogram_count,
+    const char *const gauges[], int gauge_count);
+extern void metrics_name_thread (const char *format, ...)
+    __attribute__ ((format (printf, 1, 2)));
+extern void metrics_count (int counter, uint64_t n);
+extern void metrics_record (int histogram, uint64_t value);
+extern void metrics_set (int gauge, int64_t value);
+extern uint64_t metrics_now (void);
+extern void metrics_report (FILE *file);
+
+#endif
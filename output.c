@@ -0,0 +1,410 @@
+/*
+ * output.c
+ *
+ * Per-thread output buffers drained by a writer thread. See
+ * output.h.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include "output.h"
+#include "errors.h"
+
+#define OUTPUT_ALIGN    16      /* record alignment */
+#define OUTPUT_IOV      1024    /* lines per writev, at most IOV_MAX */
+#define OUTPUT_STACK    512     /* lines formatted without malloc */
+#define OUTPUT_WRAP     0       /* stamp of a record that skips to the start */
+#define OUTPUT_LINGER   200000  /* nanoseconds to gather a burst of lines */
+
+/*
+ * Each record is a header followed by the text, padded to
+ * OUTPUT_ALIGN. Since the buffer size is a multiple of that, there
+ * is always room for a header at the end of the buffer; a record
+ * that will not fit there is preceded by an OUTPUT_WRAP header,
+ * which tells the writer to skip to the start, so that every line
+ * is contiguous for writev.
+ */
+typedef struct output_record_tag {
+    unsigned long       stamp;
+    size_t              length;
+    char                text[];
+} output_record_t;
+
+typedef struct output_buffer_tag {
+    struct output_buffer_tag *next;     /* all buffers, for the writer */
+    char                *data;
+    size_t              read;           /* writer's own position */
+    atomic_size_t       head;           /* bytes appended */
+    atomic_size_t       tail;           /* bytes released by the writer */
+} output_buffer_t;
+
+static pthread_once_t output_once = PTHREAD_ONCE_INIT;
+static pthread_key_t output_key;
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
+static output_buffer_t *_Atomic output_buffers;
+static atomic_ulong output_stamp = 1;   /* next stamp to give out */
+static atomic_ulong output_written = 1; /* next stamp to write */
+static atomic_int output_idle;          /* writer is, or will be, asleep */
+static sem_t output_wakeup;
+
+/*
+ * A thread whose buffer is full, or that is flushing, waits on
+ * output_progress, which the writer broadcasts after each write
+ * while output_waiters is not 0.
+ */
+static pthread_mutex_t output_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t output_progress = PTHREAD_COND_INITIALIZER;
+static atomic_int output_waiters;
+
+static size_t output_record_size (size_t length)
+{
+    return (sizeof (output_record_t) + length + OUTPUT_ALIGN - 1)
+        & ~(size_t)(OUTPUT_ALIGN - 1);
+}
+
+/*
+ * Wake the writer, if it is asleep.
+ */
+static void output_wake (void)
+{
+    if (atomic_load (&output_idle) == 1
+        && atomic_exchange (&output_idle, 0) == 1)
+        sem_post (&output_wakeup);
+}
+
+/*
+ * Wait until "done" returns true of "buffer", sleeping until the
+ * writer's next write each time it does not. The waiter is
+ * counted before it looks, and the writer publishes its progress
+ * before it looks for waiters, so either the waiter sees the
+ * progress or the writer sees the waiter and broadcasts.
+ */
+static void output_wait (
+    int (*done)(output_buffer_t*, void*), output_buffer_t *buffer, void *arg)
+{
+    int status;
+
+    status = pthread_mutex_lock (&output_wait_mutex);
+    if (status != 0)
+        err_abort (status, "Lock output wait");
+    atomic_fetch_add (&output_waiters, 1);
+    while (!done (buffer, arg)) {
+        output_wake ();
+        status = pthread_cond_wait (&output_progress, &output_wait_mutex);
+        if (status != 0)
+            err_abort (status, "Wait for output");
+    }
+    atomic_fetch_sub (&output_waiters, 1);
+    status = pthread_mutex_unlock (&output_wait_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock output wait");
+}
+
+/*
+ * Wake the threads waiting in output_wait, if there are any.
+ */
+static void output_progressed (void)
+{
+    int status;
+
+    if (atomic_load (&output_waiters) == 0)
+        return;
+    status = pthread_mutex_lock (&output_wait_mutex);
+    if (status != 0)
+        err_abort (status, "Lock output wait");
+    status = pthread_cond_broadcast (&output_progress);
+    if (status != 0)
+        err_abort (status, "Signal output wait");
+    status = pthread_mutex_unlock (&output_wait_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock output wait");
+}
+
+/*
+ * Return the calling thread's buffer, creating and registering it
+ * the first time the thread writes.
+ */
+static output_buffer_t *output_buffer (void)
+{
+    output_buffer_t *buffer;
+    int status;
+
+    buffer = (output_buffer_t*)pthread_getspecific (output_key);
+    if (buffer != NULL)
+        return buffer;
+    buffer = (output_buffer_t*)malloc (sizeof (output_buffer_t));
+    if (buffer == NULL
+        || (buffer->data = (char*)malloc (OUTPUT_BUFFER_SIZE)) == NULL)
+        errno_abort ("Allocate output buffer");
+    buffer->read = 0;
+    atomic_init (&buffer->head, 0);
+    atomic_init (&buffer->tail, 0);
+    status = pthread_setspecific (output_key, buffer);
+    if (status != 0)
+        err_abort (status, "Set output buffer");
+    status = pthread_mutex_lock (&output_mutex);
+    if (status != 0)
+        err_abort (status, "Lock output");
+    buffer->next = atomic_load (&output_buffers);
+    atomic_store_explicit (&output_buffers, buffer, memory_order_release);
+    status = pthread_mutex_unlock (&output_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock output");
+    return buffer;
+}
+
+/*
+ * Return the next record the writer has not yet taken from
+ * "buffer", skipping any OUTPUT_WRAP, or NULL if there is none.
+ */
+static output_record_t *output_peek (output_buffer_t *buffer)
+{
+    output_record_t *record;
+    size_t head = atomic_load_explicit (&buffer->head, memory_order_acquire);
+
+    while (buffer->read != head) {
+        record = (output_record_t*)(buffer->data
+            + (buffer->read & (OUTPUT_BUFFER_SIZE - 1)));
+        if (record->stamp != OUTPUT_WRAP)
+            return record;
+        buffer->read += OUTPUT_BUFFER_SIZE
+            - (buffer->read & (OUTPUT_BUFFER_SIZE - 1));
+    }
+    return NULL;
+}
+
+/*
+ * Write all of "iov" to standard output.
+ */
+static void output_writev (struct iovec *iov, int count)
+{
+    ssize_t written;
+
+    while (count > 0) {
+        written = writev (STDOUT_FILENO, iov, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            errno_abort ("Write output");
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+/*
+ * The writer thread. It gathers the records with the next stamps
+ * from whichever buffers hold them, writes them in one writev, and
+ * only then gives their space back to the threads that wrote them.
+ * After a short write it lingers briefly before looking again, so
+ * that a burst of lines is written in a few large writes rather
+ * than one wakeup and writev per line; a line that comes alone is
+ * still written at once.
+ *
+ * A stamp that has been given out but whose record is not yet
+ * visible is one being copied; the writer yields until it appears.
+ */
+static void *output_thread (void *arg)
+{
+    struct iovec iov[OUTPUT_IOV];
+    struct timespec linger = {0, OUTPUT_LINGER};
+    output_buffer_t *buffer;
+    output_record_t *record;
+    unsigned long next = 1;
+    int count;
+
+    while (1) {
+        count = 0;
+        buffer = atomic_load_explicit (&output_buffers, memory_order_acquire);
+        while (count < OUTPUT_IOV && buffer != NULL) {
+            record = output_peek (buffer);
+            if (record == NULL || record->stamp != next) {
+                /*
+                 * Look for the next stamp in every buffer, starting
+                 * with the first; stop if none has it yet.
+                 */
+                for (buffer = atomic_load_explicit (
+                        &output_buffers, memory_order_acquire);
+                    buffer != NULL; buffer = buffer->next) {
+                    record = output_peek (buffer);
+                    if (record != NULL && record->stamp == next)
+                        break;
+                }
+                if (buffer == NULL)
+                    break;
+            }
+            iov[count].iov_base = record->text;
+            iov[count].iov_len = record->length;
+            count++;
+            next++;
+            buffer->read += output_record_size (record->length);
+        }
+
+        if (count > 0) {
+            output_writev (iov, count);
+            for (buffer = atomic_load_explicit (
+                    &output_buffers, memory_order_acquire);
+                buffer != NULL; buffer = buffer->next)
+                atomic_store (&buffer->tail, buffer->read);
+            atomic_store (&output_written, next);
+            output_progressed ();
+            if (count < OUTPUT_IOV)
+                nanosleep (&linger, NULL);
+            continue;
+        }
+        if (atomic_load (&output_stamp) != next) {
+            sched_yield ();
+            continue;
+        }
+
+        /*
+         * Nothing to write: go to sleep. A thread that takes a
+         * stamp after we have looked will see output_idle set, and
+         * post the semaphore.
+         */
+        atomic_store (&output_idle, 1);
+        if (atomic_load (&output_stamp) != next
+            && atomic_exchange (&output_idle, 0) == 1)
+            continue;
+        while (sem_wait (&output_wakeup) != 0)
+            if (errno != EINTR)
+                errno_abort ("Wait for output");
+    }
+    return NULL;
+}
+
+static void output_key_init (void)
+{
+    int status;
+
+    status = pthread_key_create (&output_key, NULL);
+    if (status != 0)
+        err_abort (status, "Create output key");
+}
+
+/*
+ * Start the writer thread. Returns 0, or an error number.
+ */
+int output_init (void)
+{
+    pthread_t thread;
+    int status;
+
+    status = pthread_once (&output_once, output_key_init);
+    if (status != 0)
+        return status;
+    if (sem_init (&output_wakeup, 0, 0) != 0)
+        return errno;
+    status = pthread_create (&thread, NULL, output_thread, NULL);
+    if (status != 0)
+        return status;
+    return pthread_detach (thread);
+}
+
+/*
+ * Whether "buffer" has room for "*(size_t*)end" bytes, counted
+ * from the start of its data.
+ */
+static int output_room (output_buffer_t *buffer, void *end)
+{
+    return *(size_t*)end - atomic_load (&buffer->tail)
+        <= OUTPUT_BUFFER_SIZE;
+}
+
+/*
+ * Whether the writer has written the record with stamp
+ * "*(unsigned long*)last".
+ */
+static int output_done (output_buffer_t *buffer, void *last)
+{
+    return atomic_load (&output_written) > *(unsigned long*)last;
+}
+
+/*
+ * Append "length" bytes of text to the calling thread's buffer, as
+ * one record. If the buffer is full, the thread sleeps until the
+ * writer makes room; it may hold a mutex such as alarm_mutex, so
+ * it must not spin.
+ */
+void output_write (const char *text, size_t length)
+{
+    output_buffer_t *buffer = output_buffer ();
+    output_record_t *record;
+    size_t head, offset, size, skip, end;
+
+    if (length > OUTPUT_BUFFER_SIZE / 4)
+        length = OUTPUT_BUFFER_SIZE / 4; /* so it fits, even after a skip */
+    size = output_record_size (length);
+    head = atomic_load_explicit (&buffer->head, memory_order_relaxed);
+    offset = head & (OUTPUT_BUFFER_SIZE - 1);
+    skip = OUTPUT_BUFFER_SIZE - offset < size ? OUTPUT_BUFFER_SIZE - offset : 0;
+    end = head + skip + size;
+    if (!output_room (buffer, &end))
+        output_wait (output_room, buffer, &end);
+    if (skip > 0) {
+        ((output_record_t*)(buffer->data + offset))->stamp = OUTPUT_WRAP;
+        head += skip;
+        offset = 0;
+    }
+
+    /*
+     * The stamp is taken only once there is room, so the record is
+     * always published soon after, and the writer, which waits for
+     * each stamp in turn, never waits on a thread that is waiting
+     * for it.
+     */
+    record = (output_record_t*)(buffer->data + offset);
+    record->length = length;
+    memcpy (record->text, text, length);
+    record->stamp = atomic_fetch_add (&output_stamp, 1);
+    atomic_store_explicit (&buffer->head, head + size, memory_order_release);
+    output_wake ();
+}
+
+/*
+ * Format a line, as printf would, and append it to the calling
+ * thread's buffer.
+ */
+void output_printf (const char *format, ...)
+{
+    char line[OUTPUT_STACK], *text = line;
+    va_list ap, retry;
+    int length;
+
+    va_start (ap, format);
+    va_copy (retry, ap);
+    length = vsnprintf (line, sizeof (line), format, ap);
+    if (length >= (int)sizeof (line)) {
+        text = (char*)malloc (length + 1);
+        if (text == NULL)
+            errno_abort ("Format output");
+        vsnprintf (text, length + 1, format, retry);
+    }
+    va_end (retry);
+    va_end (ap);
+    if (length > 0)
+        output_write (text, length);
+    if (text != line)
+        free (text);
+}
+
+/*
+ * Wait until everything appended so far has been written.
+ */
+void output_flush (void)
+{
+    unsigned long last = atomic_load (&output_stamp) - 1;
+
+    if (!output_done (NULL, &last))
+        output_wait (output_done, NULL, &last);
+}
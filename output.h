@@ -0,0 +1,39 @@
+/*
+ * output.h
+ *
+ * Asynchronous standard output. A thread that calls printf while
+ * holding a mutex stalls every thread waiting for that mutex
+ * whenever the terminal or pipe is slow to drain; output_printf
+ * instead formats the line into a buffer belonging to the calling
+ * thread, and a writer thread copies the buffered lines to
+ * standard output with writev, many lines to a call.
+ *
+ * Each thread's buffer is a single-producer, single-consumer byte
+ * ring: the thread appends records and the writer removes them,
+ * each through one atomic position counter, with no lock. Every
+ * record is stamped from a global atomic counter when it is
+ * appended, and the writer copies records out strictly in stamp
+ * order, so lines appear in the order they were produced even
+ * though they travel through different buffers.
+ *
+ * The writer sleeps on a semaphore when there is nothing to write,
+ * and the first record appended after that posts it. A thread
+ * whose buffer is full sleeps on a condition variable until the
+ * writer makes room, so no output is lost (though a single line
+ * of more than a quarter of a buffer is cut short). Call
+ * output_flush before exit to wait for the writer to catch up.
+ */
+#ifndef __output_h
+#define __output_h
+
+#include <stddef.h>
+
+#define OUTPUT_BUFFER_SIZE      (256 * 1024)    /* per thread, a power of 2 */
+
+extern int output_init (void);
+extern void output_printf (const char *format, ...)
+    __attribute__ ((format (printf, 1, 2)));
+extern void output_write (const char *text, size_t length);
+extern void output_flush (void);
+
+#endif
@@ -0,0 +1,272 @@
+/*
+ * pool.c
+ *
+ * Fixed-size object pool with per-thread caches. See pool.h.
+ */
+#include "pool.h"
+#include "errors.h"
+
+/*
+ * A thread's cache for one pool. Only its thread changes the
+ * counts, with a plain load and store; they are atomic so that
+ * pool_stats may read them meanwhile.
+ */
+typedef struct pool_cache_tag {
+    pool_t              *pool;  /* NULL until first used */
+    pool_object_t       *head;
+    int                 count;
+    struct pool_cache_tag *next; /* pool's caches, under its mutex */
+    atomic_ulong        allocs;
+    atomic_ulong        frees;
+} pool_cache_t;
+
+/*
+ * Each thread's caches live in its static thread-local storage,
+ * so a new thread (such as a display thread) does not need to
+ * malloc one.
+ */
+static __thread pool_cache_t pool_caches[POOL_MAX];
+static atomic_int pool_count = 0;
+
+/*
+ * Move up to "count" objects from the front of a cache to the
+ * shared free list.
+ */
+static void pool_cache_drain (pool_cache_t *cache, int count)
+{
+    pool_t *pool = cache->pool;
+    pool_object_t *first = cache->head, *last;
+    int moved, status;
+
+    if (first == NULL)
+        return;
+    last = first;
+    for (moved = 1; moved < count && last->next != NULL; moved++)
+        last = last->next;
+    cache->head = last->next;
+    cache->count -= moved;
+    status = profiled_mutex_lock (&pool->mutex);
+    if (status != 0)
+        err_abort (status, "Lock pool");
+    last->next = pool->free_list;
+    pool->free_list = first;
+    pool->free_count += moved;
+    status = profiled_mutex_unlock (&pool->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock pool");
+}
+
+/*
+ * Add one to a count that only the calling thread changes.
+ */
+static void pool_count_one (atomic_ulong *count)
+{
+    atomic_store_explicit (count,
+        atomic_load_explicit (count, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+}
+
+/*
+ * Thread-specific data destructor: give an exiting thread's
+ * cached objects back to the shared list, and its counts to the
+ * pool, as its cache goes away with it.
+ */
+static void pool_cache_exit (void *arg)
+{
+    pool_cache_t *cache = (pool_cache_t*)arg, **link;
+    pool_t *pool = cache->pool;
+    int status;
+
+    pool_cache_drain (cache, cache->count);
+    status = profiled_mutex_lock (&pool->mutex);
+    if (status != 0)
+        err_abort (status, "Lock pool");
+    for (link = &pool->caches; *link != cache; link = &(*link)->next)
+        ;
+    *link = cache->next;
+    pool->allocs += atomic_load (&cache->allocs);
+    pool->frees += atomic_load (&cache->frees);
+    status = profiled_mutex_unlock (&pool->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock pool");
+    cache->pool = NULL;
+}
+
+/*
+ * Return the calling thread's cache for "pool", registering it
+ * with the pool the first time.
+ */
+static pool_cache_t *pool_cache (pool_t *pool)
+{
+    pool_cache_t *cache = &pool_caches[pool->id];
+    int status;
+
+    if (cache->pool == NULL) {
+        cache->pool = pool;
+        atomic_init (&cache->allocs, 0);
+        atomic_init (&cache->frees, 0);
+        status = profiled_mutex_lock (&pool->mutex);
+        if (status != 0)
+            err_abort (status, "Lock pool");
+        cache->next = pool->caches;
+        pool->caches = cache;
+        status = profiled_mutex_unlock (&pool->mutex);
+        if (status != 0)
+            err_abort (status, "Unlock pool");
+        status = pthread_setspecific (pool->cache_key, cache);
+        if (status != 0)
+            err_abort (status, "Set pool cache");
+    }
+    return cache;
+}
+
+/*
+ * Refill an empty cache: take a batch from the shared list, or
+ * failing that, carve up a new slab. Returns 0, or -1 if there
+ * is no memory.
+ */
+static int pool_cache_fill (pool_cache_t *cache)
+{
+    pool_t *pool = cache->pool;
+    pool_object_t *object;
+    char *slab;
+    int i, status;
+
+    status = profiled_mutex_lock (&pool->mutex);
+    if (status != 0)
+        err_abort (status, "Lock pool");
+    while (cache->count < POOL_BATCH && pool->free_list != NULL) {
+        object = pool->free_list;
+        pool->free_list = object->next;
+        pool->free_count--;
+        object->next = cache->head;
+        cache->head = object;
+        cache->count++;
+    }
+    status = profiled_mutex_unlock (&pool->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock pool");
+    if (cache->head != NULL)
+        return 0;
+
+    slab = (char*)malloc (pool->size * pool->slab_objects);
+    if (slab == NULL)
+        return -1;
+    atomic_fetch_add_explicit (&pool->slabs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit (
+        &pool->objects, pool->slab_objects, memory_order_relaxed);
+    for (i = pool->slab_objects - 1; i >= 0; i--) {
+        object = (pool_object_t*)(slab + i * pool->size);
+        object->next = cache->head;
+        cache->head = object;
+        cache->count++;
+    }
+    /*
+     * A slab may be bigger than a cache should hold; share the
+     * rest now rather than on the next free.
+     */
+    if (cache->count > POOL_CACHE_MAX)
+        pool_cache_drain (cache, cache->count - POOL_BATCH);
+    return 0;
+}
+
+/*
+ * Initialize a pool of objects of "size" bytes, allocated
+ * "slab_objects" at a time. "name" labels its mutex in the lock
+ * profile. Returns 0, or an error number.
+ */
+int pool_init (
+    pool_t *pool, const char *name, size_t size, int slab_objects)
+{
+    size_t align = _Alignof (max_align_t);
+    int status;
+
+    if (slab_objects < 1)
+        return EINVAL;
+    pool->id = atomic_fetch_add (&pool_count, 1);
+    if (pool->id >= POOL_MAX)
+        return EAGAIN;
+    if (size < sizeof (pool_object_t))
+        size = sizeof (pool_object_t);
+    pool->size = (size + align - 1) & ~(align - 1);
+    pool->slab_objects = slab_objects;
+    status = pthread_key_create (&pool->cache_key, pool_cache_exit);
+    if (status != 0)
+        return status;
+    status = profiled_mutex_init (&pool->mutex, name);
+    if (status != 0)
+        return status;
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    pool->caches = NULL;
+    pool->allocs = 0;
+    pool->frees = 0;
+    atomic_init (&pool->slabs, 0);
+    atomic_init (&pool->objects, 0);
+    return 0;
+}
+
+/*
+ * Allocate an object, or return NULL if there is no memory. The
+ * object's contents are undefined.
+ */
+void *pool_alloc (pool_t *pool)
+{
+    pool_cache_t *cache = pool_cache (pool);
+    pool_object_t *object;
+
+    if (cache->head == NULL && pool_cache_fill (cache) != 0)
+        return NULL;
+    object = cache->head;
+    cache->head = object->next;
+    cache->count--;
+    pool_count_one (&cache->allocs);
+    return object;
+}
+
+/*
+ * Free an object from the pool. Any thread may free an object,
+ * whichever thread allocated it.
+ */
+void pool_free (pool_t *pool, void *object)
+{
+    pool_cache_t *cache;
+    pool_object_t *free_object = (pool_object_t*)object;
+
+    if (object == NULL)
+        return;
+    cache = pool_cache (pool);
+    free_object->next = cache->head;
+    cache->head = free_object;
+    cache->count++;
+    pool_count_one (&cache->frees);
+    if (cache->count > POOL_CACHE_MAX)
+        pool_cache_drain (cache, POOL_BATCH);
+}
+
+/*
+ * Report a pool's counters, adding up the allocations and frees
+ * counted by each thread's cache.
+ */
+void pool_stats (pool_t *pool, pool_stats_t *stats)
+{
+    pool_cache_t *cache;
+    int status;
+
+    stats->slabs = atomic_load (&pool->slabs);
+    stats->objects = atomic_load (&pool->objects);
+    status = profiled_mutex_lock (&pool->mutex);
+    if (status != 0)
+        err_abort (status, "Lock pool");
+    stats->allocs = pool->allocs;
+    stats->frees = pool->frees;
+    for (cache = pool->caches; cache != NULL; cache = cache->next) {
+        stats->allocs += atomic_load_explicit (
+            &cache->allocs, memory_order_relaxed);
+        stats->frees += atomic_load_explicit (
+            &cache->frees, memory_order_relaxed);
+    }
+    status = profiled_mutex_unlock (&pool->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock pool");
+}
@@ -0,0 +1,73 @@
+/*
+ * pool.h
+ *
+ * A pool of fixed-size objects, for structures that one thread
+ * allocates and another frees (in New_Alarm_cond.c, alarm_pool for
+ * the alarm_t requests, group_pool for the alarm_group_t records,
+ * members_pool for each shard's group_members_t lists and view_pool
+ * for the alarm_view_t copies that View_Alarms reads).
+ *
+ * Objects are carved from slabs, each a single malloc of many
+ * objects; slabs are never returned to malloc. Each thread keeps
+ * a small cache of free objects, so most allocations and frees
+ * take no lock. A thread that frees more objects than it
+ * allocates (a consumer of requests) returns the surplus to a
+ * shared free list in batches, and a thread that runs dry takes a
+ * batch from it; only when the shared list is empty too is a new
+ * slab allocated. A thread's cache goes back to the shared list
+ * when the thread exits.
+ *
+ * The counters show how many slabs (malloc calls) the pool has
+ * made, so a steady state with no mallocs can be verified.
+ * Allocations and frees are counted in each thread's cache, so
+ * the counting shares no cache line between threads either;
+ * pool_stats adds them up. The
+ * shared list's mutex is a profiled_mutex_t (lock_profile.h), so
+ * with -DLOCK_PROFILE its contention is reported under the name
+ * given to pool_init.
+ */
+#ifndef __pool_h
+#define __pool_h
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "lock_profile.h"
+
+#define POOL_MAX        8       /* pools per process */
+#define POOL_CACHE_MAX  64      /* free objects a thread may keep */
+#define POOL_BATCH      32      /* objects moved to or from a cache */
+
+typedef struct pool_object_tag {
+    struct pool_object_tag *next;
+} pool_object_t;
+
+typedef struct pool_tag {
+    size_t              size;           /* bytes per object */
+    int                 slab_objects;   /* objects per slab */
+    int                 id;             /* index of thread caches */
+    pthread_key_t       cache_key;      /* flushes caches at exit */
+    profiled_mutex_t    mutex;          /* protects free_list, caches */
+    pool_object_t       *free_list;
+    int                 free_count;
+    struct pool_cache_tag *caches;      /* of threads that have used it */
+    unsigned long       allocs;         /* by threads that have exited */
+    unsigned long       frees;
+    atomic_ulong        slabs;          /* malloc calls */
+    atomic_ulong        objects;        /* objects in all slabs */
+} pool_t;
+
+typedef struct pool_stats_tag {
+    unsigned long       slabs;
+    unsigned long       objects;
+    unsigned long       allocs;
+    unsigned long       frees;
+} pool_stats_t;
+
+extern int pool_init (
+    pool_t *pool, const char *name, size_t size, int slab_objects);
+extern void *pool_alloc (pool_t *pool);
+extern void pool_free (pool_t *pool, void *object);
+extern void pool_stats (pool_t *pool, pool_stats_t *stats);
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * ring.c
+ *
+ * Bounded lock-free MPMC ring. See ring.h.
+ */
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include "ring.h"
+#include "errors.h"
+
+/*
+ * Initialize a ring with room for "capacity" pointers, which must
+ * be a power of 2. Returns 0, or an error number.
+ */
+int ring_init (ring_t *ring, size_t capacity)
+{
+    size_t i;
+
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+        return EINVAL;
+    ring->cells = (ring_cell_t*)malloc (capacity * sizeof (ring_cell_t));
+    if (ring->cells == NULL)
+        return ENOMEM;
+    for (i = 0; i < capacity; i++)
+        atomic_init (&ring->cells[i].sequence, i);
+    ring->mask = capacity - 1;
+    atomic_init (&ring->enqueue_pos, 0);
+    atomic_init (&ring->dequeue_pos, 0);
+    if (sem_init (&ring->items, 0, 0) != 0
+        || sem_init (&ring->slots, 0, (unsigned int)capacity) != 0) {
+        free (ring->cells);
+        return errno;
+    }
+    return 0;
+}
+
+void ring_destroy (ring_t *ring)
+{
+    sem_destroy (&ring->items);
+    sem_destroy (&ring->slots);
+    free (ring->cells);
+    ring->cells = NULL;
+}
+
+/*
+ * Claim the cell at the enqueue position and store "data" in it.
+ * Returns 0, or -1 if the cell is still waiting to be read.
+ */
+static int ring_try_push (ring_t *ring, void *data, size_t *index)
+{
+    ring_cell_t *cell;
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit (&ring->enqueue_pos, memory_order_relaxed);
+    while (1) {
+        cell = &ring->cells[pos & ring->mask];
+        seq = atomic_load_explicit (&cell->sequence, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit (
+                &ring->enqueue_pos, &pos, pos + 1,
+                memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return -1;
+        else
+            pos = atomic_load_explicit (
+                &ring->enqueue_pos, memory_order_relaxed);
+    }
+    cell->data = data;
+    atomic_store_explicit (&cell->sequence, pos + 1, memory_order_release);
+    *index = pos & ring->mask;
+    return 0;
+}
+
+/*
+ * Claim the cell at the dequeue position and take its data.
+ * Returns 0, or -1 if the cell has not been written yet.
+ */
+static int ring_try_pop (ring_t *ring, void **data, size_t *index)
+{
+    ring_cell_t *cell;
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit (&ring->dequeue_pos, memory_order_relaxed);
+    while (1) {
+        cell = &ring->cells[pos & ring->mask];
+        seq = atomic_load_explicit (&cell->sequence, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit (
+                &ring->dequeue_pos, &pos, pos + 1,
+                memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return -1;
+        else
+            pos = atomic_load_explicit (
+                &ring->dequeue_pos, memory_order_relaxed);
+    }
+    *data = cell->data;
+    atomic_store_explicit (
+        &cell->sequence, pos + ring->mask + 1, memory_order_release);
+    *index = pos & ring->mask;
+    return 0;
+}
+
+/*
+ * Wait on a semaphore, retrying if a signal interrupts the wait.
+ */
+static void ring_sem_wait (sem_t *sem)
+{
+    while (sem_wait (sem) != 0)
+        if (errno != EINTR)
+            errno_abort ("Wait on ring");
+}
+
+/*
+ * Add a pointer to the ring, waiting while it is full. Returns
+ * the index of the cell used. If "blocked_ns" is not NULL, it
+ * receives the nanoseconds spent waiting for a free cell, which
+ * are only timed when the ring was full.
+ *
+ * Once the semaphore grants a free cell, the push can only fail
+ * for the moment it takes a consumer that has claimed the cell to
+ * finish reading it, so just yield and retry.
+ */
+size_t ring_push (ring_t *ring, void *data, long *blocked_ns)
+{
+    struct timespec start, end;
+    size_t index;
+
+    if (blocked_ns != NULL)
+        *blocked_ns = 0;
+    if (sem_trywait (&ring->slots) != 0) {
+        if (blocked_ns != NULL)
+            clock_gettime (CLOCK_MONOTONIC, &start);
+        ring_sem_wait (&ring->slots);
+        if (blocked_ns != NULL) {
+            clock_gettime (CLOCK_MONOTONIC, &end);
+            *blocked_ns = (end.tv_sec - start.tv_sec) * 1000000000L
+                + (end.tv_nsec - start.tv_nsec);
+        }
+    }
+    while (ring_try_push (ring, data, &index) != 0)
+        sched_yield ();
+    if (sem_post (&ring->items) != 0)
+        errno_abort ("Post to ring");
+    return index;
+}
+
+/*
+ * Remove and return the oldest pointer in the ring, waiting while
+ * it is empty. If "index" is not NULL, it receives the index of
+ * the cell that held the pointer.
+ */
+void *ring_pop (ring_t *ring, size_t *index)
+{
+    void *data;
+    size_t cell;
+
+    ring_sem_wait (&ring->items);
+    while (ring_try_pop (ring, &data, &cell) != 0)
+        sched_yield ();
+    if (sem_post (&ring->slots) != 0)
+        errno_abort ("Post to ring");
+    if (index != NULL)
+        *index = cell;
+    return data;
+}
+
+/*
+ * Return the number of pointers in the ring. Other threads may be
+ * pushing and popping, so this is only a snapshot, and may count a
+ * push or pop that has not quite finished.
+ */
+size_t ring_count (ring_t *ring)
+{
+    size_t enqueued = atomic_load_explicit (
+        &ring->enqueue_pos, memory_order_relaxed);
+    size_t dequeued = atomic_load_explicit (
+        &ring->dequeue_pos, memory_order_relaxed);
+
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
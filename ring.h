@@ -0,0 +1,52 @@
+/*
+ * ring.h
+ *
+ * A bounded multi-producer, multi-consumer queue of pointers,
+ * after Dmitry Vyukov's design. Each cell carries a sequence
+ * number that says whether it is ready to be written or read at a
+ * given position, so producers and consumers only contend on one
+ * atomic position counter each, with no lock; a full or empty
+ * ring is detected without touching the other side's counter.
+ *
+ * ring_push and ring_pop block when the ring is full or empty.
+ * They wait on POSIX counting semaphores (futex-based in glibc,
+ * so an uncontended post or wait does not enter the kernel): one
+ * counts items, the other free cells.
+ */
+#ifndef __ring_h
+#define __ring_h
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <semaphore.h>
+
+#define RING_CACHE_LINE 64
+
+typedef struct ring_cell_tag {
+    atomic_size_t       sequence;
+    void                *data;
+} ring_cell_t;
+
+/*
+ * The two position counters are kept on separate cache lines, so
+ * producers and consumers do not invalidate each other's line.
+ */
+typedef struct ring_tag {
+    ring_cell_t         *cells;
+    size_t              mask;   /* capacity - 1 */
+    sem_t               items;  /* cells holding data */
+    sem_t               slots;  /* free cells */
+    char                pad0[RING_CACHE_LINE];
+    atomic_size_t       enqueue_pos;
+    char                pad1[RING_CACHE_LINE - sizeof (atomic_size_t)];
+    atomic_size_t       dequeue_pos;
+    char                pad2[RING_CACHE_LINE - sizeof (atomic_size_t)];
+} ring_t;
+
+extern int ring_init (ring_t *ring, size_t capacity);
+extern void ring_destroy (ring_t *ring);
+extern size_t ring_push (ring_t *ring, void *data, long *blocked_ns);
+extern void *ring_pop (ring_t *ring, size_t *index);
+extern size_t ring_count (ring_t *ring);
+
+#endif
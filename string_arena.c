@@ -0,0 +1,183 @@
+/*
+ * string_arena.c
+ *
+ * Interned string arena. See string_arena.h.
+ */
+#include "string_arena.h"
+#include "errors.h"
+
+#define STRING_ARENA_MIN_BUCKETS        256
+#define STRING_ARENA_SLAB_OBJECTS       64
+
+/*
+ * Entry sizes (header and text) of the size classes.
+ */
+static const size_t string_arena_sizes[STRING_ARENA_CLASSES] = {
+    32, 64, 96, 160
+};
+
+#define string_entry_of(text) \
+    ((string_entry_t*)((char*)(text) - offsetof (string_entry_t, text)))
+
+/*
+ * FNV-1a hash of a string.
+ */
+static unsigned int string_hash (const char *text)
+{
+    unsigned int hash = 2166136261U;
+
+    while (*text != '\0') {
+        hash ^= (unsigned char)*text++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * Double the number of hash buckets (or allocate the first
+ * ones), and rechain every entry.
+ */
+static void string_arena_grow (string_arena_t *arena)
+{
+    string_entry_t **old = arena->buckets, *entry;
+    int old_count = arena->bucket_count;
+    int bucket;
+
+    arena->bucket_count = old_count == 0
+        ? STRING_ARENA_MIN_BUCKETS : old_count * 2;
+    arena->buckets = (string_entry_t**)calloc (
+        arena->bucket_count, sizeof (string_entry_t*));
+    if (arena->buckets == NULL)
+        errno_abort ("Grow string arena");
+    for (bucket = 0; bucket < old_count; bucket++) {
+        while ((entry = old[bucket]) != NULL) {
+            old[bucket] = entry->next;
+            entry->next = arena->buckets[
+                entry->hash & (arena->bucket_count - 1)];
+            arena->buckets[entry->hash & (arena->bucket_count - 1)] = entry;
+        }
+    }
+    free (old);
+}
+
+/*
+ * Initialize an empty arena. "name" labels its mutex in the lock
+ * profile, and its pools' mutexes are labelled "name" and their
+ * size class. Returns 0, or an error number.
+ */
+int string_arena_init (string_arena_t *arena, const char *name)
+{
+    int i, status;
+
+    status = profiled_mutex_init (&arena->mutex, name);
+    if (status != 0)
+        return status;
+    arena->buckets = NULL;
+    arena->bucket_count = 0;
+    arena->count = 0;
+    for (i = 0; i < STRING_ARENA_CLASSES; i++) {
+        snprintf (arena->pool_names[i], sizeof (arena->pool_names[i]),
+            "%.32s %zu-byte pool", name, string_arena_sizes[i]);
+        status = pool_init (&arena->pools[i], arena->pool_names[i],
+            string_arena_sizes[i], STRING_ARENA_SLAB_OBJECTS);
+        if (status != 0)
+            return status;
+    }
+    return 0;
+}
+
+/*
+ * Return the interned copy of "text", with a reference for the
+ * caller, or NULL if there is no memory.
+ */
+const char *string_arena_intern (string_arena_t *arena, const char *text)
+{
+    unsigned int hash = string_hash (text);
+    size_t size = offsetof (string_entry_t, text) + strlen (text) + 1;
+    string_entry_t *entry;
+    int size_class, status;
+
+    status = profiled_mutex_lock (&arena->mutex);
+    if (status != 0)
+        err_abort (status, "Lock string arena");
+    if (arena->bucket_count == 0)
+        string_arena_grow (arena);
+    for (entry = arena->buckets[hash & (arena->bucket_count - 1)];
+        entry != NULL; entry = entry->next)
+        if (entry->hash == hash && strcmp (entry->text, text) == 0)
+            break;
+    if (entry != NULL)
+        entry->refs++;
+    else {
+        for (size_class = 0; size_class < STRING_ARENA_CLASSES; size_class++)
+            if (size <= string_arena_sizes[size_class])
+                break;
+        if (size_class < STRING_ARENA_CLASSES)
+            entry = (string_entry_t*)pool_alloc (&arena->pools[size_class]);
+        else {
+            size_class = -1;
+            entry = (string_entry_t*)malloc (size);
+        }
+        if (entry != NULL) {
+            entry->hash = hash;
+            entry->refs = 1;
+            entry->size_class = size_class;
+            strcpy (entry->text, text);
+            if (++arena->count > arena->bucket_count * 2)
+                string_arena_grow (arena);
+            entry->next = arena->buckets[hash & (arena->bucket_count - 1)];
+            arena->buckets[hash & (arena->bucket_count - 1)] = entry;
+        }
+    }
+    status = profiled_mutex_unlock (&arena->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock string arena");
+    return entry == NULL ? NULL : entry->text;
+}
+
+/*
+ * Take another reference to an interned string.
+ */
+void string_arena_hold (string_arena_t *arena, const char *text)
+{
+    int status;
+
+    status = profiled_mutex_lock (&arena->mutex);
+    if (status != 0)
+        err_abort (status, "Lock string arena");
+    string_entry_of (text)->refs++;
+    status = profiled_mutex_unlock (&arena->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock string arena");
+}
+
+/*
+ * Drop a reference to an interned string, freeing it when the
+ * last one goes. "text" may be NULL.
+ */
+void string_arena_release (string_arena_t *arena, const char *text)
+{
+    string_entry_t *entry, **link;
+    int status;
+
+    if (text == NULL)
+        return;
+    entry = string_entry_of (text);
+    status = profiled_mutex_lock (&arena->mutex);
+    if (status != 0)
+        err_abort (status, "Lock string arena");
+    if (--entry->refs == 0) {
+        link = &arena->buckets[entry->hash & (arena->bucket_count - 1)];
+        while (*link != entry)
+            link = &(*link)->next;
+        *link = entry->next;
+        arena->count--;
+        if (entry->size_class < 0)
+            free (entry);
+        else
+            pool_free (&arena->pools[entry->size_class], entry);
+    }
+    status = profiled_mutex_unlock (&arena->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock string arena");
+}
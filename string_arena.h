@@ -0,0 +1,50 @@
+/*
+ * string_arena.h
+ *
+ * Interned, reference-counted strings. Interning a string returns
+ * a shared read-only copy, so equal strings are stored once and
+ * compare equal as pointers; a structure holding one needs only a
+ * pointer instead of a fixed-size character array.
+ *
+ * Strings are stored in a few size classes, each an object pool
+ * (pool.c), so short strings take little memory and interning
+ * does not usually call malloc. A string too long for the largest
+ * class is malloc'd.
+ *
+ * The arena has its own mutex, so any thread may intern or
+ * release strings. It is a profiled_mutex_t (lock_profile.h), as
+ * are its pools', named after the arena.
+ */
+#ifndef __string_arena_h
+#define __string_arena_h
+
+#include <pthread.h>
+#include "pool.h"
+#include "lock_profile.h"
+
+#define STRING_ARENA_CLASSES    4
+
+typedef struct string_entry_tag {
+    struct string_entry_tag *next;  /* hash chain */
+    unsigned int        hash;
+    int                 refs;
+    int                 size_class; /* -1 if malloc'd */
+    char                text[];
+} string_entry_t;
+
+typedef struct string_arena_tag {
+    profiled_mutex_t    mutex;
+    string_entry_t      **buckets;
+    int                 bucket_count;   /* a power of 2 */
+    int                 count;
+    pool_t              pools[STRING_ARENA_CLASSES];
+    char                pool_names[STRING_ARENA_CLASSES][64];
+} string_arena_t;
+
+extern int string_arena_init (string_arena_t *arena, const char *name);
+extern const char *string_arena_intern (
+    string_arena_t *arena, const char *text);
+extern void string_arena_hold (string_arena_t *arena, const char *text);
+extern void string_arena_release (string_arena_t *arena, const char *text);
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * tick_clock.c
+ *
+ * The clock for alarm times. See tick_clock.h.
+ */
+#include <limits.h>
+#include "tick_clock.h"
+#include "errors.h"
+
+#define NSEC_PER_SEC    1000000000LL
+
+static int tick_clock_rate = TICK_CLOCK_SECONDS;
+static clockid_t tick_clock_id = CLOCK_REALTIME;
+
+/*
+ * Select the tick: TICK_CLOCK_SECONDS or TICK_CLOCK_MILLISECONDS.
+ * Call before any times are taken. Returns 0, or EINVAL.
+ */
+int tick_clock_init (int ticks_per_second)
+{
+    if (ticks_per_second == TICK_CLOCK_SECONDS)
+        tick_clock_id = CLOCK_REALTIME;
+    else if (ticks_per_second == TICK_CLOCK_MILLISECONDS)
+        tick_clock_id = CLOCK_MONOTONIC;
+    else
+        return EINVAL;
+    tick_clock_rate = ticks_per_second;
+    return 0;
+}
+
+/*
+ * Read the tick clock, to the nanosecond.
+ */
+static void tick_clock_read (struct timespec *now)
+{
+    if (clock_gettime (tick_clock_id, now) != 0)
+        errno_abort ("Get time");
+}
+
+/*
+ * Return the current time in ticks. This reads the same clock
+ * as tick_clock_timedwait, rather than time(), which may read a
+ * coarser clock that lags it; a thread woken at its deadline
+ * would otherwise see the deadline as not yet reached and spin.
+ */
+time_t tick_clock_now (void)
+{
+    struct timespec now;
+
+    tick_clock_read (&now);
+    return now.tv_sec * tick_clock_rate
+        + now.tv_nsec / (NSEC_PER_SEC / tick_clock_rate);
+}
+
+/*
+ * Return the time "ticks" ticks from now, rounded up to a whole
+ * tick, for a deadline. tick_clock_now drops the part of a tick
+ * that has passed, so adding to it would give a deadline up to a
+ * tick early.
+ */
+time_t tick_clock_deadline (time_t ticks)
+{
+    struct timespec now;
+    time_t tick_ns = NSEC_PER_SEC / tick_clock_rate;
+
+    tick_clock_read (&now);
+    return now.tv_sec * tick_clock_rate
+        + (now.tv_nsec + tick_ns - 1) / tick_ns + ticks;
+}
+
+/*
+ * Set "deadline" to the time "seconds" from now, rounded up to a
+ * whole tick as by tick_clock_deadline. Returns 0, or -1 if
+ * "seconds" is not a number, or puts the deadline further from 0
+ * than tick_clock_monotonic can handle: a deadline is converted to
+ * nanoseconds in a long long.
+ */
+int tick_clock_after (double seconds, time_t *deadline)
+{
+    time_t now = tick_clock_deadline (0);
+    double limit = (double)(LLONG_MAX / (NSEC_PER_SEC / tick_clock_rate)
+        - now - 1);
+    double ticks = seconds * tick_clock_rate;
+
+    if (!(ticks >= -limit && ticks <= limit))
+        return -1;
+    *deadline = now + tick_clock_ticks (seconds);
+    return 0;
+}
+
+/*
+ * Convert a number of seconds, which may have a fraction, to the
+ * nearest number of ticks.
+ */
+time_t tick_clock_ticks (double seconds)
+{
+    double ticks = seconds * tick_clock_rate;
+
+    return (time_t)(ticks < 0 ? ticks - 0.5 : ticks + 0.5);
+}
+
+/*
+ * Convert a number of ticks to seconds.
+ */
+double tick_clock_seconds (time_t ticks)
+{
+    return (double)ticks / tick_clock_rate;
+}
+
+/*
+ * Return how far the tick clock is ahead of CLOCK_MONOTONIC, in
+ * nanoseconds (0 in high-resolution mode, where they are the same
+ * clock), so that a monotonic timestamp can be turned into ticks.
+ */
+long long tick_clock_offset (void)
+{
+    struct timespec now, monotonic;
+
+    if (tick_clock_id == CLOCK_MONOTONIC)
+        return 0;
+    tick_clock_read (&now);
+    if (clock_gettime (CLOCK_MONOTONIC, &monotonic) != 0)
+        errno_abort ("Get time");
+    return ((long long)now.tv_sec - monotonic.tv_sec) * NSEC_PER_SEC
+        + (now.tv_nsec - monotonic.tv_nsec);
+}
+
+/*
+ * Return the nanoseconds since the tick clock reached "deadline",
+ * or a negative number if it has not yet.
+ */
+long long tick_clock_since (time_t deadline)
+{
+    struct timespec now;
+
+    tick_clock_read (&now);
+    return (long long)now.tv_sec * NSEC_PER_SEC + now.tv_nsec
+        - (long long)deadline * (NSEC_PER_SEC / tick_clock_rate);
+}
+
+/*
+ * Initialize a condition variable whose timed waits use
+ * CLOCK_MONOTONIC. Returns 0, or an error number.
+ */
+int tick_clock_cond_init (pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    int status;
+
+    status = pthread_condattr_init (&attr);
+    if (status != 0)
+        return status;
+    status = pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    if (status == 0)
+        status = pthread_cond_init (cond, &attr);
+    pthread_condattr_destroy (&attr);
+    return status;
+}
+
+/*
+ * Set "when" to the CLOCK_MONOTONIC time at which the tick clock
+ * will reach "deadline", to the nanosecond. Returns 0, or -1 if
+ * the deadline has already passed.
+ */
+int tick_clock_monotonic (time_t deadline, struct timespec *when)
+{
+    struct timespec now;
+    long long wait_ns;
+
+    tick_clock_read (&now);
+    wait_ns = (long long)deadline * (NSEC_PER_SEC / tick_clock_rate)
+        - ((long long)now.tv_sec * NSEC_PER_SEC + now.tv_nsec);
+    if (wait_ns <= 0)
+        return -1;
+    if (clock_gettime (CLOCK_MONOTONIC, when) != 0)
+        errno_abort ("Get time");
+    when->tv_sec += wait_ns / NSEC_PER_SEC;
+    when->tv_nsec += wait_ns % NSEC_PER_SEC;
+    if (when->tv_nsec >= NSEC_PER_SEC) {
+        when->tv_sec++;
+        when->tv_nsec -= NSEC_PER_SEC;
+    }
+    return 0;
+}
+
+/*
+ * Wait on "cond", which must have been initialized with
+ * tick_clock_cond_init, until it is signalled or the tick clock
+ * reaches "deadline". Returns 0, ETIMEDOUT (at once, if the
+ * deadline has passed), or an error number.
+ */
+int tick_clock_timedwait (
+    pthread_cond_t *cond, pthread_mutex_t *mutex, time_t deadline)
+{
+    struct timespec cond_time;
+
+    if (tick_clock_monotonic (deadline, &cond_time) != 0)
+        return ETIMEDOUT;
+    return pthread_cond_timedwait (cond, mutex, &cond_time);
+}
@@ -0,0 +1,39 @@
+/*
+ * tick_clock.h
+ *
+ * The clock that alarm times are measured on. Times are integer
+ * "ticks", so the timer queues can hold them in a timer_node_t.
+ * By default a tick is one second of the wall clock, as returned
+ * by time(). In high-resolution mode ("-m" in both programs), a
+ * tick is one millisecond of CLOCK_MONOTONIC, which setting the
+ * clock does not move.
+ *
+ * In either mode, timed waits are measured on CLOCK_MONOTONIC: a
+ * condition variable created with tick_clock_cond_init() is set
+ * to use it, and tick_clock_timedwait() converts a deadline in
+ * ticks into a monotonic time to the nanosecond, with
+ * tick_clock_monotonic() (which also serves to arm a timerfd).
+ */
+#ifndef __tick_clock_h
+#define __tick_clock_h
+
+#include <pthread.h>
+#include <time.h>
+
+#define TICK_CLOCK_SECONDS      1       /* ticks per second */
+#define TICK_CLOCK_MILLISECONDS 1000
+
+extern int tick_clock_init (int ticks_per_second);
+extern time_t tick_clock_now (void);
+extern time_t tick_clock_deadline (time_t ticks);
+extern int tick_clock_after (double seconds, time_t *deadline);
+extern time_t tick_clock_ticks (double seconds);
+extern double tick_clock_seconds (time_t ticks);
+extern int tick_clock_monotonic (time_t deadline, struct timespec *when);
+extern long long tick_clock_offset (void);
+extern long long tick_clock_since (time_t deadline);
+extern int tick_clock_cond_init (pthread_cond_t *cond);
+extern int tick_clock_timedwait (
+    pthread_cond_t *cond, pthread_mutex_t *mutex, time_t deadline);
+
+#endif
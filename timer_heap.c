@@ -0,0 +1,186 @@
+/*
+ * timer_heap.c
+ *
+ * Binary min-heap of timer nodes. See timer_heap.h.
+ */
+#include "timer_heap.h"
+#include "errors.h"
+
+#define TIMER_HEAP_MIN_SIZE 64
+
+/*
+ * Store a node in a heap slot, keeping the node's back-pointer
+ * to its slot current.
+ */
+static void timer_heap_set (timer_heap_t *heap, int index, timer_node_t *node)
+{
+    heap->nodes[index] = node;
+    node->index = index;
+}
+
+/*
+ * Move the node at "index" toward the root until its parent
+ * expires no later than it does.
+ */
+static void timer_heap_sift_up (timer_heap_t *heap, int index)
+{
+    timer_node_t *node = heap->nodes[index];
+    int parent;
+
+    while (index > 0) {
+        parent = (index - 1) / 2;
+        if (heap->nodes[parent]->time <= node->time)
+            break;
+        timer_heap_set (heap, index, heap->nodes[parent]);
+        index = parent;
+    }
+    timer_heap_set (heap, index, node);
+}
+
+/*
+ * Move the node at "index" away from the root until neither
+ * child expires earlier than it does.
+ */
+static void timer_heap_sift_down (timer_heap_t *heap, int index)
+{
+    timer_node_t *node = heap->nodes[index];
+    int child;
+
+    while ((child = 2 * index + 1) < heap->count) {
+        if (child + 1 < heap->count
+            && heap->nodes[child + 1]->time < heap->nodes[child]->time)
+            child++;
+        if (node->time <= heap->nodes[child]->time)
+            break;
+        timer_heap_set (heap, index, heap->nodes[child]);
+        index = child;
+    }
+    timer_heap_set (heap, index, node);
+}
+
+void timer_node_init (timer_node_t *node, time_t time)
+{
+    node->time = time;
+    node->index = -1;
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+/*
+ * Release the heap's slot array. The nodes themselves belong to
+ * the caller.
+ */
+void timer_heap_destroy (timer_heap_t *heap)
+{
+    free (heap->nodes);
+    heap->nodes = NULL;
+    heap->count = heap->size = 0;
+}
+
+/*
+ * Grow the slot array, if necessary, to hold "count" nodes.
+ */
+static void timer_heap_reserve (timer_heap_t *heap, int count)
+{
+    timer_node_t **nodes;
+    int size;
+
+    if (count <= heap->size)
+        return;
+    size = heap->size == 0 ? TIMER_HEAP_MIN_SIZE : heap->size;
+    while (size < count)
+        size *= 2;
+    nodes = (timer_node_t**)realloc (
+        heap->nodes, size * sizeof (timer_node_t*));
+    if (nodes == NULL)
+        errno_abort ("Grow timer heap");
+    heap->nodes = nodes;
+    heap->size = size;
+}
+
+/*
+ * Add a node to the heap, growing the slot array if necessary.
+ */
+void timer_heap_insert (timer_heap_t *heap, timer_node_t *node)
+{
+    timer_heap_reserve (heap, heap->count + 1);
+    timer_heap_set (heap, heap->count++, node);
+    timer_heap_sift_up (heap, node->index);
+}
+
+/*
+ * Add "count" nodes at once. When they are many compared with
+ * the heap, it is cheaper to append them all and rebuild the heap
+ * bottom-up, which is O(n), than to sift each one up, which is
+ * O(log n) apiece; so a heap built from a bulk load is made in one
+ * pass.
+ */
+void timer_heap_insert_many (
+    timer_heap_t *heap, timer_node_t **nodes, int count)
+{
+    int total = heap->count + count, depth = 0, i;
+
+    timer_heap_reserve (heap, total);
+    for (i = 1; i < total; i *= 2)
+        depth++;
+    if ((long)count * depth <= 2L * total) {
+        for (i = 0; i < count; i++) {
+            timer_heap_set (heap, heap->count++, nodes[i]);
+            timer_heap_sift_up (heap, heap->count - 1);
+        }
+        return;
+    }
+    for (i = 0; i < count; i++)
+        timer_heap_set (heap, heap->count++, nodes[i]);
+    for (i = total / 2 - 1; i >= 0; i--)
+        timer_heap_sift_down (heap, i);
+}
+
+/*
+ * Remove a node from wherever it is in the heap. The last node
+ * is moved into the vacated slot and then sifted whichever way
+ * restores the heap order.
+ */
+void timer_heap_remove (timer_heap_t *heap, timer_node_t *node)
+{
+    int index = node->index;
+    timer_node_t *last;
+
+    if (index < 0)
+        return;
+    node->index = -1;
+    last = heap->nodes[--heap->count];
+    if (last == node)
+        return;
+    timer_heap_set (heap, index, last);
+    timer_heap_update (heap, last);
+}
+
+/*
+ * Restore the heap order after the caller has changed the
+ * expiration time of a queued node.
+ */
+void timer_heap_update (timer_heap_t *heap, timer_node_t *node)
+{
+    int index = node->index;
+
+    if (index < 0)
+        return;
+    if (index > 0 && heap->nodes[(index - 1) / 2]->time > node->time)
+        timer_heap_sift_up (heap, index);
+    else
+        timer_heap_sift_down (heap, index);
+}
+
+/*
+ * Remove and return the earliest node, or NULL if the heap is
+ * empty.
+ */
+timer_node_t *timer_heap_pop (timer_heap_t *heap)
+{
+    timer_node_t *node = timer_heap_peek (heap);
+
+    if (node != NULL)
+        timer_heap_remove (heap, node);
+    return node;
+}
@@ -0,0 +1,69 @@
+/*
+ * timer_heap.h
+ *
+ * A binary min-heap of timers, ordered by expiration time. It
+ * replaces the sorted singly-linked alarm list: inserting and
+ * removing a timer are O(log n), and the earliest timer is always
+ * at the root, so finding it is O(1).
+ *
+ * The heap is "intrusive": the caller embeds a timer_node_t in
+ * its own structure (for example, the alarm_t) and the heap only
+ * stores pointers to the nodes. Each node remembers its own slot
+ * in the heap, so a timer can be removed, or moved after its
+ * expiration time changes, by handle without searching for it.
+ * Use timer_entry() to get from a node back to the structure that
+ * contains it.
+ *
+ * The heap does no locking of its own; the caller must serialize
+ * access (in the alarm programs, by holding alarm_mutex).
+ */
+#ifndef __timer_heap_h
+#define __timer_heap_h
+
+#include <stddef.h>
+#include <time.h>
+
+typedef struct timer_node_tag {
+    time_t              time;   /* in ticks, see tick_clock.h */
+    int                 index;  /* queue slot, -1 if not queued */
+    struct timer_node_tag *next;    /* slot list (timer_wheel.c) */
+    struct timer_node_tag **pprev;
+} timer_node_t;
+
+typedef struct timer_heap_tag {
+    timer_node_t        **nodes;
+    int                 count;
+    int                 size;   /* allocated slots in nodes */
+} timer_heap_t;
+
+#define TIMER_HEAP_INITIALIZER {NULL, 0, 0}
+
+/*
+ * Return a pointer to the structure of the given type that
+ * contains the timer_node_t "node" as the field "member".
+ */
+#define timer_entry(node,type,member) \
+    ((type*)((char*)(node) - offsetof (type, member)))
+
+extern void timer_node_init (timer_node_t *node, time_t time);
+extern void timer_heap_destroy (timer_heap_t *heap);
+extern void timer_heap_insert (timer_heap_t *heap, timer_node_t *node);
+extern void timer_heap_insert_many (
+    timer_heap_t *heap, timer_node_t **nodes, int count);
+extern void timer_heap_remove (timer_heap_t *heap, timer_node_t *node);
+extern void timer_heap_update (timer_heap_t *heap, timer_node_t *node);
+extern timer_node_t *timer_heap_pop (timer_heap_t *heap);
+
+/*
+ * Return the earliest timer without removing it, or NULL if the
+ * heap is empty.
+ */
+#define timer_heap_peek(heap) \
+    ((heap)->count > 0 ? (heap)->nodes[0] : NULL)
+
+/*
+ * Nonzero if the node is currently on a heap (or wheel).
+ */
+#define timer_node_queued(node) ((node)->index >= 0)
+
+#endif
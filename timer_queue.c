@@ -0,0 +1,141 @@
+/*
+ * timer_queue.c
+ *
+ * Dispatch timer queue operations to the heap or the wheel. See
+ * timer_queue.h.
+ */
+#include "timer_queue.h"
+#include "errors.h"
+
+/*
+ * Translate a backend name from the command line. Returns 0 on
+ * success, or -1 if the name is not recognized.
+ */
+int timer_queue_kind_parse (const char *name, timer_queue_kind_t *kind)
+{
+    if (strcmp (name, "heap") == 0)
+        *kind = TIMER_QUEUE_HEAP;
+    else if (strcmp (name, "wheel") == 0)
+        *kind = TIMER_QUEUE_WHEEL;
+    else
+        return -1;
+    return 0;
+}
+
+void timer_queue_init (
+    timer_queue_t *queue, timer_queue_kind_t kind, time_t now)
+{
+    queue->kind = kind;
+    if (kind == TIMER_QUEUE_WHEEL)
+        timer_wheel_init (&queue->wheel, now);
+    else {
+        queue->heap.nodes = NULL;
+        queue->heap.count = queue->heap.size = 0;
+    }
+}
+
+void timer_queue_destroy (timer_queue_t *queue)
+{
+    if (queue->kind == TIMER_QUEUE_HEAP)
+        timer_heap_destroy (&queue->heap);
+}
+
+void timer_queue_insert (timer_queue_t *queue, timer_node_t *node)
+{
+    if (queue->kind == TIMER_QUEUE_WHEEL)
+        timer_wheel_insert (&queue->wheel, node);
+    else
+        timer_heap_insert (&queue->heap, node);
+}
+
+/*
+ * Add "count" nodes at once, as for a bulk load.
+ */
+void timer_queue_insert_many (
+    timer_queue_t *queue, timer_node_t **nodes, int count)
+{
+    if (queue->kind == TIMER_QUEUE_WHEEL)
+        timer_wheel_insert_many (&queue->wheel, nodes, count);
+    else
+        timer_heap_insert_many (&queue->heap, nodes, count);
+}
+
+void timer_queue_remove (timer_queue_t *queue, timer_node_t *node)
+{
+    if (queue->kind == TIMER_QUEUE_WHEEL)
+        timer_wheel_remove (&queue->wheel, node);
+    else
+        timer_heap_remove (&queue->heap, node);
+}
+
+/*
+ * Reposition a queued node after the caller has changed its
+ * expiration time. Does nothing if the node is not queued.
+ */
+void timer_queue_update (timer_queue_t *queue, timer_node_t *node)
+{
+    if (queue->kind == TIMER_QUEUE_WHEEL)
+        timer_wheel_update (&queue->wheel, node);
+    else
+        timer_heap_update (&queue->heap, node);
+}
+
+/*
+ * Remove and return one node whose expiration time is no later
+ * than "now", or NULL if there is none.
+ */
+timer_node_t *timer_queue_pop_expired (timer_queue_t *queue, time_t now)
+{
+    timer_node_t *node;
+
+    if (queue->kind == TIMER_QUEUE_WHEEL)
+        return timer_wheel_pop_expired (&queue->wheel, now);
+    node = timer_heap_peek (&queue->heap);
+    if (node == NULL || node->time > now)
+        return NULL;
+    timer_heap_remove (&queue->heap, node);
+    return node;
+}
+
+/*
+ * Return the time at which the caller should next look for
+ * expired nodes, or 0 if the queue is empty. For the heap this is
+ * the earliest expiration time; the wheel may ask to be woken
+ * earlier, to cascade.
+ */
+time_t timer_queue_next (timer_queue_t *queue)
+{
+    timer_node_t *node;
+
+    if (queue->kind == TIMER_QUEUE_WHEEL)
+        return timer_wheel_next (&queue->wheel);
+    node = timer_heap_peek (&queue->heap);
+    return node == NULL ? 0 : node->time;
+}
+
+int timer_queue_count (timer_queue_t *queue)
+{
+    if (queue->kind == TIMER_QUEUE_WHEEL)
+        return queue->wheel.count;
+    return queue->heap.count;
+}
+
+/*
+ * Iterate over every queued node, in no particular order. The
+ * queue must not be modified during the iteration.
+ */
+timer_node_t *timer_queue_first (timer_queue_t *queue)
+{
+    if (queue->kind == TIMER_QUEUE_WHEEL)
+        return timer_wheel_first (&queue->wheel);
+    return timer_heap_peek (&queue->heap);
+}
+
+timer_node_t *timer_queue_iter_next (timer_queue_t *queue, timer_node_t *node)
+{
+    if (queue->kind == TIMER_QUEUE_WHEEL)
+        return timer_wheel_iter_next (&queue->wheel, node);
+    if (node->index + 1 < queue->heap.count)
+        return queue->heap.nodes[node->index + 1];
+    return NULL;
+}
@@ -0,0 +1,49 @@
+/*
+ * timer_queue.h
+ *
+ * A timer queue that is backed by either the binary heap
+ * (timer_heap.c) or the hierarchical timing wheel (timer_wheel.c),
+ * chosen when the queue is initialized. The heap is exact and
+ * compact; the wheel makes insert, cancel, reschedule and expiry
+ * O(1) for very large numbers of timers.
+ *
+ * Both programs let the user pick the backend at startup with
+ * "-q heap" or "-q wheel".
+ */
+#ifndef __timer_queue_h
+#define __timer_queue_h
+
+#include "timer_heap.h"
+#include "timer_wheel.h"
+
+typedef enum timer_queue_kind_tag {
+    TIMER_QUEUE_HEAP,
+    TIMER_QUEUE_WHEEL
+} timer_queue_kind_t;
+
+typedef struct timer_queue_tag {
+    timer_queue_kind_t  kind;
+    union {
+        timer_heap_t    heap;
+        timer_wheel_t   wheel;
+    };
+} timer_queue_t;
+
+extern int timer_queue_kind_parse (const char *name, timer_queue_kind_t *kind);
+extern void timer_queue_init (
+    timer_queue_t *queue, timer_queue_kind_t kind, time_t now);
+extern void timer_queue_destroy (timer_queue_t *queue);
+extern void timer_queue_insert (timer_queue_t *queue, timer_node_t *node);
+extern void timer_queue_insert_many (
+    timer_queue_t *queue, timer_node_t **nodes, int count);
+extern void timer_queue_remove (timer_queue_t *queue, timer_node_t *node);
+extern void timer_queue_update (timer_queue_t *queue, timer_node_t *node);
+extern timer_node_t *timer_queue_pop_expired (
+    timer_queue_t *queue, time_t now);
+extern time_t timer_queue_next (timer_queue_t *queue);
+extern int timer_queue_count (timer_queue_t *queue);
+extern timer_node_t *timer_queue_first (timer_queue_t *queue);
+extern timer_node_t *timer_queue_iter_next (
+    timer_queue_t *queue, timer_node_t *node);
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * timer_wheel.c
+ *
+ * Hierarchical timing wheel. See timer_wheel.h.
+ */
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_ROOT_MASK   (TIMER_WHEEL_ROOT_SIZE - 1)
+#define TIMER_WHEEL_LEVEL_MASK  (TIMER_WHEEL_LEVEL_SIZE - 1)
+
+/*
+ * Slot number of entry "index" of outer wheel "level" (1 and up).
+ */
+#define timer_wheel_level_slot(level,index) \
+    (TIMER_WHEEL_ROOT_SIZE + ((level) - 1) * TIMER_WHEEL_LEVEL_SIZE \
+        + (index))
+
+/*
+ * Pick the slot for a timer, relative to the wheel's current
+ * tick. A timer that is already due goes on the current tick's
+ * slot; a timer beyond the range of the outermost wheel is parked
+ * in its farthest slot, and placed again when that slot cascades.
+ */
+static int timer_wheel_slot (timer_wheel_t *wheel, time_t time)
+{
+    time_t delta;
+    int level, shift;
+
+    if (time < wheel->current)
+        time = wheel->current;
+    delta = time - wheel->current;
+    if (delta < TIMER_WHEEL_ROOT_SIZE)
+        return (int)(time & TIMER_WHEEL_ROOT_MASK);
+    shift = TIMER_WHEEL_ROOT_BITS;
+    for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (delta < (time_t)1 << (shift + TIMER_WHEEL_LEVEL_BITS)
+            || level == TIMER_WHEEL_LEVELS - 1)
+            break;
+        shift += TIMER_WHEEL_LEVEL_BITS;
+    }
+    if (delta >= (time_t)1 << (shift + TIMER_WHEEL_LEVEL_BITS))
+        time = wheel->current
+            + ((time_t)1 << (shift + TIMER_WHEEL_LEVEL_BITS)) - 1;
+    return timer_wheel_level_slot (
+        level, (int)((time >> shift) & TIMER_WHEEL_LEVEL_MASK));
+}
+
+static void timer_wheel_link (
+    timer_wheel_t *wheel, int slot, timer_node_t *node)
+{
+    node->index = slot;
+    node->next = wheel->slots[slot];
+    if (node->next != NULL)
+        node->next->pprev = &node->next;
+    node->pprev = &wheel->slots[slot];
+    wheel->slots[slot] = node;
+}
+
+static void timer_wheel_unlink (timer_node_t *node)
+{
+    *node->pprev = node->next;
+    if (node->next != NULL)
+        node->next->pprev = node->pprev;
+    node->next = NULL;
+    node->pprev = NULL;
+    node->index = -1;
+}
+
+/*
+ * Redistribute the timers of an outer wheel slot, relative to
+ * the current tick.
+ */
+static void timer_wheel_cascade (timer_wheel_t *wheel, int slot)
+{
+    timer_node_t *node, *list = wheel->slots[slot];
+
+    wheel->slots[slot] = NULL;
+    while (list != NULL) {
+        node = list;
+        list = node->next;
+        timer_wheel_link (wheel, timer_wheel_slot (wheel, node->time), node);
+    }
+}
+
+/*
+ * Process the current tick: cascade any outer wheel slots that
+ * have come due, then move the root slot for this tick onto the
+ * expired slot.
+ */
+static void timer_wheel_tick (timer_wheel_t *wheel)
+{
+    time_t tick = wheel->current;
+    timer_node_t *node, *list;
+    int level, index, shift;
+
+    if ((tick & TIMER_WHEEL_ROOT_MASK) == 0) {
+        shift = TIMER_WHEEL_ROOT_BITS;
+        for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            index = (int)((tick >> shift) & TIMER_WHEEL_LEVEL_MASK);
+            timer_wheel_cascade (
+                wheel, timer_wheel_level_slot (level, index));
+            if (index != 0)
+                break;
+            shift += TIMER_WHEEL_LEVEL_BITS;
+        }
+    }
+    list = wheel->slots[tick & TIMER_WHEEL_ROOT_MASK];
+    wheel->slots[tick & TIMER_WHEEL_ROOT_MASK] = NULL;
+    while (list != NULL) {
+        node = list;
+        list = node->next;
+        timer_wheel_link (wheel, TIMER_WHEEL_EXPIRED, node);
+    }
+    wheel->current++;
+}
+
+void timer_wheel_init (timer_wheel_t *wheel, time_t now)
+{
+    int slot;
+
+    for (slot = 0; slot <= TIMER_WHEEL_SLOTS; slot++)
+        wheel->slots[slot] = NULL;
+    wheel->current = now;
+    wheel->count = 0;
+}
+
+void timer_wheel_insert (timer_wheel_t *wheel, timer_node_t *node)
+{
+    timer_wheel_link (wheel, timer_wheel_slot (wheel, node->time), node);
+    wheel->count++;
+}
+
+void timer_wheel_insert_many (
+    timer_wheel_t *wheel, timer_node_t **nodes, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        timer_wheel_insert (wheel, nodes[i]);
+}
+
+void timer_wheel_remove (timer_wheel_t *wheel, timer_node_t *node)
+{
+    if (node->index < 0)
+        return;
+    timer_wheel_unlink (node);
+    wheel->count--;
+}
+
+/*
+ * Move a queued timer to the slot for its new expiration time.
+ */
+void timer_wheel_update (timer_wheel_t *wheel, timer_node_t *node)
+{
+    if (node->index < 0)
+        return;
+    timer_wheel_unlink (node);
+    timer_wheel_link (wheel, timer_wheel_slot (wheel, node->time), node);
+}
+
+/*
+ * Advance the wheel up to "now", and remove and return one timer
+ * that has expired, or NULL if none has. While the wheel is
+ * empty, it simply jumps to "now" rather than ticking through
+ * the idle ticks.
+ */
+timer_node_t *timer_wheel_pop_expired (timer_wheel_t *wheel, time_t now)
+{
+    timer_node_t *node;
+
+    if (wheel->count == 0) {
+        if (wheel->current < now)
+            wheel->current = now;
+        return NULL;
+    }
+    while (wheel->slots[TIMER_WHEEL_EXPIRED] == NULL
+        && wheel->current <= now)
+        timer_wheel_tick (wheel);
+    node = wheel->slots[TIMER_WHEEL_EXPIRED];
+    if (node != NULL)
+        timer_wheel_remove (wheel, node);
+    return node;
+}
+
+/*
+ * Return the earliest time at which the wheel may have work to
+ * do, or 0 if it is empty: either the first occupied root slot,
+ * or the next cascade, whichever comes first. This looks at no
+ * more than one turn of the root wheel.
+ */
+time_t timer_wheel_next (timer_wheel_t *wheel)
+{
+    time_t tick;
+    int i;
+
+    if (wheel->count == 0)
+        return 0;
+    if (wheel->slots[TIMER_WHEEL_EXPIRED] != NULL)
+        return wheel->current - 1;
+    for (i = 0; i < TIMER_WHEEL_ROOT_SIZE; i++) {
+        tick = wheel->current + i;
+        if ((tick & TIMER_WHEEL_ROOT_MASK) == 0)
+            break;
+        if (wheel->slots[tick & TIMER_WHEEL_ROOT_MASK] != NULL)
+            break;
+    }
+    return tick;
+}
+
+/*
+ * Iterate over every queued timer, in no particular order.
+ */
+static timer_node_t *timer_wheel_scan (timer_wheel_t *wheel, int slot)
+{
+    for (; slot <= TIMER_WHEEL_SLOTS; slot++)
+        if (wheel->slots[slot] != NULL)
+            return wheel->slots[slot];
+    return NULL;
+}
+
+timer_node_t *timer_wheel_first (timer_wheel_t *wheel)
+{
+    return timer_wheel_scan (wheel, 0);
+}
+
+timer_node_t *timer_wheel_iter_next (timer_wheel_t *wheel, timer_node_t *node)
+{
+    if (node->next != NULL)
+        return node->next;
+    return timer_wheel_scan (wheel, node->index + 1);
+}
@@ -0,0 +1,58 @@
+/*
+ * timer_wheel.h
+ *
+ * A hierarchical timing wheel with one slot per tick (a second,
+ * or a millisecond in high-resolution mode). The root wheel has
+ * one slot for each of the next 256 ticks; each outer wheel has
+ * 64 slots, each covering a whole turn of the wheel inside it. When the root wheel wraps, the due slot of the next
+ * wheel out is "cascaded": its timers are redistributed to the
+ * inner wheels. Insert, remove and reschedule are O(1), and each
+ * timer is moved at most once per level before it expires, so
+ * expiry is O(1) amortized.
+ *
+ * The wheel uses the same intrusive timer_node_t as the heap
+ * (timer_heap.h), so a caller can switch between them. Each node
+ * sits on a doubly-linked slot list; its index field holds the
+ * slot number.
+ *
+ * Like the heap, the wheel does no locking of its own.
+ */
+#ifndef __timer_wheel_h
+#define __timer_wheel_h
+
+#include "timer_heap.h"
+
+#define TIMER_WHEEL_ROOT_BITS   8
+#define TIMER_WHEEL_LEVEL_BITS  6
+#define TIMER_WHEEL_LEVELS      4       /* root + 3 outer wheels */
+#define TIMER_WHEEL_ROOT_SIZE   (1 << TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_LEVEL_SIZE  (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_SLOTS       (TIMER_WHEEL_ROOT_SIZE + \
+    (TIMER_WHEEL_LEVELS - 1) * TIMER_WHEEL_LEVEL_SIZE)
+
+/*
+ * Timers whose tick has passed wait on an extra "expired" slot
+ * until they are popped.
+ */
+#define TIMER_WHEEL_EXPIRED     TIMER_WHEEL_SLOTS
+
+typedef struct timer_wheel_tag {
+    timer_node_t        *slots[TIMER_WHEEL_SLOTS + 1];
+    time_t              current;        /* next tick to process */
+    int                 count;
+} timer_wheel_t;
+
+extern void timer_wheel_init (timer_wheel_t *wheel, time_t now);
+extern void timer_wheel_insert (timer_wheel_t *wheel, timer_node_t *node);
+extern void timer_wheel_insert_many (
+    timer_wheel_t *wheel, timer_node_t **nodes, int count);
+extern void timer_wheel_remove (timer_wheel_t *wheel, timer_node_t *node);
+extern void timer_wheel_update (timer_wheel_t *wheel, timer_node_t *node);
+extern timer_node_t *timer_wheel_pop_expired (
+    timer_wheel_t *wheel, time_t now);
+extern time_t timer_wheel_next (timer_wheel_t *wheel);
+extern timer_node_t *timer_wheel_first (timer_wheel_t *wheel);
+extern timer_node_t *timer_wheel_iter_next (
+    timer_wheel_t *wheel, timer_node_t *node);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * workload.c
+ *
+ * Command generator for benchmarks. See workload.h.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "workload.h"
+
+/*
+ * Names of the kinds, as used in a mix specification.
+ */
+const char *workload_kind_names[WORKLOAD_KINDS] = {
+    "start", "change", "cancel", "suspend", "reactivate", "view"
+};
+
+/*
+ * The mix a new workload has: mostly Start_Alarms, with some of
+ * every other command.
+ */
+static const unsigned workload_default_mix[WORKLOAD_KINDS] = {
+    60, 15, 10, 5, 5, 5
+};
+
+/*
+ * Initialize a workload whose Start_Alarms use ids from
+ * "first_id" on, with the default mix, 10 groups, 1000 seconds
+ * and an interval of 100. Returns 0, or an error number.
+ */
+int workload_init (workload_t *workload, int first_id, uint64_t seed)
+{
+    int kind;
+
+    workload->mix_total = 0;
+    for (kind = 0; kind < WORKLOAD_KINDS; kind++) {
+        workload->mix[kind] = workload_default_mix[kind];
+        workload->mix_total += workload->mix[kind];
+    }
+    workload->groups = 10;
+    workload->seconds = 1000;
+    workload->interval = 100;
+    workload->next_id = first_id;
+    workload->capacity = 1024;
+    workload->active = (int*)malloc (workload->capacity * sizeof (int));
+    workload->suspended = (int*)malloc (workload->capacity * sizeof (int));
+    if (workload->active == NULL || workload->suspended == NULL) {
+        free (workload->active);
+        free (workload->suspended);
+        return ENOMEM;
+    }
+    workload->active_count = workload->suspended_count = 0;
+    workload->random = seed == 0 ? 88172645463325252ULL : seed;
+    return 0;
+}
+
+void workload_destroy (workload_t *workload)
+{
+    free (workload->active);
+    free (workload->suspended);
+    workload->active = workload->suspended = NULL;
+    workload->capacity = 0;
+}
+
+/*
+ * Set the mix from a specification such as "start=70,cancel=30":
+ * a weight for each kind named, and 0 for the rest. Returns 0, or
+ * EINVAL if the specification does not parse or every weight is 0.
+ */
+int workload_set_mix (workload_t *workload, const char *spec)
+{
+    unsigned mix[WORKLOAD_KINDS] = {0}, total = 0;
+    const char *next = spec;
+    char *end;
+    unsigned long weight;
+    size_t length;
+    int kind;
+
+    while (*next != '\0') {
+        length = strcspn (next, "=");
+        for (kind = 0; kind < WORKLOAD_KINDS; kind++)
+            if (strlen (workload_kind_names[kind]) == length
+                && strncmp (workload_kind_names[kind], next, length) == 0)
+                break;
+        if (kind == WORKLOAD_KINDS || next[length] != '=')
+            return EINVAL;
+        weight = strtoul (next + length + 1, &end, 10);
+        if (end == next + length + 1 || (*end != ',' && *end != '\0')
+            || weight > 1000000)
+            return EINVAL;
+        total += (unsigned)weight - mix[kind];
+        mix[kind] = (unsigned)weight;
+        next = *end == ',' ? end + 1 : end;
+    }
+    if (total == 0)
+        return EINVAL;
+    memcpy (workload->mix, mix, sizeof (mix));
+    workload->mix_total = total;
+    return 0;
+}
+
+/*
+ * Return the next random number.
+ */
+uint64_t workload_random (workload_t *workload)
+{
+    uint64_t x = workload->random;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    workload->random = x;
+    return x * 2685821657736338717ULL;
+}
+
+/*
+ * Take a random id out of a list, moving the last into its place.
+ */
+static int workload_take (workload_t *workload, int *list, int *count)
+{
+    int slot = (int)(workload_random (workload) % (uint64_t)*count);
+    int id = list[slot];
+
+    list[slot] = list[--*count];
+    return id;
+}
+
+/*
+ * Make the next command, as a line ending with a newline, in
+ * "line". Returns its kind, and sets "alarm_id" to the alarm it
+ * names (0 for View_Alarms). Each list of alarms has room for
+ * every live alarm; if a Start_Alarm would need more and the lists
+ * cannot grow, the command is a View_Alarms.
+ */
+workload_kind_t workload_next (
+    workload_t *workload, char *line, size_t size, int *alarm_id)
+{
+    unsigned pick = (unsigned)(workload_random (workload)
+        % workload->mix_total);
+    workload_kind_t kind;
+    int id = 0, group, *list;
+
+    for (kind = 0; pick >= workload->mix[kind]; kind++)
+        pick -= workload->mix[kind];
+    if ((kind == WORKLOAD_CHANGE || kind == WORKLOAD_CANCEL
+            || kind == WORKLOAD_SUSPEND) && workload->active_count == 0)
+        kind = WORKLOAD_START;
+    if (kind == WORKLOAD_REACTIVATE && workload->suspended_count == 0)
+        kind = WORKLOAD_START;
+    if (kind == WORKLOAD_START && workload->active_count
+            + workload->suspended_count == workload->capacity) {
+        list = (int*)realloc (workload->active,
+            workload->capacity * 2 * sizeof (int));
+        if (list != NULL)
+            workload->active = list;
+        list = list == NULL ? NULL : (int*)realloc (workload->suspended,
+            workload->capacity * 2 * sizeof (int));
+        if (list == NULL)
+            kind = WORKLOAD_VIEW;
+        else {
+            workload->suspended = list;
+            workload->capacity *= 2;
+        }
+    }
+    group = 1 + (int)(workload_random (workload)
+        % (uint64_t)workload->groups);
+
+    switch (kind) {
+        case WORKLOAD_START:
+            id = workload->next_id++;
+            workload->active[workload->active_count++] = id;
+            snprintf (line, size, "Start_Alarm(%d): %d %g %g m%d\n",
+                id, group, workload->seconds, workload->interval, id);
+            break;
+        case WORKLOAD_CHANGE:
+            id = workload->active[workload_random (workload)
+                % (uint64_t)workload->active_count];
+            snprintf (line, size, "Change_Alarm(%d): %d %g %g c%d\n",
+                id, group, workload->seconds, workload->interval, id);
+            break;
+        case WORKLOAD_CANCEL:
+            id = workload_take (
+                workload, workload->active, &workload->active_count);
+            snprintf (line, size, "Cancel_Alarm(%d)\n", id);
+            break;
+        case WORKLOAD_SUSPEND:
+            id = workload_take (
+                workload, workload->active, &workload->active_count);
+            workload->suspended[workload->suspended_count++] = id;
+            snprintf (line, size, "Suspend_Alarm(%d)\n", id);
+            break;
+        case WORKLOAD_REACTIVATE:
+            id = workload_take (
+                workload, workload->suspended, &workload->suspended_count);
+            workload->active[workload->active_count++] = id;
+            snprintf (line, size, "Reactivate_Alarm(%d)\n", id);
+            break;
+        default:
+            kind = WORKLOAD_VIEW;
+            snprintf (line, size, "View_Alarms\n");
+            break;
+    }
+    *alarm_id = id;
+    return kind;
+}
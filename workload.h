@@ -0,0 +1,60 @@
+/*
+ * workload.h
+ *
+ * A generator of New_Alarm_cond.c commands, for benchmarks and
+ * load tests: each call makes one command, picked at random from
+ * a mix of Start_Alarm, Change_Alarm, Cancel_Alarm, Suspend_Alarm,
+ * Reactivate_Alarm and View_Alarms in given proportions.
+ *
+ * The generator keeps track of the alarms it has started, so that
+ * every command it makes takes effect: only live alarms are
+ * changed, cancelled or suspended, and only suspended ones are
+ * reactivated. When a command of the kind picked would not (there
+ * is nothing to reactivate, say), it makes a Start_Alarm instead.
+ * This assumes that the alarms do not expire while the workload
+ * runs, so their seconds should be longer than the run.
+ *
+ * The random numbers come from a seeded xorshift generator, so a
+ * seed always gives the same commands.
+ */
+#ifndef __workload_h
+#define __workload_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum workload_kind_tag {
+    WORKLOAD_START,
+    WORKLOAD_CHANGE,
+    WORKLOAD_CANCEL,
+    WORKLOAD_SUSPEND,
+    WORKLOAD_REACTIVATE,
+    WORKLOAD_VIEW,
+    WORKLOAD_KINDS
+} workload_kind_t;
+
+typedef struct workload_tag {
+    unsigned            mix[WORKLOAD_KINDS];    /* relative weights */
+    unsigned            mix_total;
+    int                 groups;         /* groups are 1 to groups */
+    double              seconds;        /* for Start and Change */
+    double              interval;
+    int                 next_id;        /* for the next Start_Alarm */
+    int                 *active;        /* live, not suspended */
+    int                 active_count;
+    int                 *suspended;
+    int                 suspended_count;
+    int                 capacity;       /* of active and suspended */
+    uint64_t            random;         /* xorshift state, never 0 */
+} workload_t;
+
+extern const char *workload_kind_names[WORKLOAD_KINDS];
+
+extern int workload_init (workload_t *workload, int first_id, uint64_t seed);
+extern void workload_destroy (workload_t *workload);
+extern int workload_set_mix (workload_t *workload, const char *spec);
+extern workload_kind_t workload_next (
+    workload_t *workload, char *line, size_t size, int *alarm_id);
+extern uint64_t workload_random (workload_t *workload);
+
+#endif